@@ -3,51 +3,398 @@
 #include "6510.h"
 #include "Files.h"
 #include <stdlib.h>
+#include "DiffBytes.h"
 
 // for now support 1 CPU
 
 static CPU6510* sp6510 = nullptr;
+static size_t sMemoryHistoryBudget = 8 * 1024 * 1024;
 
+// unwritten bytes between two writes in up to date pages are sent along to save a message
+enum { WRITE_GAP = 8 };
 
-CPU6510::CPU6510() : space(VICEMemSpaces::MainMemory), memoryChanged(false)
+
+CPU6510::CPU6510() : space(VICEMemSpaces::MainMemory), memoryChanged(false), memoryReaders(0), memoryGeneration(0),
+	history(nullptr), historyFirst(0), historyCount(0), historyCapacity(0), historyBytes(0),
+	historyBase(nullptr), historyLast(nullptr), knownGeneration(0)
 {
 	IBMutexInit(&memoryUpdateMutex, "CPU memory sync");
-	ram = (uint8_t*)calloc(1, 64 * 1024);
+	// all pages start out as the same cleared page
+	MemoryPage* zero = (MemoryPage*)calloc(1, sizeof(MemoryPage));
+	MemoryMap* map = (MemoryMap*)calloc(1, sizeof(MemoryMap));
+	zero->refs = NUM_PAGES;
+	map->refs = 1;
+	for (int p = 0; p < NUM_PAGES; ++p) { map->pages[p] = zero; }
+	memory = map;
+	for (int p = 0; p < NUM_PAGES; ++p) { pageState[p].store(Page_Valid, std::memory_order_relaxed); }
+	for (int w = 0; w < PAGE_WORDS; ++w) {
+		pagesWanted[w] = 0;
+		pagesShown[w] = 0;
+		knownPages[w] = 0;
+		seenPages[w] = 0;
+		dirtyPages[w] = 0;
+		changedPages[w] = 0;
+		writePages[w] = 0;
+	}
+	memset(changedBytes, 0, sizeof(changedBytes));
+	memset(writeBytes, 0, sizeof(writeBytes));
+	writesPending = false;
+}
+
+CPU6510::~CPU6510()
+{
+	ClearHistory();
+	if (history) { free(history); }
+	ReleaseMemory(memory.exchange(nullptr));
+	for (size_t m = 0, n = retiredMaps.size(); m < n; ++m) { ReleaseMemory(retiredMaps[m]); }
+	IBMutexDestroy(&memoryUpdateMutex);
+}
+
+void CPU6510::MemoryMap::Read(uint16_t addr, uint8_t* dest, size_t bytes) const
+{
+	while (bytes) {
+		size_t offs = addr & (PAGE_SIZE - 1);
+		size_t chunk = PAGE_SIZE - offs;
+		if (chunk > bytes) { chunk = bytes; }
+		memcpy(dest, pages[addr >> PAGE_SHIFT]->bytes + offs, chunk);
+		dest += chunk;
+		bytes -= chunk;
+		addr = (uint16_t)(addr + chunk);
+	}
+}
+
+CPU6510::MemoryMap* CPU6510::AcquireMemory()
+{
+	// replaced maps are kept until no reader is between these two steps
+	memoryReaders.fetch_add(1);
+	MemoryMap* map = memory.load();
+	map->refs.fetch_add(1, std::memory_order_relaxed);
+	memoryReaders.fetch_sub(1);
+	return map;
+}
+
+void CPU6510::ReleaseMemory(MemoryMap* map)
+{
+	if (!map || map->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) { return; }
+	for (int p = 0; p < NUM_PAGES; ++p) {
+		MemoryPage* page = map->pages[p];
+		if (page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) { free(page); }
+	}
+	free(map);
 }
 
-void CPU6510::MemoryFromVICE(uint16_t start, uint16_t end, uint8_t *bytes)
+// publish a new map with the changed pages replaced, pages that end up with
+// the same bytes keep the old page so consecutive stops share them.
+// false if memory ran out, the mirror is left as it was
+bool CPU6510::WriteMemory(uint16_t start, uint32_t bytes, const uint8_t* data)
+{
+	if (!bytes) { return true; }
+	MemoryMap* curr = memory.load();
+	MemoryMap* next = nullptr;
+	for (uint32_t addr = start, left = bytes; left;) {
+		uint32_t p = (addr >> PAGE_SHIFT) & (NUM_PAGES - 1);
+		uint32_t offs = addr & (PAGE_SIZE - 1);
+		uint32_t chunk = PAGE_SIZE - offs;
+		if (chunk > left) { chunk = left; }
+		uint64_t bit = 1ull << (p & 63);
+		uint8_t* bits = (seenPages[p >> 6] & bit) ? changedBytes : nullptr;
+		if (DiffBytes(curr->pages[p]->bytes + offs, data, chunk, addr, bits)) {
+			dirtyPages[p >> 6] |= bit;
+			if (bits) { changedPages[p >> 6] |= bit; }
+			if (!next) {
+				next = (MemoryMap*)malloc(sizeof(MemoryMap));
+				if (!next) { return false; }
+				next->refs = 1;
+				memcpy(next->pages, curr->pages, sizeof(next->pages));
+				for (int c = 0; c < NUM_PAGES; ++c) { next->pages[c]->refs.fetch_add(1, std::memory_order_relaxed); }
+			}
+			MemoryPage* page = next->pages[p];
+			if (page == curr->pages[p]) {
+				// first change to this page in this write
+				MemoryPage* copy = (MemoryPage*)malloc(sizeof(MemoryPage));
+				if (!copy) {
+					ReleaseMemory(next);
+					return false;
+				}
+				copy->refs = 1;
+				memcpy(copy->bytes, page->bytes, PAGE_SIZE);
+				page->refs.fetch_sub(1, std::memory_order_relaxed);
+				next->pages[p] = page = copy;
+			}
+			memcpy(page->bytes + offs, data, chunk);
+		}
+		data += chunk;
+		left -= chunk;
+		addr = (addr + chunk) & 0xffff;
+	}
+	if (next) {
+		memory.store(next);
+		// a reader that loaded a retired map has raised memoryReaders until it holds a ref
+		retiredMaps.push_back(curr);
+		if (!memoryReaders.load()) {
+			for (size_t m = 0, n = retiredMaps.size(); m < n; ++m) { ReleaseMemory(retiredMaps[m]); }
+			retiredMaps.clear();
+		}
+		memoryChanged = true;
+	}
+	return true;
+}
+
+// VICE answers in order so a read only misses the writes sent after it and
+// the ones not sent yet, the local bytes are newer for those
+void CPU6510::KeepLocalWrites(uint16_t start, uint16_t end, uint8_t* bytes, ViceRequest request)
+{
+	size_t keep = 0;
+	for (size_t w = 0, n = writesInFlight.size(); w < n; ++w) {
+		const WriteInFlight& write = writesInFlight[w];
+		if (write.request < request) { continue; }	// done before this read
+		writesInFlight[keep++] = write;
+		uint32_t from = write.start > start ? write.start : start;
+		uint32_t to = write.start + write.bytes - 1;
+		if (to > end) { to = end; }
+		if (from <= to) { ReadMemory((uint16_t)from, bytes + (from - start), to - from + 1); }
+	}
+	writesInFlight.resize(keep);
+	if (!writesPending) { return; }
+	for (uint32_t a = start; a <= end; ++a) {
+		uint32_t page = a >> PAGE_SHIFT;
+		if (!(writePages[page >> 6] & (1ull << (page & 63)))) {
+			a |= PAGE_SIZE - 1;
+			continue;
+		}
+		if (writeBytes[a >> 3] & (1 << (a & 7))) { ReadMemory((uint16_t)a, bytes + (a - start), 1); }
+	}
+}
+
+void CPU6510::MemoryFromVICE(uint16_t start, uint16_t end, uint8_t *bytes, uint32_t generation, ViceRequest request)
 {
 	if (end < start) { return; }
+	KeepLocalWrites(start, end, bytes, request);
 	IBMutexLock(&memoryUpdateMutex);
-	memcpy(ram + start, bytes, (size_t)end - (size_t)start + 1);
-	memoryChanged = true;
+	// first read of a new stop closes the previous one
+	if (generation == memoryGeneration && generation != knownGeneration) {
+		RecordStop();
+		knownGeneration = generation;
+		memset(changedBytes, 0, sizeof(changedBytes));
+		for (int w = 0; w < PAGE_WORDS; ++w) { changedPages[w] = 0; }
+	}
+	if (!WriteMemory(start, (uint32_t)end - (uint32_t)start + 1, bytes)) {
+		// fetched again next time they're wanted
+		for (uint32_t p = start >> PAGE_SHIFT, e = end >> PAGE_SHIFT; p <= e; ++p) {
+			if (pageState[p].load(std::memory_order_relaxed) == Page_Requested) { pageState[p].store(Page_Stale, std::memory_order_relaxed); }
+		}
+		IBMutexRelease(&memoryUpdateMutex);
+		return;
+	}
+	// only pages that were completely covered are up to date
+	for (uint32_t p = ((uint32_t)start + PAGE_SIZE - 1) >> PAGE_SHIFT, e = ((uint32_t)end + 1) >> PAGE_SHIFT;
+		p < e && generation == memoryGeneration; ++p) {
+		pageState[p].store(Page_Valid, std::memory_order_relaxed);
+		knownPages[p >> 6] |= 1ull << (p & 63);
+		seenPages[p >> 6] |= 1ull << (p & 63);
+	}
+	IBMutexRelease(&memoryUpdateMutex);
+}
+
+void CPU6510::PagesInRange(uint64_t* pages, uint32_t start, uint32_t end)
+{
+	start &= 0xffff;
+	if (end < start) { return; }
+	if ((end - start) > 0xffff) { end = start + 0xffff; }
+	if (end > 0xffff) {
+		// views wrap around like the 6502 address space
+		PagesInRange(pages, 0, end & 0xffff);
+		end = 0xffff;
+	}
+	for (uint32_t p = start >> PAGE_SHIFT, e = end >> PAGE_SHIFT; p <= e; ++p) {
+		pages[p >> 6] |= 1ull << (p & 63);
+	}
+}
+
+void CPU6510::WantMemory(uint32_t start, uint32_t end)
+{
+	uint64_t pages[PAGE_WORDS] = {};
+	PagesInRange(pages, start, end);
+	for (int w = 0; w < PAGE_WORDS; ++w) {
+		if (pages[w]) { pagesWanted[w].fetch_or(pages[w], std::memory_order_relaxed); }
+	}
+}
+
+// pages wanted so far this frame and on the last published frame
+void CPU6510::WantedPages(uint64_t* pages)
+{
+	for (int w = 0; w < PAGE_WORDS; ++w) {
+		pages[w] = pagesWanted[w].load(std::memory_order_relaxed) | pagesShown[w].load(std::memory_order_relaxed);
+	}
+}
+
+void CPU6510::PublishWantedMemory()
+{
+	for (int w = 0; w < PAGE_WORDS; ++w) {
+		pagesShown[w].store(pagesWanted[w].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+}
+
+void CPU6510::InvalidateMemory()
+{
+	IBMutexLock(&memoryUpdateMutex);
+	for (int p = 0; p < NUM_PAGES; ++p) { pageState[p].store(Page_Stale, std::memory_order_relaxed); }
+	++memoryGeneration;
+	IBMutexRelease(&memoryUpdateMutex);
+}
+
+bool CPU6510::MemoryValid(uint16_t start, uint16_t end)
+{
+	for (uint32_t p = start >> PAGE_SHIFT, e = end >> PAGE_SHIFT; p <= e; ++p) {
+		if (pageState[p].load(std::memory_order_relaxed) != Page_Valid) { return false; }
+	}
+	return true;
+}
+
+bool CPU6510::NextMemoryRequest(const uint64_t* pages, uint32_t maxPages, uint16_t& start, uint16_t& end)
+{
+	uint64_t mask[PAGE_WORDS];
+	for (int w = 0; w < PAGE_WORDS; ++w) { mask[w] = pages ? pages[w] : ~0ull; }
+	bool found = false;
+	IBMutexLock(&memoryUpdateMutex);
+	for (uint32_t p = 0; p < NUM_PAGES; ++p) {
+		if (pageState[p].load(std::memory_order_relaxed) != Page_Stale || !(mask[p >> 6] & (1ull << (p & 63)))) { continue; }
+		uint32_t last = p;
+		while ((last + 1) < NUM_PAGES && (last + 1 - p) < maxPages && pageState[last + 1].load(std::memory_order_relaxed) == Page_Stale &&
+			(mask[(last + 1) >> 6] & (1ull << ((last + 1) & 63)))) {
+			++last;
+		}
+		for (uint32_t r = p; r <= last; ++r) { pageState[r].store(Page_Requested, std::memory_order_relaxed); }
+		start = (uint16_t)(p << PAGE_SHIFT);
+		end = (uint16_t)(((last + 1) << PAGE_SHIFT) - 1);
+		found = true;
+		break;
+	}
+	IBMutexRelease(&memoryUpdateMutex);
+	return found;
+}
+
+void CPU6510::MemoryRequestFailed(uint16_t start, uint16_t end)
+{
+	IBMutexLock(&memoryUpdateMutex);
+	for (uint32_t p = start >> PAGE_SHIFT, e = end >> PAGE_SHIFT; p <= e; ++p) {
+		if (pageState[p].load(std::memory_order_relaxed) == Page_Requested) { pageState[p].store(Page_Stale, std::memory_order_relaxed); }
+	}
 	IBMutexRelease(&memoryUpdateMutex);
 }
 
 uint8_t CPU6510::GetByte(uint16_t addr)
 {
-	return ram[addr];
+	// reading a stale page asks for it on the next tick
+	uint32_t page = addr >> PAGE_SHIFT;
+	if (pageState[page].load(std::memory_order_relaxed) == Page_Stale) {
+		pagesWanted[page >> 6].fetch_or(1ull << (page & 63), std::memory_order_relaxed);
+	}
+	// memory is only replaced on the UI thread so it can read without a ref
+	return memory.load(std::memory_order_relaxed)->Byte(addr);
 }
 
-const uint8_t* CPU6510::GetMem(uint16_t addr)
+void CPU6510::ReadMemory(uint16_t addr, uint8_t* dest, size_t bytes)
 {
-	return ram + addr;
+	memory.load(std::memory_order_relaxed)->Read(addr, dest, bytes);
 }
 
 void CPU6510::SetByte(uint16_t addr, uint8_t byte)
 {
-	ram[addr] = byte;
+	IBMutexLock(&memoryUpdateMutex);
+	WriteMemory(addr, 1, &byte);
+	IBMutexRelease(&memoryUpdateMutex);
 	memoryChanged = true;
-	ViceSetMemory(addr, 1, ram + addr, space);
+	MarkWrite(addr, 1);
 }
 
 void CPU6510::CopyToRAM(uint16_t address, uint8_t* data, size_t size)
 {
 	uint32_t bytes = 0x10000 - address;
 	if (size_t(bytes) > size) { bytes = (uint32_t)size; }
-	memcpy(ram + address, data, bytes);
+	IBMutexLock(&memoryUpdateMutex);
+	WriteMemory(address, bytes, data);
+	IBMutexRelease(&memoryUpdateMutex);
 	memoryChanged = true;
-	ViceSetMemory(address, bytes, ram + address, space);
+	MarkWrite(address, bytes);
+}
+
+void CPU6510::Upload(uint16_t address, const uint8_t* data, size_t size)
+{
+	uint32_t bytes = 0x10000 - address;
+	if (size_t(bytes) > size) { bytes = (uint32_t)size; }
+	IBMutexLock(&memoryUpdateMutex);
+	WriteMemory(address, bytes, data);
+	IBMutexRelease(&memoryUpdateMutex);
+	memoryChanged = true;
+	// pending writes in the range are covered by the upload
+	for (uint32_t a = address, e = address + bytes; a < e; ++a) {
+		writeBytes[a >> 3] &= ~(1 << (a & 7));
+	}
+	// chunks are answered in order so the last one covers the whole upload
+	if (ViceRequest request = ViceUpload(address, data, bytes, space)) {
+		WriteInFlight write = { request, address, bytes };
+		writesInFlight.push_back(write);
+	}
+}
+
+void CPU6510::MarkWrite(uint16_t start, uint32_t bytes)
+{
+	for (uint32_t a = start, e = start + bytes; a < e; ++a) {
+		if (!(a & 7) && (e - a) >= 8) {
+			writeBytes[a >> 3] = 0xff;
+			a += 7;
+		} else {
+			writeBytes[a >> 3] |= 1 << (a & 7);
+		}
+		writePages[a >> (PAGE_SHIFT + 6)] |= 1ull << ((a >> PAGE_SHIFT) & 63);
+	}
+	writesPending = true;
+}
+
+// send the pending writes as runs, called once per frame and before VICE resumes
+void CPU6510::FlushWrites()
+{
+	if (!writesPending) { return; }
+	writesPending = false;
+	uint32_t runStart = 0, runEnd = 0;	// runEnd is exclusive, 0 means no run
+	for (uint32_t a = 0; a < 0x10000; ++a) {
+		uint32_t page = a >> PAGE_SHIFT;
+		if (!(writePages[page >> 6] & (1ull << (page & 63)))) {
+			a |= PAGE_SIZE - 1;
+			continue;
+		}
+		if (!(writeBytes[a >> 3] & (1 << (a & 7)))) { continue; }
+		bool bridge = runEnd && (a - runEnd) <= WRITE_GAP && (a - runStart) < 0xffff;
+		for (uint32_t g = runEnd; bridge && g < a; g += PAGE_SIZE - (g & (PAGE_SIZE - 1))) {
+			if (pageState[g >> PAGE_SHIFT].load(std::memory_order_relaxed) != Page_Valid) { bridge = false; }
+		}
+		if (runEnd && runEnd == a && (a - runStart) < 0xffff) {
+			++runEnd;
+		} else if (bridge) {
+			runEnd = a + 1;
+		} else {
+			if (runEnd) { SendWrite((uint16_t)runStart, runEnd - runStart); }
+			runStart = a;
+			runEnd = a + 1;
+		}
+	}
+	if (runEnd) { SendWrite((uint16_t)runStart, runEnd - runStart); }
+	memset(writeBytes, 0, sizeof(writeBytes));
+	for (int w = 0; w < PAGE_WORDS; ++w) { writePages[w] = 0; }
+}
+
+void CPU6510::SendWrite(uint16_t start, uint32_t bytes)
+{
+	uint8_t* data = (uint8_t*)malloc(bytes);
+	if (data) {
+		ReadMemory(start, data, bytes);
+		if (ViceRequest request = ViceSetMemory(start, (uint16_t)bytes, data, space)) {
+			WriteInFlight write = { request, start, bytes };
+			writesInFlight.push_back(write);
+		}
+		free(data);
+	}
 }
 
 void CPU6510::ReadPRGToRAM(const char *filename)
@@ -57,18 +404,230 @@ void CPU6510::ReadPRGToRAM(const char *filename)
 		if (uint8_t* file = LoadBinary(filename, size)) {
 			if (size > 2) {
 				uint16_t addr = file[0] + (((uint16_t)file[1]) << 8);
-				CopyToRAM(addr, file + 2, size - 2);
-				free(file);
+				Upload(addr, file + 2, size - 2);
 			}
+			free(file);
 		}
 	}
 }
+// keep the pages of the stop that just ended that changed since the stop before it
+void CPU6510::RecordStop()
+{
+	bool anyKnown = false;
+	for (int w = 0; w < PAGE_WORDS; ++w) { anyKnown = anyKnown || knownPages[w]; }
+	if (!anyKnown) { return; }
+
+	if (historyCount == historyCapacity) {
+		uint32_t capacity = historyCapacity ? 2 * historyCapacity : 256;
+		if (MemoryStop* grown = (MemoryStop*)malloc(sizeof(MemoryStop) * capacity)) {
+			for (uint32_t i = 0; i < historyCount; ++i) { grown[i] = Stop(i); }
+			if (history) { free(history); }
+			history = grown;
+			historyCapacity = capacity;
+			historyFirst = 0;
+		} else if (historyCount < 2 || !DropOldestStop()) {
+			// out of memory, this stop isn't kept
+			for (int w = 0; w < PAGE_WORDS; ++w) { knownPages[w] = 0; }
+			return;
+		}
+	}
+
+	MemoryMap* map = memory.load();
+	MemoryStop& stop = history[(historyFirst + historyCount) % historyCapacity];
+	stop.generation = knownGeneration;
+	stop.regs = regs;
+	stop.numPages = 0;
+	stop.pages = nullptr;
+	for (int w = 0; w < PAGE_WORDS; ++w) {
+		stop.known[w] = knownPages[w];
+		stop.changed[w] = 0;
+		knownPages[w] = 0;
+	}
+	if (!historyBase) {
+		// the first stop is kept whole
+		map->refs.fetch_add(1);
+		historyBase = map;
+	} else {
+		for (int p = 0; p < NUM_PAGES; ++p) {
+			if (map->pages[p] != historyLast->pages[p]) {
+				stop.changed[p >> 6] |= 1ull << (p & 63);
+				++stop.numPages;
+			}
+		}
+		if (stop.numPages) {
+			stop.pages = (MemoryStop::Page*)malloc(sizeof(MemoryStop::Page) * stop.numPages);
+			// out of memory, this stop isn't kept and the next one is compared to the stop before
+			if (!stop.pages) { return; }
+			for (uint32_t p = 0, n = 0; p < NUM_PAGES; ++p) {
+				if (map->pages[p] != historyLast->pages[p]) {
+					map->pages[p]->refs.fetch_add(1);
+					stop.pages[n].index = (uint8_t)p;
+					stop.pages[n++].page = map->pages[p];
+				}
+			}
+		}
+		ReleaseMemory(historyLast);
+	}
+	map->refs.fetch_add(1);
+	historyLast = map;
+	historyBytes += sizeof(MemoryStop) + stop.numPages * (sizeof(MemoryStop::Page) + sizeof(MemoryPage));
+	++historyCount;
+
+	while (historyCount > 1 && historyBytes > sMemoryHistoryBudget && DropOldestStop()) {}
+}
+
+// fold the second oldest stop into the base, false if out of memory
+bool CPU6510::DropOldestStop()
+{
+	MemoryStop& next = Stop(1);
+	MemoryMap* base = historyBase;
+	if (base->refs.load() != 1) {
+		base = (MemoryMap*)malloc(sizeof(MemoryMap));
+		if (!base) { return false; }
+		base->refs = 1;
+		memcpy(base->pages, historyBase->pages, sizeof(base->pages));
+		for (int p = 0; p < NUM_PAGES; ++p) { base->pages[p]->refs.fetch_add(1); }
+		ReleaseMemory(historyBase);
+	}
+	for (uint32_t i = 0; i < next.numPages; ++i) {
+		MemoryPage*& slot = base->pages[next.pages[i].index];
+		if (slot->refs.fetch_sub(1) == 1) { free(slot); }
+		slot = next.pages[i].page;
+	}
+	historyBase = base;
+	// the oldest stop never has pages of its own
+	historyBytes -= sizeof(MemoryStop) + next.numPages * (sizeof(MemoryStop::Page) + sizeof(MemoryPage));
+	if (next.pages) { free(next.pages); }
+	next.pages = nullptr;
+	next.numPages = 0;
+	for (int w = 0; w < PAGE_WORDS; ++w) { next.changed[w] = 0; }
+	historyFirst = (historyFirst + 1) % historyCapacity;
+	--historyCount;
+	return true;
+}
+
+void CPU6510::ClearHistory()
+{
+	for (uint32_t i = 0; i < historyCount; ++i) {
+		MemoryStop& stop = Stop(i);
+		for (uint32_t p = 0; p < stop.numPages; ++p) {
+			if (stop.pages[p].page->refs.fetch_sub(1) == 1) { free(stop.pages[p].page); }
+		}
+		if (stop.pages) { free(stop.pages); }
+	}
+	ReleaseMemory(historyBase);
+	ReleaseMemory(historyLast);
+	historyBase = historyLast = nullptr;
+	historyFirst = historyCount = 0;
+	historyBytes = 0;
+}
+
+bool CPU6510::FindStop(uint32_t stop, uint32_t& index)
+{
+	uint32_t low = 0, high = historyCount;
+	while (low < high) {
+		uint32_t mid = (low + high) >> 1;
+		if (Stop(mid).generation < stop) { low = mid + 1; }
+		else { high = mid; }
+	}
+	index = low;
+	return low < historyCount && Stop(low).generation == stop;
+}
+
+const CPU6510::MemoryPage* CPU6510::PageAtStop(uint32_t index, uint32_t page)
+{
+	for (uint32_t i = index; i > 0; --i) {
+		MemoryStop& stop = Stop(i);
+		if (!(stop.changed[page >> 6] & (1ull << (page & 63)))) { continue; }
+		for (uint32_t p = 0; p < stop.numPages; ++p) {
+			if (stop.pages[p].index == page) { return stop.pages[p].page; }
+		}
+	}
+	return historyBase->pages[page];
+}
+
+uint32_t CPU6510::OldestStop()
+{
+	return historyCount ? Stop(0).generation : knownGeneration;
+}
+
+bool CPU6510::MemoryAtStop(uint32_t stop, uint16_t addr, uint8_t& byte)
+{
+	uint32_t page = addr >> PAGE_SHIFT, index;
+	if (stop == knownGeneration) {
+		if (!(knownPages[page >> 6] & (1ull << (page & 63)))) { return false; }
+		byte = GetByte(addr);
+		return true;
+	}
+	if (!FindStop(stop, index) || !(Stop(index).known[page >> 6] & (1ull << (page & 63)))) { return false; }
+	byte = PageAtStop(index, page)->bytes[addr & (PAGE_SIZE - 1)];
+	return true;
+}
+
+bool CPU6510::RegsAtStop(uint32_t stop, Regs& stopRegs)
+{
+	uint32_t index;
+	if (stop == knownGeneration) { stopRegs = regs; return true; }
+	if (!FindStop(stop, index)) { return false; }
+	stopRegs = Stop(index).regs;
+	return true;
+}
+
+uint32_t CPU6510::DiffStops(uint32_t stopA, uint32_t stopB, uint8_t* changed)
+{
+	memset(changed, 0, 0x10000 / 8);
+	uint32_t indexA = 0, indexB = 0;
+	bool currA = stopA == knownGeneration, currB = stopB == knownGeneration;
+	if ((!currA && !FindStop(stopA, indexA)) || (!currB && !FindStop(stopB, indexB))) { return 0; }
+	const uint64_t* knownA = currA ? knownPages : Stop(indexA).known;
+	const uint64_t* knownB = currB ? knownPages : Stop(indexB).known;
+	MemoryMap* live = memory.load();
+	uint32_t count = 0;
+	for (uint32_t p = 0; p < NUM_PAGES; ++p) {
+		if (!(knownA[p >> 6] & knownB[p >> 6] & (1ull << (p & 63)))) { continue; }
+		const MemoryPage* a = currA ? live->pages[p] : PageAtStop(indexA, p);
+		const MemoryPage* b = currB ? live->pages[p] : PageAtStop(indexB, p);
+		if (a == b) { continue; }	// shared pages are the same
+		count += DiffBytes(a->bytes, b->bytes, PAGE_SIZE, p << PAGE_SHIFT, changed);
+	}
+	return count;
+}
+
+void CPU6510::WemoryChangeRefreshed()
+{
+	memoryChanged = false;
+	for (int w = 0; w < PAGE_WORDS; ++w) { dirtyPages[w] = 0; }
+}
+
+bool CPU6510::PagesChanged(const uint64_t* pages)
+{
+	for (int w = 0; w < PAGE_WORDS; ++w) {
+		if (dirtyPages[w] & pages[w]) { return true; }
+	}
+	return false;
+}
+
+void CPU6510::ChangedPages(uint64_t* pages)
+{
+	for (int w = 0; w < PAGE_WORDS; ++w) { pages[w] = changedPages[w]; }
+}
+
 void CPU6510::SetPC(uint16_t pc)
 {
 	regs.PC = pc;
 	ViceSetRegisters(*this, RM_PC);
 }
 
+void SetMemoryHistoryBudget(size_t bytes)
+{
+	sMemoryHistoryBudget = bytes;
+}
+
+size_t GetMemoryHistoryBudget()
+{
+	return sMemoryHistoryBudget;
+}
+
 void CreateMainCPU()
 {
 	if (sp6510 == nullptr) {
@@ -2,6 +2,8 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <atomic>
+#include <vector>
 
 #include "ViceInterface.h"
 #include "platform.h"
@@ -23,29 +25,160 @@ struct CPU6510 {
 		RM_FL = 0x0010,
 		RM_ZP00 = 0x0020,
 		RM_ZP01 = 0x0040,
-		RM_PC = 0x0080
+		RM_PC = 0x0080,
+		RM_LIN = 0x0100,
+		RM_CYC = 0x0200
+	};
+
+	// memory mirrored from VICE is tracked in pages that go stale when VICE
+	// stops and are fetched as views need them
+	enum PageState : uint8_t {
+		Page_Valid,
+		Page_Stale,
+		Page_Requested
+	};
+
+	enum {
+		PAGE_SHIFT = 8,
+		PAGE_SIZE = 1 << PAGE_SHIFT,
+		NUM_PAGES = 0x10000 >> PAGE_SHIFT,
+		PAGE_WORDS = NUM_PAGES / 64
+	};
+
+	// copy-on-write memory, a map is an immutable set of refcounted pages so
+	// unchanged pages are shared between versions
+	struct MemoryPage {
+		std::atomic<uint32_t> refs;
+		uint8_t bytes[PAGE_SIZE];
+	};
+
+	struct MemoryMap {
+		std::atomic<uint32_t> refs;
+		MemoryPage* pages[NUM_PAGES];
+
+		uint8_t Byte(uint16_t addr) const { return pages[addr >> PAGE_SHIFT]->bytes[addr & (PAGE_SIZE - 1)]; }
+		void Read(uint16_t addr, uint8_t* dest, size_t bytes) const;
+	};
+
+	// memory and registers at an earlier stop, only the pages that changed
+	// since the stop before are kept
+	struct MemoryStop {
+		struct Page {
+			uint8_t index;
+			MemoryPage* page;
+		};
+		uint32_t generation;		// MemoryGeneration while stopped
+		uint32_t numPages;
+		Regs regs;
+		uint64_t known[PAGE_WORDS];	// pages read from VICE during this stop
+		uint64_t changed[PAGE_WORDS];
+		Page* pages;
 	};
 
 	Regs	regs;
-	uint8_t *ram;
 	VICEMemSpaces space;
 
 	CPU6510();
+	~CPU6510();
 
-	void MemoryFromVICE(uint16_t start, uint16_t end, uint8_t* bytes);
+	// stable version of memory for any thread, ReleaseMemory when done
+	MemoryMap* AcquireMemory();
+	static void ReleaseMemory(MemoryMap* map);
+
+	// pages only turn valid if VICE hasn't stopped again since the bytes were read.
+	// bytes written locally that the read predates are kept, bytes is patched to match
+	void MemoryFromVICE(uint16_t start, uint16_t end, uint8_t* bytes, uint32_t generation, ViceRequest request);
+	uint32_t MemoryGeneration() { return memoryGeneration; }
+
+	// views register what they show every frame, reads from stale pages are added too
+	void WantMemory(uint32_t start, uint32_t end);
+	void WantedPages(uint64_t* pages);
+	static void PagesInRange(uint64_t* pages, uint32_t start, uint32_t end);
+	void InvalidateMemory();
+	bool MemoryValid(uint16_t start, uint16_t end);
+	// next run of stale pages within the page mask (all if null), the pages are marked as requested
+	bool NextMemoryRequest(const uint64_t* pages, uint32_t maxPages, uint16_t& start, uint16_t& end);
+	void MemoryRequestFailed(uint16_t start, uint16_t end);
+	// move the wanted pages of this frame to the set fetched first on the next stop
+	void PublishWantedMemory();
+
+	// stops are identified by their memory generation, the current stop is
+	// included. false if the stop was dropped or the page never read
+	uint32_t OldestStop();
+	bool MemoryAtStop(uint32_t stop, uint16_t addr, uint8_t& byte);
+	bool RegsAtStop(uint32_t stop, Regs& stopRegs);
+	// bit per address set where the bytes differ (0x2000 bytes), only pages
+	// read at both stops are compared. returns the number of bytes that differ
+	uint32_t DiffStops(uint32_t stopA, uint32_t stopB, uint8_t* changed);
 
 	uint8_t GetByte(uint16_t addr);
-	const uint8_t* GetMem(uint16_t addr);
+	void ReadMemory(uint16_t addr, uint8_t* dest, size_t bytes);
+	// writes are sent to VICE on FlushWrites, merged into as few messages as possible
 	void SetByte(uint16_t addr, uint8_t byte);
 	void CopyToRAM(uint16_t address, uint8_t* data, size_t size);
+	void FlushWrites();
+	// large writes go to VICE right away in pipelined chunks
+	void Upload(uint16_t address, const uint8_t* data, size_t size);
 	bool MemoryChange() { return memoryChanged; }
-	void WemoryChangeRefreshed() { memoryChanged = false; }
+	void WemoryChangeRefreshed();
+	// any of the pages in the mask changed along with MemoryChange
+	bool PagesChanged(const uint64_t* pages);
+	// bytes that VICE changed since the previous stop, only pages read at an earlier stop are compared
+	bool ByteChanged(uint16_t addr) { return (changedBytes[addr >> 3] >> (addr & 7)) & 1; }
+	const uint8_t* ChangedBytes() { return changedBytes; }
+	void ChangedPages(uint64_t* pages);
 	void ReadPRGToRAM(const char *filename);
 	void SetPC(uint16_t pc);
 
 protected:
-	IBMutex memoryUpdateMutex;
+	bool WriteMemory(uint16_t start, uint32_t bytes, const uint8_t* data);
+	void MarkWrite(uint16_t start, uint32_t bytes);
+	void SendWrite(uint16_t start, uint32_t bytes);
+	void KeepLocalWrites(uint16_t start, uint16_t end, uint8_t* bytes, ViceRequest request);
+	void RecordStop();
+	bool DropOldestStop();
+	void ClearHistory();
+	MemoryStop& Stop(uint32_t index) { return history[(historyFirst + index) % historyCapacity]; }
+	bool FindStop(uint32_t stop, uint32_t& index);
+	const MemoryPage* PageAtStop(uint32_t index, uint32_t page);
+
+	IBMutex memoryUpdateMutex;		// serializes writers, readers never lock
 	bool memoryChanged;
+
+	std::atomic<MemoryMap*> memory;
+	std::atomic<uint32_t> memoryReaders;	// threads between loading memory and adding a ref
+	std::vector<MemoryMap*> retiredMaps;	// replaced while memoryReaders was raised, under memoryUpdateMutex
+
+	std::atomic<uint8_t> pageState[NUM_PAGES];	// written under memoryUpdateMutex, read from any thread
+	std::atomic<uint32_t> memoryGeneration;		// bumped every time the pages go stale
+	std::atomic<uint64_t> pagesWanted[PAGE_WORDS];
+	std::atomic<uint64_t> pagesShown[PAGE_WORDS];
+
+	// UI thread only
+	MemoryStop* history;		// ring of stops, oldest first
+	uint32_t historyFirst, historyCount, historyCapacity;
+	size_t historyBytes;
+	MemoryMap* historyBase;		// full memory at the oldest stop
+	MemoryMap* historyLast;		// full memory at the newest stop
+	uint32_t knownGeneration;	// stop the known pages were read in
+	uint64_t knownPages[PAGE_WORDS];
+	uint64_t seenPages[PAGE_WORDS];		// read from VICE at any stop
+	uint64_t dirtyPages[PAGE_WORDS];	// changed since views last refreshed
+	uint64_t changedPages[PAGE_WORDS];	// changed since the previous stop
+	uint8_t changedBytes[0x10000 / 8];
+
+	// written locally but not yet sent to VICE, UI thread only
+	bool writesPending;
+	uint64_t writePages[PAGE_WORDS];
+	uint8_t writeBytes[0x10000 / 8];
+
+	// sent to VICE, kept until a read sent after them is answered. UI thread only
+	struct WriteInFlight {
+		ViceRequest request;
+		uint16_t start;
+		uint32_t bytes;
+	};
+	std::vector<WriteInFlight> writesInFlight;
 };
 
 enum StatusFlags {
@@ -60,6 +193,10 @@ enum StatusFlags {
 };
 
 
+// bytes of memory history kept across stops
+void SetMemoryHistoryBudget(size_t bytes);
+size_t GetMemoryHistoryBudget();
+
 void CreateMainCPU();
 void ShutdownMainCPU();
 
@@ -1,7 +1,9 @@
-// breakpoints are added in bulk when VICE stops
-// breakpoints can be added by the debugger
+// breakpoints are added in bulk on the first stop after connecting
+// after that single changes answered by VICE are applied one at a time
 
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
 #include "platform.h"
 #include "Breakpoints.h"
 #include "HashTable.h"
@@ -12,11 +14,88 @@
 #define _strdup strdup
 #endif
 
+// address ranges of the breakpoints sorted by start, read as a balanced tree
+// where each span is the root of the spans between its neighbours on the way
+// down (an implicit interval tree). a range query skips every subtree that ends
+// before it so one wide span doesn't make it visit everything.
+// rebuilt on the next query after a change, changes are rare and queries every frame
+struct BreakpointSpan {
+	uint16_t start, end;
+	uint16_t maxEnd;	// highest end of the spans in this subtree
+	uint32_t index;		// into sBreakpoints
+};
 
 static IBMutex sBreakpointMutex;
-static std::vector<Breakpoint> sBreakpoints;
+static std::vector<Breakpoint> sBreakpoints;	// sorted by number
+static std::vector<BreakpointSpan> sBreakpointSpans;
+static bool sBreakpointSpansDirty = false;
 static std::vector<uint32_t> sCurrentBreakpoints;
-static HashTable<uint16_t, uint32_t> sBreakpointLookup;	// address, VICE breakpoint index
+static HashTable<uint32_t, uint32_t> sTraceHitCounts;	// VICE breakpoint index, hits (UI thread)
+static std::atomic<bool> sTraceHitsReset(false);		// drop the counts on the next UI update
+
+static void FreeConditions()
+{
+	for (size_t i = 0; i < sBreakpoints.size(); ++i) {
+		if (sBreakpoints[i].condition) { free((void*)sBreakpoints[i].condition); }
+	}
+}
+
+// insert position of a breakpoint number, call with sBreakpointMutex held
+static size_t BreakpointSlot(uint32_t number)
+{
+	size_t lo = 0, hi = sBreakpoints.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) >> 1;
+		if (sBreakpoints[mid].number < number) { lo = mid + 1; } else { hi = mid; }
+	}
+	return lo;
+}
+
+// index of a breakpoint number or the number of breakpoints if not found
+static size_t FindBreakpoint(uint32_t number)
+{
+	size_t slot = BreakpointSlot(number);
+	return (slot < sBreakpoints.size() && sBreakpoints[slot].number == number) ? slot : sBreakpoints.size();
+}
+
+// subtree of lo..hi is rooted in the middle span
+static uint16_t SpanTreeMaxEnd(size_t lo, size_t hi)
+{
+	if (lo >= hi) { return 0; }
+	size_t mid = (lo + hi) >> 1;
+	BreakpointSpan& span = sBreakpointSpans[mid];
+	uint16_t left = SpanTreeMaxEnd(lo, mid), right = SpanTreeMaxEnd(mid + 1, hi);
+	span.maxEnd = span.end;
+	if (left > span.maxEnd) { span.maxEnd = left; }
+	if (right > span.maxEnd) { span.maxEnd = right; }
+	return span.maxEnd;
+}
+
+static void UpdateBreakpointSpans()
+{
+	if (!sBreakpointSpansDirty) { return; }
+	sBreakpointSpans.clear();
+	for (size_t i = 0, n = sBreakpoints.size(); i < n; ++i) {
+		BreakpointSpan span = { sBreakpoints[i].start, sBreakpoints[i].end, 0, (uint32_t)i };
+		if (span.end < span.start) { span.end = span.start; }
+		sBreakpointSpans.push_back(span);
+	}
+	std::sort(sBreakpointSpans.begin(), sBreakpointSpans.end(),
+		[](const BreakpointSpan& a, const BreakpointSpan& b) { return a.start < b.start; });
+	SpanTreeMaxEnd(0, sBreakpointSpans.size());
+	sBreakpointSpansDirty = false;
+}
+
+// first span that starts after address
+static size_t BreakpointSpanAfter(uint16_t address)
+{
+	size_t lo = 0, hi = sBreakpointSpans.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) >> 1;
+		if (sBreakpointSpans[mid].start <= address) { lo = mid + 1; } else { hi = mid; }
+	}
+	return lo;
+}
 
 void InitBreakpoints()
 {
@@ -25,16 +104,20 @@ void InitBreakpoints()
 
 void ShutdownBreakpoints()
 {
+	FreeConditions();
 	sBreakpoints.clear();
+	sBreakpointSpans.clear();
 	ClearBreapointsHit();
+	sTraceHitCounts.Clear();
 	IBMutexDestroy(&sBreakpointMutex);
 }
 
 void ClearBreakpoints()
 {
 	IBMutexLock(&sBreakpointMutex);
+	FreeConditions();
 	sBreakpoints.clear();
-	sBreakpointLookup.Clear();
+	sBreakpointSpansDirty = true;
 	IBMutexRelease(&sBreakpointMutex);
 }
 
@@ -64,54 +147,99 @@ void AddBreakpoint(uint32_t number, uint32_t flags, uint16_t start, uint16_t end
 {
 	// breakpoints with multiple settings are duplicated so merge them by number
 	IBMutexLock(&sBreakpointMutex);
-	for (size_t i = 0; i < sBreakpoints.size(); ++i) {
-		if (sBreakpoints[i].number == number) {
-			sBreakpoints[i].flags |= flags;
-			if (sBreakpoints[i].condition) {
-				free((void*)sBreakpoints[i].condition);
-				sBreakpoints[i].condition = nullptr;
-			}
-			if (condition) { sBreakpoints[i].condition = _strdup(condition);	}
-			IBMutexRelease(&sBreakpointMutex);
-			return;
+	size_t slot = BreakpointSlot(number);
+	if (slot < sBreakpoints.size() && sBreakpoints[slot].number == number) {
+		sBreakpoints[slot].flags |= flags;
+		if (sBreakpoints[slot].condition) {
+			free((void*)sBreakpoints[slot].condition);
+			sBreakpoints[slot].condition = nullptr;
 		}
+		if (condition) { sBreakpoints[slot].condition = _strdup(condition); }
+		IBMutexRelease(&sBreakpointMutex);
+		return;
 	}
 	Breakpoint bp = { number, flags, start, end, nullptr };
 	if (condition) { bp.condition = _strdup(condition); }
-	sBreakpoints.push_back(bp);
-	if ((flags & Breakpoint::Exec) && sBreakpointLookup.Value(start) == nullptr) {
-		sBreakpointLookup.Insert(start, number);
+	sBreakpoints.insert(sBreakpoints.begin() + slot, bp);
+	sBreakpointSpansDirty = true;
+	IBMutexRelease(&sBreakpointMutex);
+}
+
+// a single checkpoint as VICE reported it, replaces what was known about it
+void UpdateBreakpoint(uint32_t number, uint32_t flags, uint16_t start, uint16_t end, const char* condition)
+{
+	IBMutexLock(&sBreakpointMutex);
+	size_t slot = BreakpointSlot(number);
+	if (slot == sBreakpoints.size() || sBreakpoints[slot].number != number) {
+		Breakpoint bp = { number, 0, start, end, nullptr };
+		sBreakpoints.insert(sBreakpoints.begin() + slot, bp);
+	}
+	Breakpoint& bp = sBreakpoints[slot];
+	bp.flags = flags;
+	bp.start = start;
+	bp.end = end;
+	if (bp.condition) {
+		free((void*)bp.condition);
+		bp.condition = nullptr;
 	}
+	if (condition) { bp.condition = _strdup(condition); }
+	sBreakpointSpansDirty = true;
 	IBMutexRelease(&sBreakpointMutex);
 }
 
-void RemoveBreakpoint(uint32_t number)
+void EnableBreakpoint(uint32_t number, bool enable)
 {
 	IBMutexLock(&sBreakpointMutex);
-	for (size_t i = 0; i < sBreakpoints.size(); ++i) {
-		if (sBreakpoints[i].number == number) {
-			if (uint32_t* num = sBreakpointLookup.Value(sBreakpoints[i].start)) {
-				if (*num == number) {
-					// TODO: Add remove hash table slot!
-				}
-			}
-			sBreakpoints.erase(sBreakpoints.begin() + i);
-			break;
+	size_t index = FindBreakpoint(number);
+	if (index < sBreakpoints.size()) {
+		if (enable) {
+			sBreakpoints[index].flags |= Breakpoint::Enabled;
+		} else {
+			sBreakpoints[index].flags &= ~Breakpoint::Enabled;
+		}
+	}
+	IBMutexRelease(&sBreakpointMutex);
+}
+
+void SetBreakpointCondition(uint32_t number, const char* condition)
+{
+	IBMutexLock(&sBreakpointMutex);
+	size_t index = FindBreakpoint(number);
+	if (index < sBreakpoints.size()) {
+		Breakpoint& bp = sBreakpoints[index];
+		if (bp.condition) {
+			free((void*)bp.condition);
+			bp.condition = nullptr;
 		}
+		if (condition) { bp.condition = _strdup(condition); }
 	}
 	IBMutexRelease(&sBreakpointMutex);
 }
 
+void RemoveBreakpoint(uint32_t number)
+{
+	IBMutexLock(&sBreakpointMutex);
+	size_t index = FindBreakpoint(number);
+	if (index < sBreakpoints.size()) {
+		if (sBreakpoints[index].condition) { free((void*)sBreakpoints[index].condition); }
+		sBreakpoints.erase(sBreakpoints.begin() + index);
+		sBreakpointSpansDirty = true;
+	}
+	IBMutexRelease(&sBreakpointMutex);
+	sTraceHitCounts.Erase(number);	// removals are applied on the UI thread
+}
+
 void RemoveAllBreakpoints()
 {
 	IBMutexLock(&sBreakpointMutex);
 	for (size_t i = 0; i < sBreakpoints.size(); ++i) {
 		ViceRemoveBreakpointNoList(sBreakpoints[i].number);
-		if (sBreakpoints[i].condition) { free((void*)sBreakpoints[i].condition); }
 	}
+	FreeConditions();
 	sBreakpoints.clear();
-	sBreakpointLookup.Clear();
+	sBreakpointSpansDirty = true;
 	IBMutexRelease(&sBreakpointMutex);
+	sTraceHitsReset = true;	// may be called from the debug load thread
 }
 
 size_t NumBreakpoints()
@@ -133,16 +261,80 @@ Breakpoint GetBreakpoint(size_t index)
 bool BreakpointAt(uint16_t address, Breakpoint& bp)
 {
 	IBMutexLock(&sBreakpointMutex);
-	if (uint32_t* number = sBreakpointLookup.Value(address)) {
-		uint32_t num = *number;
-		for (size_t index = 0, n = sBreakpoints.size(); index < n; ++index) {
-			if (sBreakpoints[index].number == num) {
-				bp = sBreakpoints[index];
-				IBMutexRelease(&sBreakpointMutex);
-				return true;
-			}
+	UpdateBreakpointSpans();
+	// lowest numbered exec breakpoint starting at address
+	size_t found = sBreakpoints.size();
+	for (size_t s = BreakpointSpanAfter(address); s > 0 && sBreakpointSpans[s - 1].start == address; --s) {
+		size_t index = sBreakpointSpans[s - 1].index;
+		if ((sBreakpoints[index].flags & Breakpoint::Exec) && index < found) { found = index; }
+	}
+	if (found < sBreakpoints.size()) { bp = sBreakpoints[found]; }
+	IBMutexRelease(&sBreakpointMutex);
+	return found < sBreakpoints.size();
+}
+
+struct SpanQuery {
+	uint16_t start, end;
+	uint32_t skipFrom;		// spans reaching this were found by the first half of a wrapped range
+	uint32_t flags;
+	Breakpoint* found;
+	size_t count, maxFound;
+};
+
+// in order walk of the subtree of lo..hi, lowest start first
+static void SpansInRange(SpanQuery& query, size_t lo, size_t hi)
+{
+	while (lo < hi && query.count < query.maxFound) {
+		size_t mid = (lo + hi) >> 1;
+		const BreakpointSpan& span = sBreakpointSpans[mid];
+		if (span.maxEnd < query.start) { return; }	// nothing below reaches the range
+		SpansInRange(query, lo, mid);
+		if (query.count == query.maxFound || span.start > query.end) { return; }
+		if (span.end >= query.start && (uint32_t)span.end < query.skipFrom && (sBreakpoints[span.index].flags & query.flags)) {
+			query.found[query.count++] = sBreakpoints[span.index];
 		}
+		lo = mid + 1;
 	}
+}
+
+size_t BreakpointsInRange(uint16_t start, uint16_t end, uint32_t flags, Breakpoint* found, size_t maxFound)
+{
+	SpanQuery query = { start, end, 0x10000, flags, found, 0, maxFound };
+	IBMutexLock(&sBreakpointMutex);
+	UpdateBreakpointSpans();
+	size_t spans = sBreakpointSpans.size();
+	if (end < start) {
+		// wrapped, start..$ffff first and then $0000..end
+		query.end = 0xffff;
+		SpansInRange(query, 0, spans);
+		query.start = 0;
+		query.end = end;
+		query.skipFrom = start;
+	}
+	SpansInRange(query, 0, spans);
 	IBMutexRelease(&sBreakpointMutex);
-	return false;
-}
\ No newline at end of file
+	return query.count;
+}
+
+void UpdateTraceHits()
+{
+	// VICE sends its own hit count so dropped hits don't throw the count off
+	enum { TRACE_HIT_BATCH = 256 };
+	// VICE numbers checkpoints from scratch when it restarts
+	if (sTraceHitsReset.exchange(false) || (!ViceConnected() && sTraceHitCounts.GetUsed())) {
+		sTraceHitCounts.Clear();
+	}
+	ViceTraceHit hits[TRACE_HIT_BATCH];
+	while (size_t count = ViceTraceHits(hits, TRACE_HIT_BATCH)) {
+		for (size_t h = 0; h < count; ++h) {
+			if (hits[h].number) { sTraceHitCounts.Insert(hits[h].number, hits[h].count); }
+		}
+		if (count < TRACE_HIT_BATCH) { break; }
+	}
+}
+
+uint32_t TraceHitCount(uint32_t number)
+{
+	uint32_t* count = sTraceHitCounts.Value(number);
+	return count ? *count : 0;
+}
@@ -25,6 +25,9 @@ void InitBreakpoints();
 void ShutdownBreakpoints();
 void ClearBreakpoints();
 void AddBreakpoint(uint32_t number, uint32_t flags, uint16_t start, uint16_t end, const char* condition = nullptr);
+void UpdateBreakpoint(uint32_t number, uint32_t flags, uint16_t start, uint16_t end, const char* condition = nullptr);
+void EnableBreakpoint(uint32_t number, bool enable);
+void SetBreakpointCondition(uint32_t number, const char* condition);
 void RemoveBreakpoint(uint32_t number);
 void RemoveAllBreakpoints();
 bool BreakpointCurrent(uint32_t number);
@@ -32,4 +35,12 @@ void SetBreakpointHit(uint32_t number);
 void ClearBreapointsHit();
 size_t NumBreakpoints();
 Breakpoint GetBreakpoint(size_t index);
+// exec breakpoint that starts at address
 bool BreakpointAt(uint16_t address, Breakpoint& bp);
+// breakpoints with any of flags that overlap start..end in address order, one
+// query covers everything a view shows in a frame. end below start wraps around
+// and lists start..$ffff before $0000..end. returns the number copied to found
+size_t BreakpointsInRange(uint16_t start, uint16_t end, uint32_t flags, Breakpoint* found, size_t maxFound);
+// UI thread, takes the tracepoint hits VICE sent since the last frame
+void UpdateTraceHits();
+uint32_t TraceHitCount(uint32_t number);
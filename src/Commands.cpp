@@ -1,11 +1,4 @@
 // various commands for the console view etc.
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#include <synchapi.h>
-#else
-#include <unistd.h>
-#endif
 #include <vector>
 #include "struse/struse.h"
 #include "Expressions.h"
@@ -15,20 +8,41 @@
 
 static std::vector<uint16_t> sRemembered;
 
-bool HaltViceWait() {
-	bool wasRunning = ViceRunning();
-	if (wasRunning) {
-		ViceBreak();
-		for (int i = 0; i < 60; ++i) {
-#ifdef _WIN32
-			Sleep(1);
-#else
-			usleep(1000);
-#endif
-			if (!ViceRunning()) { break; }
-		}
+// commands that read memory finish on the UI thread once the break and
+// the memory read have been answered and their snapshot applied
+typedef void (*HaltedCommand)(void* user);
+
+struct HaltedRead {
+	HaltedCommand command;
+	void* user;
+	bool wasRunning;
+};
+
+static void HaltedReadDone(void* user, ViceRequest, uint8_t errorCode) {
+	HaltedRead* read = (HaltedRead*)user;
+	if (errorCode == VICE_REQUEST_ABORTED) {
+		ViceLog(strref("VICE disconnected, using last known memory"));
 	}
-	return wasRunning;
+	read->command(read->user);
+	if (read->wasRunning) { ViceGo(); }
+	delete read;
+}
+
+// VICE handles commands in order so break, read and resume are queued
+// back to back instead of waiting for the stop to be reported
+static void HaltViceAndRead(uint16_t start, uint16_t end, HaltedCommand command, void* user) {
+	HaltedRead* read = new HaltedRead;
+	read->command = command;
+	read->user = user;
+	read->wasRunning = ViceRunning();
+	ViceRequest requests[2] = {};
+	if (read->wasRunning) { requests[0] = ViceBreak(); }
+	// memory is only fetched from VICE as it gets shown
+	CPU6510* cpu = GetCurrCPU();
+	if (cpu && (read->wasRunning || !cpu->MemoryValid(start, end))) {
+		requests[1] = ViceGetMemory(start, end, cpu->space);
+	}
+	ViceWhenAll(requests, 2, HaltedReadDone, read);
 }
 
 void CommandPoke(strref param) {
@@ -38,7 +52,8 @@ void CommandPoke(strref param) {
 	int addrValue = ValueFromExpression(strown<256>(addr).c_str());
 	int byteValue = ValueFromExpression(strown<256>(byte).c_str());
 
-	bool wasRunning = HaltViceWait();
+	bool wasRunning = ViceRunning();
+	if (wasRunning) { ViceBreak(); }
 	if (CPU6510* cpu = GetCurrCPU()) {
 		cpu->SetByte((uint16_t)addrValue, (uint8_t)byteValue);
 	}
@@ -88,15 +103,20 @@ bool ParseRememberCompare(strref &param_in, uint8_t *pb0, uint8_t *pb1, uint32_t
 }
 
 
-void CommandRemember(strref param) {
+struct MatchArgs {
 	uint8_t b0, b1;
 	uint32_t a0, a1;
-	bool inv = false;
-	if (!ParseRememberCompare(param, &b0, &b1, &a0, &a1, &inv)) { return; }
+	bool inv, trc, wtc, clr, flt;
+	int charSpace;
+};
 
-	if (CPU6510* cpu = GetCurrCPU()) {
-		bool wasRunning = HaltViceWait();
+static void RememberHalted(void* user) {
+	MatchArgs* args = (MatchArgs*)user;
+	uint8_t b0 = args->b0, b1 = args->b1;
+	uint32_t a0 = args->a0, a1 = args->a1;
+	delete args;
 
+	if (CPU6510* cpu = GetCurrCPU()) {
 		if (sRemembered.capacity() < 512) {
 			sRemembered.reserve(512);
 		}
@@ -117,36 +137,35 @@ void CommandRemember(strref param) {
 		if (a0 > 0) { resultStr.append(" between $").append_num(a0, 4, 16)
 			.append(" to $").append_num(a1, 4, 16); }
 		ViceLog(resultStr.get_strref());
-		if (wasRunning) { ViceGo(); }
 	}
 }
 
+void CommandRemember(strref param) {
+	MatchArgs* args = new MatchArgs();
+	if (!ParseRememberCompare(param, &args->b0, &args->b1, &args->a0, &args->a1, &args->inv)) {
+		delete args;
+		return;
+	}
+	HaltViceAndRead((uint16_t)args->a0, (uint16_t)(args->a1 - 1), RememberHalted, args);
+}
+
 void  CommandForget() {
 	sRemembered.clear();
 }
 
-void CommandMatch(strref param, int charSpace) {
-	uint8_t b0, b1;
-	uint32_t a0, a1;
-	bool inv = false;
-	if (!ParseRememberCompare(param, &b0, &b1, &a0, &a1, &inv)) { return; }
-	if (CPU6510* cpu = GetCurrCPU()) {
-		bool wasRunning = HaltViceWait();
+static void MatchHalted(void* user) {
+	MatchArgs* args = (MatchArgs*)user;
+	uint8_t b0 = args->b0, b1 = args->b1;
+	uint32_t a0 = args->a0, a1 = args->a1;
+	bool inv = args->inv, trc = args->trc, wtc = args->wtc, clr = args->clr, flt = args->flt;
+	int charSpace = args->charSpace;
+	delete args;
 
+	if (CPU6510* cpu = GetCurrCPU()) {
 		ViceLog("Matches:");
 		strown<128> result;
 		int found = 0;
 
-		bool trc = false, wtc = false, clr = false, flt = false;
-		while (strref ctrl = param.split_token_trim(' ')) {
-			switch (strref::tolower(ctrl.get_first())) {
-				case 't': trc = true; break;
-				case 'w': wtc = true; break;
-				case 'c': clr = true; break;
-				case 'f': flt = true; break;
-			}
-		}
-
 		if (clr) { sRemembered.clear(); }
 
 		bool wasClr = sRemembered.size() == 0;
@@ -196,10 +215,27 @@ void CommandMatch(strref param, int charSpace) {
 				.append(" to $").append_num(a1, 4, 16);
 		}
 		ViceLog(result.get_strref());
-		if (wasRunning) { ViceGo(); }
 	}
 }
 
+void CommandMatch(strref param, int charSpace) {
+	MatchArgs* args = new MatchArgs();
+	if (!ParseRememberCompare(param, &args->b0, &args->b1, &args->a0, &args->a1, &args->inv)) {
+		delete args;
+		return;
+	}
+	while (strref ctrl = param.split_token_trim(' ')) {
+		switch (strref::tolower(ctrl.get_first())) {
+			case 't': args->trc = true; break;
+			case 'w': args->wtc = true; break;
+			case 'c': args->clr = true; break;
+			case 'f': args->flt = true; break;
+		}
+	}
+	args->charSpace = charSpace;
+	HaltViceAndRead((uint16_t)args->a0, (uint16_t)(args->a1 - 1), MatchHalted, args);
+}
+
 enum {
 	GFX_Text,
 	GFX_TextMC,
@@ -222,24 +258,33 @@ void SendViceMonitorLine(const char* message, int size);
 int CommandGfxSaveC64(strref param);
 int CommandGfxSavePlus4(strref param);
 
-const char* CommandGfxSave(strref param) {
-	bool wasRunning = HaltViceWait();
+static void GfxSaveHalted(void* user) {
+	strown<256>* param = (strown<256>*)user;
+	strref arg = param->get_strref();
 	int mode = 0;
 	switch(ViceGetEmuType()) {
 		case VICEEmuType::C64:
-			mode = CommandGfxSaveC64(param);
+			mode = CommandGfxSaveC64(arg);
 			break;
 		case VICEEmuType::Vic20:
 			/* unsupported */
 			break;
 		case VICEEmuType::Plus4:
-			mode = CommandGfxSavePlus4(param);
+			mode = CommandGfxSavePlus4(arg);
 			break;
 	}
-	if (wasRunning) {
-		ViceGo();
-	}
-	return sazScreenModes[mode];
+	strown<512> msg;
+	msg.sprintf("Exported " STRREF_FMT ".txt, " STRREF_FMT ".scr (screen),", STRREF_ARG(arg), STRREF_ARG(arg));
+	ViceLog(msg.get_strref());
+	msg.sprintf(STRREF_FMT ".col (color mem) and " STRREF_FMT ".chr (characters)", STRREF_ARG(arg), STRREF_ARG(arg));
+	ViceLog(msg.get_strref());
+	msg.sprintf("for graphics mode %s", sazScreenModes[mode]);
+	ViceLog(msg.get_strref());
+	delete param;
+}
+
+void CommandGfxSave(strref param) {
+	HaltViceAndRead(0x0000, 0xffff, GfxSaveHalted, new strown<256>(param));
 }
 
 int CommandGfxSaveC64(strref param) {
@@ -331,7 +376,9 @@ int CommandGfxSaveC64(strref param) {
 	f = fopen(file.c_str(), "wb");
 	if (f) {
 #endif
-		fwrite(cpu->GetMem(screen), 1000, 1, f);
+		uint8_t tmpScreen[1000];
+		cpu->ReadMemory(screen, tmpScreen, sizeof(tmpScreen));
+		fwrite(tmpScreen, 1000, 1, f);
 		fclose(f);
 	}
 
@@ -345,7 +392,7 @@ int CommandGfxSaveC64(strref param) {
 		if (f) {
 #endif
 			uint8_t tmpCol[1000];
-			memcpy(tmpCol, cpu->GetMem(0xd800), 1000);
+			cpu->ReadMemory(0xd800, tmpCol, sizeof(tmpCol));
 			for (int i = 0; i < 1000; ++i) {
 				tmpCol[i] &= 0x0f;
 			}
@@ -362,7 +409,9 @@ int CommandGfxSaveC64(strref param) {
 	f = fopen(file.c_str(), "wb");
 	if (f) {
 #endif
-		fwrite(cpu->GetMem(chars), numChars * 8, 1, f);
+		uint8_t tmpChars[1000 * 8];
+		cpu->ReadMemory(chars, tmpChars, numChars * 8);
+		fwrite(tmpChars, numChars * 8, 1, f);
 		fclose(f);
 	}
 
@@ -454,7 +503,9 @@ int CommandGfxSavePlus4(strref param) {
 	f = fopen(file.c_str(), "wb");
 	if (f) {
 #endif
-		fwrite(cpu->GetMem(screen), 1000, 1, f);
+		uint8_t tmpScreen[1000];
+		cpu->ReadMemory(screen, tmpScreen, sizeof(tmpScreen));
+		fwrite(tmpScreen, 1000, 1, f);
 		fclose(f);
 	}
 
@@ -468,7 +519,7 @@ int CommandGfxSavePlus4(strref param) {
 		if (f) {
 #endif
 			uint8_t tmpCol[1000];
-			memcpy(tmpCol, cpu->GetMem(screen-0x400), 1000);
+			cpu->ReadMemory(screen-0x400, tmpCol, sizeof(tmpCol));
 			fwrite(tmpCol, 1000, 1, f);
 			fclose(f);
 		}
@@ -482,7 +533,9 @@ int CommandGfxSavePlus4(strref param) {
 	f = fopen(file.c_str(), "wb");
 	if (f) {
 #endif
-		fwrite(cpu->GetMem(chars), numChars * 8, 1, f);
+		uint8_t tmpChars[1000 * 8];
+		cpu->ReadMemory(chars, tmpChars, numChars * 8);
+		fwrite(tmpChars, numChars * 8, 1, f);
 		fclose(f);
 	}
 
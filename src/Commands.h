@@ -4,5 +4,5 @@ void CommandPoke(strref param);
 void CommandRemember(strref param);
 void CommandForget();
 void CommandMatch(strref param, int charSpace);
-const char* CommandGfxSave(strref param);
+void CommandGfxSave(strref param);
 
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "struse/struse.h"
+#include "Files.h"
+#include "Breakpoints.h"
+#include "ViceInterface.h"
+#include "DebugCache.h"
+
+#define DEBUG_CACHE_EXT ".ibcache"
+
+enum {
+	DEBUG_CACHE_MAGIC = 0x43444249,	// "IBDC"
+	DEBUG_CACHE_VERSION = 2,
+	DEBUG_CACHE_ALIGN = 8
+};
+
+// file systems with coarse stamps can give a file written again right after
+// it was read the same stamp
+static const int64_t DEBUG_CACHE_STAMP_SLACK = 2000000000ll;	// ns
+
+// followed by the arrays in DebugCacheArray order, each aligned
+struct DebugCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;		// of the debug file
+	int64_t modified;
+	uint64_t hash;		// fnv1a_64 of the debug file
+	int64_t checked;	// the stamps were known to match the hashes at this time
+	uint32_t breakFlags;
+	uint32_t bytes[DCA_Count];
+};
+
+static size_t DebugCacheAlign(size_t size)
+{
+	return (size + DEBUG_CACHE_ALIGN - 1) & ~(size_t)(DEBUG_CACHE_ALIGN - 1);
+}
+
+static uint64_t DebugCacheHash(const void* contents, size_t size)
+{
+	return strref((const char*)contents, (strl_t)size).fnv1a_64();
+}
+
+// same clock as FileStamp, nanoseconds since 1970
+static int64_t DebugCacheNow()
+{
+	return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool DebugCacheStampTrusted(int64_t modified, int64_t checked)
+{
+	return (modified + DEBUG_CACHE_STAMP_SLACK) <= checked;
+}
+
+// the file has the size and hash it was cached with, the stamp is checked by the caller
+static bool DebugCacheContentsMatch(const char* path, uint64_t size, uint64_t hash)
+{
+	size_t contentSize = 0;
+	uint8_t* contents = LoadBinary(path, contentSize);
+	bool match = contents && contentSize == size && DebugCacheHash(contents, contentSize) == hash;
+	if (contents) { free(contents); }
+	return match;
+}
+
+DebugCacheWriter::DebugCacheWriter() : breakFlags(0), started(DebugCacheNow()) {}
+
+uint32_t DebugCacheWriter::Text(DebugCacheArray array, strref str)
+{
+	std::vector<uint8_t>& text = arrays[array];
+	uint32_t offset = (uint32_t)text.size();
+	if (str.get_len()) { text.insert(text.end(), (const uint8_t*)str.get(), (const uint8_t*)str.get() + str.get_len()); }
+	text.push_back(0);
+	return offset;
+}
+
+void DebugCacheWriter::AddSource(const char* path, const void* contents, size_t size)
+{
+	DebugCacheSource source = { 0, 0, 0, Text(DCA_SourceText, strref(path)), 0 };
+	if (!contents || !FileStamp(path, source.size, source.modified) || source.size != size) {
+		source.size = DebugCacheSource::MISSING;
+	} else {
+		source.hash = DebugCacheHash(contents, size);
+	}
+	Add(DCA_Sources, source);
+}
+
+bool DebugCacheWriter::Save(const char* filename, const void* contents, size_t size)
+{
+	DebugCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = DEBUG_CACHE_MAGIC;
+	header.version = DEBUG_CACHE_VERSION;
+	// the file changed while it was read
+	if (!FileStamp(filename, header.size, header.modified) || header.size != size) { return false; }
+	header.hash = DebugCacheHash(contents, size);
+	header.checked = started;
+	header.breakFlags = breakFlags;
+
+	size_t total = DebugCacheAlign(sizeof(header));
+	for (int a = 0; a < DCA_Count; ++a) {
+		header.bytes[a] = (uint32_t)arrays[a].size();
+		total += DebugCacheAlign(arrays[a].size());
+	}
+	uint8_t* data = (uint8_t*)calloc(1, total);
+	if (!data) { return false; }
+	memcpy(data, &header, sizeof(header));
+	size_t offset = DebugCacheAlign(sizeof(header));
+	for (int a = 0; a < DCA_Count; ++a) {
+		if (arrays[a].size()) { memcpy(data + offset, &arrays[a][0], arrays[a].size()); }
+		offset += DebugCacheAlign(arrays[a].size());
+	}
+
+	strown<PATH_MAX_LEN> cacheFile(filename);
+	cacheFile.append(DEBUG_CACHE_EXT);
+	bool saved = SaveBinary(cacheFile.c_str(), data, total);
+	free(data);
+	return saved;
+}
+
+bool DebugCacheReader::Load(const char* filename)
+{
+	uint64_t fileSize;
+	int64_t modified;
+	if (!FileStamp(filename, fileSize, modified)) { return false; }
+
+	strown<PATH_MAX_LEN> cacheFile(filename);
+	cacheFile.append(DEBUG_CACHE_EXT);
+	data = LoadBinary(cacheFile.c_str(), size);
+	if (!data) { return false; }
+
+	DebugCacheHeader* header = (DebugCacheHeader*)data;
+	bool valid = size >= DebugCacheAlign(sizeof(DebugCacheHeader)) && header->magic == DEBUG_CACHE_MAGIC &&
+		header->version == DEBUG_CACHE_VERSION && header->size == fileSize;
+	if (valid) {
+		size_t offset = DebugCacheAlign(sizeof(DebugCacheHeader));
+		for (int a = 0; a < DCA_Count; ++a) {
+			offsets[a] = offset;
+			bytes[a] = header->bytes[a];
+			offset += DebugCacheAlign(bytes[a]);
+		}
+		valid = offset == size;
+		// strings can be used as they are if the text ends with a terminator
+		for (int a = DCA_SymbolText; valid && a <= DCA_SourceText; ++a) {
+			valid = !bytes[a] || !data[offsets[a] + bytes[a] - 1];
+		}
+	}
+	// rebuilds often write the same file again, then only the stamps need updating
+	int64_t checked = DebugCacheNow();
+	bool hashed = false, update = false;
+	if (valid && (header->modified != modified || !DebugCacheStampTrusted(modified, header->checked))) {
+		valid = DebugCacheContentsMatch(filename, fileSize, header->hash);
+		update = header->modified != modified || DebugCacheStampTrusted(modified, checked);
+		header->modified = modified;
+		hashed = true;
+	}
+	DebugCacheSource* sources = (DebugCacheSource*)(data + offsets[DCA_Sources]);
+	for (uint32_t s = 0, n = Count<DebugCacheSource>(DCA_Sources); valid && s < n; ++s) {
+		uint64_t sourceSize = DebugCacheSource::MISSING;
+		int64_t sourceModified = sources[s].modified;
+		const char* path = Text(DCA_SourceText, sources[s].path);
+		if (!FileStamp(path, sourceSize, sourceModified)) { sourceSize = DebugCacheSource::MISSING; }
+		valid = ValidText(DCA_SourceText, sources[s].path, 0) && sourceSize == sources[s].size;
+		if (valid && sourceSize != DebugCacheSource::MISSING &&
+			(sourceModified != sources[s].modified || !DebugCacheStampTrusted(sourceModified, header->checked))) {
+			valid = DebugCacheContentsMatch(path, sourceSize, sources[s].hash);
+			update = update || sourceModified != sources[s].modified || DebugCacheStampTrusted(sourceModified, checked);
+			sources[s].modified = sourceModified;
+			hashed = true;
+		}
+	}
+	if (!valid) {
+		free(data);
+		data = nullptr;
+		return false;
+	}
+	// save the new stamps, or that they can be trusted next time
+	if (hashed && update) {
+		header->checked = checked;
+		SaveBinary(cacheFile.c_str(), data, size);
+	}
+	breakFlags = header->breakFlags;
+	return true;
+}
+
+void SetDebugFileBreakpoints(uint32_t flags, const uint16_t* breaks, size_t count)
+{
+	if (flags & DCB_RemoveAll) { RemoveAllBreakpoints(); }
+	for (size_t b = 0; b < count; ++b) {
+		if (flags & DCB_IfNone) {
+			Breakpoint bp;
+			if (BreakpointAt(breaks[b], bp)) { continue; }
+		}
+		ViceAddBreakpoint(breaks[b]);
+	}
+}
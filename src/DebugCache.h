@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+class strref;
+
+// debug info read from a file is saved next to it as <file>.ibcache and read
+// back instead of parsing the file again while the file, or at least its
+// contents, and the source files it refers to are unchanged. a file stamp is
+// only trusted if it is a couple of seconds older than the files were read,
+// otherwise the contents are hashed
+
+enum DebugCacheArray {
+	DCA_Sources,	// DebugCacheSource, files the debug file refers to
+	DCA_Sections,	// uint32_t symbol text offset
+	DCA_Labels,		// DebugCacheLabel
+	DCA_Breaks,		// uint16_t address
+	DCA_Segments,	// DebugCacheSegment
+	DCA_Blocks,		// DebugCacheName
+	DCA_Lines,		// DebugCacheLine
+	DCA_SymbolText,	// zero terminated strings of sections and labels
+	DCA_SourceText,	// zero terminated strings of everything else
+	DCA_Count
+};
+
+enum DebugCacheBreakFlags {
+	DCB_RemoveAll = 1,	// the file replaces the current breakpoints
+	DCB_IfNone = 2		// only where there isn't an exec breakpoint already
+};
+
+// text offsets are into DCA_SymbolText for sections and labels and
+// DCA_SourceText for the rest
+struct DebugCacheSource {
+	static const uint64_t MISSING = ~0ull;
+	uint64_t size;		// MISSING if the file couldn't be read
+	int64_t modified;
+	uint64_t hash;		// fnv1a_64 of the file
+	uint32_t path;
+	uint32_t unused;
+};
+
+struct DebugCacheLabel {
+	uint32_t address;
+	uint32_t section;	// index in DCA_Sections
+	uint32_t text;
+};
+
+struct DebugCacheName {
+	uint32_t text;
+	uint32_t len;
+};
+
+struct DebugCacheSegment {
+	uint32_t addrFirst, addrLast;
+	DebugCacheName name;
+	uint32_t firstBlock, numBlocks;
+	uint32_t firstLine;	// addrLast + 1 - addrFirst lines
+};
+
+struct DebugCacheLine {
+	enum { NO_TEXT = 0xffffffff };
+	uint32_t text;
+	uint8_t len, spaces, block, unused;
+};
+
+// create before reading the files that are cached, the stamps of files
+// written since shortly before then are checked by hash
+struct DebugCacheWriter {
+	std::vector<uint8_t> arrays[DCA_Count];
+	uint32_t breakFlags;
+	int64_t started;
+
+	DebugCacheWriter();
+
+	template<class T> void Add(DebugCacheArray array, const T& item) {
+		arrays[array].insert(arrays[array].end(), (const uint8_t*)&item, (const uint8_t*)&item + sizeof(T));
+	}
+	template<class T> uint32_t Count(DebugCacheArray array) const { return (uint32_t)(arrays[array].size() / sizeof(T)); }
+	uint32_t Text(DebugCacheArray text, strref str);
+	// contents is null if the source couldn't be read
+	void AddSource(const char* path, const void* contents, size_t size);
+	// filename is the debug file, contents what was parsed
+	bool Save(const char* filename, const void* contents, size_t size);
+};
+
+struct DebugCacheReader {
+	uint8_t* data;
+	size_t size;
+	size_t offsets[DCA_Count];
+	uint32_t bytes[DCA_Count];
+	uint32_t breakFlags;
+
+	DebugCacheReader() : data(nullptr), size(0), breakFlags(0) {
+		memset(offsets, 0, sizeof(offsets));
+		memset(bytes, 0, sizeof(bytes));
+	}
+	~DebugCacheReader() { if (data) { free(data); } }
+
+	// true if there is a cache that matches the debug file
+	bool Load(const char* filename);
+	template<class T> const T* Array(DebugCacheArray array) const { return (const T*)(data + offsets[array]); }
+	template<class T> uint32_t Count(DebugCacheArray array) const { return bytes[array] / (uint32_t)sizeof(T); }
+	bool ValidText(DebugCacheArray text, uint32_t offset, uint32_t len) const {
+		return offset < bytes[text] && len < (bytes[text] - offset);
+	}
+	const char* Text(DebugCacheArray text, uint32_t offset) const {
+		return ValidText(text, offset, 0) ? (const char*)(data + offsets[text] + offset) : "";
+	}
+	// the caller frees the cache data, text stays valid until then
+	uint8_t* Release() { uint8_t* ret = data; data = nullptr; return ret; }
+};
+
+// loading thread, sets the breakpoints a debug file asked for
+void SetDebugFileBreakpoints(uint32_t flags, const uint16_t* breaks, size_t count);
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include "struse/struse.h"
+#include "Files.h"
+#include "Sym.h"
+#include "SourceDebug.h"
+#include "platform.h"
+#include "views/Views.h"
+#include "HotReload.h"
+#include "DebugLoad.h"
+
+#ifndef _WIN32
+#define WINAPI
+#endif
+
+struct DebugLoadJob {
+	DebugLoadType type;
+	bool ifPrevFailed;
+	strown<PATH_MAX_LEN> file;
+};
+
+static IBMutex sDebugLoadMutex;
+static std::vector<DebugLoadJob> sDebugLoadJobs;	// guarded by sDebugLoadMutex
+static std::atomic<bool> sDebugLoadRunning(false);	// set when queueing starts the thread, cleared as it exits
+static std::atomic<bool> sDebugLoadCancel(false);
+static std::atomic<size_t> sDebugLoadDone(0);
+static std::atomic<size_t> sDebugLoadTotal(0);
+static bool sDebugLoadPrevLoaded = false;			// loading thread
+
+static bool DebugLoad(DebugLoadJob& job)
+{
+	const char* file = job.file.c_str();
+	switch (job.type) {
+		case DebugLoadType::SymbolsFile: return ReadSymbolsFile(file);
+		case DebugLoadType::SymbolsForBinary: ReadSymbolsForBinary(file); return true;
+		case DebugLoadType::KickDbg: return ReadC64DbgSrc(file);
+		case DebugLoadType::KickDbgExtra: return ReadC64DbgSrcExtra(file);
+		case DebugLoadType::ViceCommands: return ReadViceCommandFile(file);
+		case DebugLoadType::Symbols: return ReadSymbols(file);
+		case DebugLoadType::Listing: return ReadListingFile(file);
+		case DebugLoadType::HotReloadHash: return HotReloadHashFiles(file);
+	}
+	return false;
+}
+
+// runs the queued loads in order and exits when there are none left
+static IBThreadRet WINAPI DebugLoadThread(void*)
+{
+	for (;;) {
+		IBMutexLock(&sDebugLoadMutex);
+		if (sDebugLoadJobs.empty() || sDebugLoadCancel) {
+			sDebugLoadJobs.clear();
+			sDebugLoadRunning = false;
+			IBMutexRelease(&sDebugLoadMutex);
+			return 0;
+		}
+		DebugLoadJob job = sDebugLoadJobs.front();
+		sDebugLoadJobs.erase(sDebugLoadJobs.begin());
+		IBMutexRelease(&sDebugLoadMutex);
+
+		if (!job.ifPrevFailed || !sDebugLoadPrevLoaded) {
+			sDebugLoadDone = 0;
+			sDebugLoadTotal = 0;
+			sDebugLoadPrevLoaded = DebugLoad(job);
+		}
+	}
+}
+
+void QueueDebugLoad(DebugLoadType type, const char* filename, bool ifPrevFailed)
+{
+	if (!filename || !filename[0]) { return; }
+	IBMutexLock(&sDebugLoadMutex);
+	if (sDebugLoadCancel) {
+		IBMutexRelease(&sDebugLoadMutex);
+		return;
+	}
+	// the same file queued again before it was read only needs reading once
+	if (sDebugLoadJobs.empty() || sDebugLoadJobs.back().type != type || ifPrevFailed != sDebugLoadJobs.back().ifPrevFailed ||
+		!sDebugLoadJobs.back().file.get_strref().same_str_case(filename)) {
+		sDebugLoadJobs.push_back(DebugLoadJob());
+		DebugLoadJob& job = sDebugLoadJobs.back();
+		job.type = type;
+		job.ifPrevFailed = ifPrevFailed;
+		job.file.copy(filename);
+	}
+	if (!sDebugLoadRunning) {
+		sDebugLoadRunning = true;
+		IBThread thread;
+		if (IBCreateThread(&thread, 65536, DebugLoadThread, nullptr)) {
+			IBReleaseThread(&thread);
+		} else {
+			sDebugLoadRunning = false;	// the jobs run with the next queued one
+		}
+	}
+	IBMutexRelease(&sDebugLoadMutex);
+}
+
+bool DebugLoadProgress(float& progress)
+{
+	if (!sDebugLoadRunning) { return false; }
+	size_t done = sDebugLoadDone, total = sDebugLoadTotal;
+	progress = total ? (float)done / (float)total : 0.0f;
+	return true;
+}
+
+void DebugLoadStep(size_t done, size_t total)
+{
+	sDebugLoadDone.store(done, std::memory_order_relaxed);
+	sDebugLoadTotal.store(total, std::memory_order_relaxed);
+}
+
+void DebugLoadTick()
+{
+	UpdateLoadedSymbols();
+	if (UpdateLoadedSourceDebug()) {
+		ReviewListing();
+	}
+}
+
+void InitDebugLoad()
+{
+	IBMutexInit(&sDebugLoadMutex, "Debug Load");
+}
+
+// lets the current load finish and drops the rest
+void ShutdownDebugLoad()
+{
+	IBMutexLock(&sDebugLoadMutex);
+	sDebugLoadCancel = true;
+	IBMutexRelease(&sDebugLoadMutex);
+	while (sDebugLoadRunning) { std::this_thread::yield(); }
+	// the thread clears sDebugLoadRunning while holding the mutex
+	IBMutexLock(&sDebugLoadMutex);
+	IBMutexRelease(&sDebugLoadMutex);
+	IBMutexDestroy(&sDebugLoadMutex);
+}
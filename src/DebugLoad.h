@@ -0,0 +1,26 @@
+#pragma once
+
+// symbol, debug info and listing files are read and parsed on a loader thread
+// so the UI keeps drawing, the results are swapped in by DebugLoadTick
+enum class DebugLoadType {
+	SymbolsFile,		// .dbg, .sym or .vs by extension
+	SymbolsForBinary,	// debug files next to a program
+	KickDbg,
+	KickDbgExtra,		// added to the current debug info
+	ViceCommands,
+	Symbols,
+	Listing,
+	HotReloadHash		// contents of the files watched for hot reload
+};
+
+// ifPrevFailed: skip this load if the load queued before it succeeded
+void QueueDebugLoad(DebugLoadType type, const char* filename, bool ifPrevFailed = false);
+// true while loading, progress of the current file 0-1
+bool DebugLoadProgress(float& progress);
+// loading thread, bytes of the current file that have been parsed
+void DebugLoadStep(size_t done, size_t total);
+
+// UI thread, once per frame
+void DebugLoadTick();
+void InitDebugLoad();
+void ShutdownDebugLoad();
@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIFF_SSE2
+#endif
+
+static inline uint32_t DiffCountBits(uint32_t v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
+
+// byte by byte version, used for the unaligned ends and as the reference in bench/DiffBytesBench.cpp
+static inline uint32_t DiffBytesScalar(const uint8_t* prev, const uint8_t* next, uint32_t bytes, uint32_t addr, uint8_t* bits)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < bytes; ++i) {
+		if (prev[i] != next[i]) {
+			if (bits) { bits[(addr + i) >> 3] |= 1 << ((addr + i) & 7); }
+			++count;
+		}
+	}
+	return count;
+}
+
+// compare two runs of bytes, sets a bit per differing byte from addr in bits
+// if not null and returns the number of bytes that differ
+static inline uint32_t DiffBytes(const uint8_t* prev, const uint8_t* next, uint32_t bytes, uint32_t addr, uint8_t* bits)
+{
+	// scalar until the bitmap is byte aligned so vector masks can be or'd in whole
+	uint32_t i = (8 - (addr & 7)) & 7;
+	if (i > bytes) { i = bytes; }
+	uint32_t count = DiffBytesScalar(prev, next, i, addr, bits);
+#if defined(__AVX2__)
+	for (; (i + 32) <= bytes; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(prev + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(next + i));
+		uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+		if (diff) {
+			count += DiffCountBits(diff);
+			if (bits) {
+				uint8_t* out = bits + ((addr + i) >> 3);
+				out[0] |= (uint8_t)diff; out[1] |= (uint8_t)(diff >> 8);
+				out[2] |= (uint8_t)(diff >> 16); out[3] |= (uint8_t)(diff >> 24);
+			}
+		}
+	}
+#endif
+#ifdef DIFF_SSE2
+	for (; (i + 16) <= bytes; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(prev + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(next + i));
+		uint32_t diff = 0xffff ^ (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if (diff) {
+			count += DiffCountBits(diff);
+			if (bits) {
+				uint8_t* out = bits + ((addr + i) >> 3);
+				out[0] |= (uint8_t)diff; out[1] |= (uint8_t)(diff >> 8);
+			}
+		}
+	}
+#endif
+	return count + DiffBytesScalar(prev + i, next + i, bytes - i, addr + i, bits);
+}
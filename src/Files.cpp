@@ -1,5 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 #include "Files.h"
 
 bool SaveFile(const char *filename, void* data, size_t size)
@@ -18,6 +23,44 @@ bool SaveFile(const char *filename, void* data, size_t size)
 	return false;
 }
 
+bool SaveBinary(const char* filename, const void* data, size_t size)
+{
+	FILE* f;
+#ifdef _WIN32
+	if (fopen_s(&f, filename, "wb") == 0 && f != nullptr) {
+#else
+	f = fopen(filename, "wb");
+	if (f) {
+#endif
+		bool written = fwrite(data, size, 1, f) == 1 || !size;
+		fclose(f);
+		return written;
+	}
+	return false;
+}
+
+bool FileStamp(const char* path, uint64_t& size, int64_t& modified)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr)) { return false; }
+	size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+	// 100ns ticks since 1601
+	uint64_t ticks = ((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+	modified = ((int64_t)ticks - 116444736000000000ll) * 100;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0) { return false; }
+	size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+	modified = (int64_t)st.st_mtimespec.tv_sec * 1000000000ll + st.st_mtimespec.tv_nsec;
+#else
+	modified = (int64_t)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+#endif
+#endif
+	return true;
+}
+
 uint8_t* LoadBinary(const char* name, size_t& size)
 {
 	FILE* f;
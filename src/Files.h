@@ -2,7 +2,10 @@
 
 #include <stdint.h>
 bool SaveFile(const char* filename, void* data, size_t size);
+bool SaveBinary(const char* filename, const void* data, size_t size);
 uint8_t* LoadBinary(const char* name, size_t& size);
+// size and modification time in nanoseconds since 1970, as precise as the file system keeps it
+bool FileStamp(const char* path, uint64_t& size, int64_t& modified);
 
 #ifndef _MSC_VER
 int fopen_s(FILE **f, const char* filename, const char *options);
@@ -1,171 +1,162 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
-
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Robin Hood hash table with backward shift deletion. Every slot has a
+// metadata byte holding its distance from the home slot plus one (0 = empty)
+// so probing compares bytes before keys, stops as soon as a slot is closer to
+// its home than the key would be, and any key value including 0 can be stored.
+// Values only exist in used slots and are moved when the table grows.
 template< class KeyType, class ValueType > struct HashTable {
+	enum { MAX_DIST = 255 };
 
 	size_t size;
-	size_t maxSteps;
 	size_t used;
 
 	KeyType* keys;
 	ValueType* values;
+	uint8_t* dist;
 
 	static size_t HashValue(KeyType kv) { uint64_t v = kv; return size_t(((v + (v >> 28) + (v << 28)) + 14695981039346656037ull) * 1099511628211ull); }
 	static size_t Slot(size_t hash, size_t tableSize) { return hash & (tableSize - 1); }
 	static size_t NextSlot(size_t hash, size_t tableSize) { return (hash + 1) & (tableSize - 1); }
 	static size_t HashSlot(KeyType key, size_t tableSize) { return Slot(HashValue(key), tableSize); }
-	static size_t FindSlot(KeyType hash, size_t hashTableSize, KeyType* hashKeys) {
-		size_t slot = HashSlot(hash, hashTableSize);
-		while (KeyType k = hashKeys[slot]) {
-			if (k == hash) { return slot; }
-			slot = NextSlot(slot, hashTableSize);
-		}
-		return slot;
-	}
-	static size_t FindSlot(KeyType hash, size_t hashTableSize, KeyType* hashKeys, size_t maxKeySteps) {
-		size_t slot = HashSlot(hash, hashTableSize);
-		while (hashKeys) {
-			KeyType k = hashKeys[slot];
-			if (!k || k == hash) { return slot; }
-			slot = NextSlot(slot, hashTableSize);
-			if (!maxKeySteps--) { break; }
-		}
-		return slot;
-	}
 
-	size_t HashSlot(KeyType key) { return HashSlot(key, size); }
-
-	size_t InsertSlot(KeyType key, size_t slot) {
-		const KeyType* hashKeys = keys;
-		size_t currSize = size;
-		size_t insertSteps = 0;
-		while (KeyType k = hashKeys[slot]) {
-			if (k == key) { return slot; }  // key already exists
-			size_t kfirst = HashSlot(k, currSize);
-			size_t ksteps = kfirst > slot ? (currSize + slot - kfirst) : (slot - kfirst);
-			if (insertSteps > ksteps) { return slot; }
+	size_t HashSlot(KeyType key) const { return HashSlot(key, size); }
+
+	// slot holding key or size if not found
+	size_t FindSlot(KeyType key) const {
+		if (!used) { return size; }
+		size_t slot = HashSlot(key);
+		for (uint32_t d = 1; dist[slot] >= d; ++d) {
+			if (keys[slot] == key) { return slot; }
 			slot = NextSlot(slot, size);
-			++insertSteps;
 		}
-		return slot;
+		return size;
 	}
 
-	size_t FindSlot(KeyType hash) const { return FindSlot(hash, size, keys, maxSteps); }
-
-	size_t Steps(KeyType hash) {
-		size_t slot = HashSlot(hash, size);
-		size_t numSteps = 0;
-		while (keys[slot] && keys[slot] != hash) {
-			++numSteps;
+	// key must not be in the table and the table must have room
+	ValueType* InsertNew(KeyType key) {
+		size_t slot = HashSlot(key);
+		uint32_t d = 1;
+		while (dist[slot] >= d) {
 			slot = NextSlot(slot, size);
+			++d;
 		}
-		return numSteps;
-	}
-
-	void UpdateSteps(size_t first, size_t slot) {
-		size_t steps = slot > first ? (slot - first) : (size + slot - first);
-		if (steps > maxSteps) { maxSteps = steps; }
-	}
-
-	ValueType* InsertFitted(KeyType key) {
-		assert(key); // key may not be 0
-		size_t first = HashSlot(key);
-		size_t slot = InsertSlot(key, first);
-		UpdateSteps(first, slot);
-		if (keys[slot]) {
-			if (keys[slot] == key) { return &values[slot]; } else {
-				KeyType prvKey = keys[slot];
-				ValueType prev_value = values[slot];
-				keys[slot] = key;
-				for (;; ) {
-					size_t prev_first = HashSlot(prvKey);
-					size_t slotRH = InsertSlot(prvKey, prev_first);
-					UpdateSteps(prev_first, slotRH);
-					if (keys[slotRH] && keys[slotRH] != prvKey) {
-						KeyType tmpKey = keys[slotRH];
-						keys[slotRH] = prvKey;
-						prvKey = tmpKey;
-						ValueType temp_value = values[slotRH];
-						values[slotRH] = prev_value;
-						prev_value = temp_value;
-					} else {
-						keys[slotRH] = prvKey;
-						values[slotRH] = prev_value;
-						++used;
-						return &values[slot];
-					}
-				}
-			}
+		if (d >= MAX_DIST) {
+			Grow(size << 1);
+			return InsertNew(key);
+		}
+		if (!dist[slot]) {
+			keys[slot] = key;
+			dist[slot] = (uint8_t)d;
+			++used;
+			return new (values + slot) ValueType();
 		}
+		// take the slot from the entry closer to its home and push that one along
+		KeyType carryKey = keys[slot];
+		ValueType carryValue(std::move(values[slot]));
+		uint32_t carryDist = dist[slot];
+		values[slot].~ValueType();
 		keys[slot] = key;
+		dist[slot] = (uint8_t)d;
+		ValueType* inserted = new (values + slot) ValueType();
 		++used;
-		return &values[slot];
+		for (;;) {
+			slot = NextSlot(slot, size);
+			if (++carryDist >= MAX_DIST) {
+				// rare enough to rehash everything and place the carried entry after
+				Grow(size << 1);
+				*InsertNew(carryKey) = std::move(carryValue);
+				return &values[FindSlot(key)];
+			}
+			if (!dist[slot]) {
+				keys[slot] = carryKey;
+				dist[slot] = (uint8_t)carryDist;
+				new (values + slot) ValueType(std::move(carryValue));
+				return inserted;
+			}
+			if (dist[slot] < carryDist) {
+				KeyType k = keys[slot]; keys[slot] = carryKey; carryKey = k;
+				uint32_t cd = dist[slot]; dist[slot] = (uint8_t)carryDist; carryDist = cd;
+				std::swap(values[slot], carryValue);
+			}
+		}
 	}
 
 	HashTable() { Reset(); }
+	~HashTable() { Clear(); }
+
+	HashTable(const HashTable&) = delete;
+	HashTable& operator=(const HashTable&) = delete;
 
 	void Reset() {
 		used = 0;
 		size = 0;
-		maxSteps = 0;
 		keys = nullptr;
 		values = nullptr;
+		dist = nullptr;
 	}
 
-	~HashTable() { Clear(); }
-
 	void Clear() {
-		if (values) {
-			for (size_t i = 0, n = size; i < n; ++i) {
-				values[i].~ValueType();
-			}
-			free(values);
+		for (size_t i = 0; !std::is_trivially_destructible<ValueType>::value && dist && i < size; ++i) {
+			if (dist[i]) { values[i].~ValueType(); }
 		}
+		if (values) { free(values); }
 		if (keys) { free(keys); }
+		if (dist) { free(dist); }
 		Reset();
 	}
 
 	size_t GetUsed() const { return used; }
-	bool TableMax() const { return used && (used << 4) >= (size * 13); }
+	static bool TableMax(size_t count, size_t tableSize) { return (count << 4) >= (tableSize * 13); }
+	bool TableMax() const { return used && TableMax(used, size); }
 
-	void Grow() {
+	// rehash into newSize slots, values are moved to the new table
+	void Grow(size_t newSize) {
 		KeyType* prevKeys = keys;
 		ValueType* prevValues = values;
+		uint8_t* prevDist = dist;
 		size_t prevSize = size;
-		size_t newSize = prevSize ? (prevSize << 1) : 64;
 
 		size = newSize;
-		keys = (KeyType*)calloc(1, newSize * sizeof(KeyType));
-		values = (ValueType*)calloc(1, newSize * sizeof(ValueType));
-		maxSteps = 0;
-
-//		for (size_t i = 0; i < newSize; ++i) {
-//			new (values + i) ValueType;
-//		}
-
-		if (used) {
-			used = 0;
-			for (size_t i = 0; i < prevSize; i++) {
-				if (KeyType key = prevKeys[i]) {
-					*InsertFitted(key) = prevValues[i];
-				}
-			}
-		}
+		keys = (KeyType*)malloc(newSize * sizeof(KeyType));
+		values = (ValueType*)malloc(newSize * sizeof(ValueType));
+		dist = (uint8_t*)calloc(1, newSize);
+		used = 0;
 
-		if (prevKeys) { free(prevKeys); }
-		if (prevValues) {
-			for (size_t i = 0; i != prevSize; ++i) {
+		for (size_t i = 0; prevDist && i < prevSize; ++i) {
+			if (prevDist[i]) {
+				*InsertNew(prevKeys[i]) = std::move(prevValues[i]);
 				prevValues[i].~ValueType();
 			}
-			free(prevValues);
 		}
+
+		if (prevKeys) { free(prevKeys); }
+		if (prevValues) { free(prevValues); }
+		if (prevDist) { free(prevDist); }
+	}
+
+	void Grow() { Grow(size ? (size << 1) : 64); }
+
+	// make room for count keys without growing again
+	void Reserve(size_t count) {
+		size_t newSize = size ? size : 64;
+		while (TableMax(count, newSize)) { newSize <<= 1; }
+		if (newSize > size) { Grow(newSize); }
 	}
 
 	ValueType* Insert(KeyType key) {
-		if (!size || TableMax()) { Grow(); }
-		return InsertFitted(key);
+		size_t slot = FindSlot(key);
+		if (slot < size) { return &values[slot]; }
+		if (!size || TableMax(used + 1, size)) { Grow(); }
+		return InsertNew(key);
 	}
 
 	ValueType* Insert(KeyType key, const ValueType& value) {
@@ -174,18 +165,48 @@ template< class KeyType, class ValueType > struct HashTable {
 		return value_ptr;
 	}
 
-	bool Exists(KeyType key) {
-		return size && key && keys[FindSlot(key)] == key;
+	bool Exists(KeyType key) const {
+		return FindSlot(key) < size;
 	}
 
 	ValueType* Value(KeyType key) {
-		if (size && key) {
-			size_t slot = FindSlot(key);
-			if (keys[slot] == key) {
-				return &values[slot];
-			}
+		size_t slot = FindSlot(key);
+		return slot < size ? &values[slot] : nullptr;
+	}
+
+	// shift the following entries that aren't in their home slot back by one
+	bool Erase(KeyType key) {
+		size_t slot = FindSlot(key);
+		if (slot >= size) { return false; }
+		values[slot].~ValueType();
+		for (size_t next = NextSlot(slot, size); dist[next] > 1; next = NextSlot(next, size)) {
+			keys[slot] = keys[next];
+			dist[slot] = dist[next] - 1;
+			new (values + slot) ValueType(std::move(values[next]));
+			values[next].~ValueType();
+			slot = next;
 		}
-		return nullptr;
+		dist[slot] = 0;
+		--used;
+		return true;
 	}
-};
 
+	// for (auto& entry : table) { entry.Key(); entry.Value(); }
+	struct Iterator {
+		HashTable* table;
+		size_t slot;
+		KeyType Key() const { return table->keys[slot]; }
+		ValueType& Value() const { return table->values[slot]; }
+		Iterator& operator*() { return *this; }
+		Iterator& operator++() { slot = table->UsedSlot(slot + 1); return *this; }
+		bool operator!=(const Iterator& other) const { return slot != other.slot; }
+	};
+
+	size_t UsedSlot(size_t slot) const {
+		while (slot < size && !dist[slot]) { ++slot; }
+		return slot;
+	}
+
+	Iterator begin() { Iterator it = { this, UsedSlot(0) }; return it; }
+	Iterator end() { Iterator it = { this, size }; return it; }
+};
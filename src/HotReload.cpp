@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include "struse/struse.h"
+#include "Files.h"
+#include "FileDialog.h"
+#include "Sym.h"
+#include "DebugLoad.h"
+#include "6510.h"
+#include "ViceInterface.h"
+#include "HotReload.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+enum {
+	HOT_RELOAD_SETTLE = 6,		// frames without changes before reloading, builds write several files
+	HOT_RELOAD_POLL = 30,		// frames between checks when file events aren't available
+	HOT_RELOAD_GAP = 16,		// unchanged bytes merged into an upload rather than starting another
+	HOT_RELOAD_RECENT = 2		// seconds after a write that polling also compares contents, stamps may be coarse
+};
+
+enum WatchedFileType {
+	WF_Program,
+	WF_KickDbg,
+	WF_Symbols,
+	WF_ViceCmd,
+	WF_Count
+};
+
+static const char* saWatchedExt[WF_Count] = { nullptr, ".dbg", ".sym", ".vs" };
+
+struct WatchedFile {
+	strown<PATH_MAX_LEN> path;
+	uint64_t size;
+	int64_t modified;
+	bool changed;
+};
+
+static bool sHotReload = false;
+static bool sHotReloadRestart = false;
+static WatchedFile saWatched[WF_Count];
+static strown<PATH_MAX_LEN> sWatchedProgram;
+static uint32_t sFrame = 0;
+static uint32_t sLastChange = 0;
+static bool sChangePending = false;
+
+// contents are hashed on the debug load thread, the UI only asks for it
+static std::atomic<uint32_t> sHashRequests(0);		// bit per WatchedFileType
+static std::atomic<bool> sProgramChanged(false);	// set by the debug load thread
+static strown<PATH_MAX_LEN> sHashedProgram;			// debug load thread
+static uint32_t saHashes[WF_Count];					// debug load thread, contents when last read
+
+#ifdef __linux__
+static int sNotifyFD = -1;
+static int sNotifyWatch = -1;
+#endif
+
+static uint32_t FileHash(const char* path)
+{
+	size_t size = 0;
+	uint32_t hash = 0;
+	if (uint8_t* data = LoadBinary(path, size)) {
+		hash = strref((const char*)data, (strl_t)size).fnv1a();
+		free(data);
+	}
+	return hash;
+}
+
+static void WatchedPath(const char* program, int type, strown<PATH_MAX_LEN>& path)
+{
+	strref base = strref(program).before_last('.');
+	if (!base) { base = strref(program); }
+	if (saWatchedExt[type]) { path.copy(base); path.append(saWatchedExt[type]); }
+	else { path.copy(program); }
+}
+
+// debug load thread, reads the debug files again if their contents changed.
+// the first call for a program only records the hashes
+bool HotReloadHashFiles(const char* program)
+{
+	uint32_t requests = sHashRequests.exchange(0);
+	bool first = !sHashedProgram.same_str_case(program);
+	if (first) {
+		sHashedProgram.copy(program);
+		requests = (1 << WF_Count) - 1;
+	}
+	bool symbols = false;
+	for (int f = 0; f < WF_Count; ++f) {
+		if (!(requests & (1 << f))) { continue; }
+		strown<PATH_MAX_LEN> path;
+		WatchedPath(program, f, path);
+		// rebuilds often write identical files
+		uint32_t hash = FileHash(path.c_str());
+		if (!first && hash != saHashes[f]) {
+			if (f == WF_Program) { sProgramChanged = true; }
+			else { symbols = true; }
+		}
+		saHashes[f] = hash;
+	}
+	if (symbols) { ReadSymbolsForBinary(program); }
+	return true;
+}
+
+static void StopWatching()
+{
+#ifdef __linux__
+	if (sNotifyFD >= 0) {
+		close(sNotifyFD);
+		sNotifyFD = -1;
+		sNotifyWatch = -1;
+	}
+#endif
+	sWatchedProgram.clear();
+	sChangePending = false;
+}
+
+static void StartWatching(const char* program)
+{
+	StopWatching();
+	sWatchedProgram.copy(program);
+	for (int f = 0; f < WF_Count; ++f) {
+		WatchedFile& file = saWatched[f];
+		WatchedPath(program, f, file.path);
+		file.size = 0;
+		file.modified = 0;
+		file.changed = false;
+		FileStamp(file.path.c_str(), file.size, file.modified);
+	}
+	sProgramChanged = false;
+	QueueDebugLoad(DebugLoadType::HotReloadHash, program);
+#ifdef __linux__
+	// watch the folder, assemblers often replace files rather than write them
+	strown<PATH_MAX_LEN> folder(strref(program).before_last('/'));
+	if (!folder) { folder.copy("."); }
+	sNotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (sNotifyFD >= 0) {
+		sNotifyWatch = inotify_add_watch(sNotifyFD, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (sNotifyWatch < 0) {
+			close(sNotifyFD);
+			sNotifyFD = -1;
+		}
+	}
+#endif
+}
+
+// true if any watched file was touched since the last check
+static bool CheckFiles()
+{
+	bool touched = false;
+#ifdef __linux__
+	if (sNotifyFD >= 0) {
+		char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t bytes;
+		while ((bytes = read(sNotifyFD, events, sizeof(events))) > 0) {
+			for (char* e = events; e < events + bytes;) {
+				const struct inotify_event* event = (const struct inotify_event*)e;
+				if (event->len) {
+					for (int f = 0; f < WF_Count; ++f) {
+						if (strref(saWatched[f].path.c_str()).after_last_or_full('/').same_str_case(event->name)) {
+							saWatched[f].changed = true;
+							touched = true;
+						}
+					}
+				}
+				e += sizeof(struct inotify_event) + event->len;
+			}
+		}
+		return touched;
+	}
+#endif
+	if ((sFrame % HOT_RELOAD_POLL) != 0) { return false; }
+	int64_t recent = ((int64_t)time(nullptr) - HOT_RELOAD_RECENT) * 1000000000ll;
+	for (int f = 0; f < WF_Count; ++f) {
+		WatchedFile& file = saWatched[f];
+		uint64_t size = 0;
+		int64_t modified = 0;
+		// a rewrite within the stamp resolution looks the same, the hash tells
+		if (FileStamp(file.path.c_str(), size, modified) && (size != file.size || modified != file.modified || modified >= recent)) {
+			file.size = size;
+			file.modified = modified;
+			file.changed = true;
+			touched = true;
+		}
+	}
+	return touched;
+}
+
+// upload the parts of the program that differ from the mirrored memory.
+// while VICE runs the mirror is stale until the break is answered, so the
+// whole image goes up instead
+static void PatchProgram(const char* program)
+{
+	CPU6510* cpu = GetMainCPU();
+	size_t size = 0;
+	uint8_t* file = LoadBinary(program, size);
+	if (!cpu || !file) { return; }
+	if (size > 2) {
+		uint32_t start = file[0] + (((uint32_t)file[1]) << 8);
+		uint32_t bytes = (uint32_t)(size - 2);
+		if (bytes > (0x10000 - start)) { bytes = 0x10000 - start; }
+		const uint8_t* image = file + 2;
+		if (ViceRunning()) {
+			ViceBreak();
+			cpu->Upload((uint16_t)start, image, bytes);
+			ViceGo();
+		} else if (uint8_t* mirror = (uint8_t*)malloc(bytes)) {
+			cpu->ReadMemory((uint16_t)start, mirror, bytes);
+			uint32_t runStart = 0, runEnd = 0;	// runEnd is exclusive, 0 means no run
+			for (uint32_t i = 0; i < bytes; ++i) {
+				uint16_t addr = (uint16_t)(start + i);
+				// bytes of pages that weren't read this stop can't be compared
+				if (image[i] == mirror[i] && cpu->MemoryValid(addr, addr)) { continue; }
+				if (runEnd && (i - runEnd) <= HOT_RELOAD_GAP) {
+					runEnd = i + 1;
+				} else {
+					if (runEnd) { cpu->Upload((uint16_t)(start + runStart), image + runStart, runEnd - runStart); }
+					runStart = i;
+					runEnd = i + 1;
+				}
+			}
+			if (runEnd) { cpu->Upload((uint16_t)(start + runStart), image + runStart, runEnd - runStart); }
+			free(mirror);
+		}
+	}
+	free(file);
+}
+
+// the changed files are compared on the debug load thread
+static void Reload()
+{
+	uint32_t requests = 0;
+	for (int f = 0; f < WF_Count; ++f) {
+		WatchedFile& file = saWatched[f];
+		if (!file.changed) { continue; }
+		file.changed = false;
+		FileStamp(file.path.c_str(), file.size, file.modified);
+		requests |= 1 << f;
+	}
+	if (requests) {
+		sHashRequests.fetch_or(requests);
+		QueueDebugLoad(DebugLoadType::HotReloadHash, sWatchedProgram.c_str());
+	}
+}
+
+void HotReloadTick()
+{
+	++sFrame;
+	const char* program = sHotReload ? ReloadProgramFile() : nullptr;
+	if (!program) {
+		if (sWatchedProgram.valid()) { StopWatching(); }
+		return;
+	}
+	if (!sWatchedProgram.same_str_case(program)) { StartWatching(program); }
+
+	if (CheckFiles()) {
+		sChangePending = true;
+		sLastChange = sFrame;
+	}
+	if (sChangePending && (sFrame - sLastChange) >= HOT_RELOAD_SETTLE) {
+		sChangePending = false;
+		Reload();
+	}
+	if (sProgramChanged.exchange(false)) {
+		if (sHotReloadRestart) { ViceStartProgram(sWatchedProgram.c_str()); }
+		else { PatchProgram(sWatchedProgram.c_str()); }
+	}
+}
+
+void ShutdownHotReload()
+{
+	StopWatching();
+}
+
+bool HotReloadEnabled() { return sHotReload; }
+void HotReloadEnable(bool enable) { sHotReload = enable; }
+bool HotReloadRestarts() { return sHotReloadRestart; }
+void HotReloadSetRestart(bool restart) { sHotReloadRestart = restart; }
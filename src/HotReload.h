@@ -0,0 +1,15 @@
+#pragma once
+
+// watches the loaded program and its debug files, when they are rebuilt only
+// the bytes that differ from the mirrored memory are uploaded and the debug
+// info is read again if its contents changed
+void HotReloadTick();
+void ShutdownHotReload();
+// debug load thread, compares the contents of the files that were touched
+bool HotReloadHashFiles(const char* program);
+
+bool HotReloadEnabled();
+void HotReloadEnable(bool enable);
+// autostart the rebuilt program instead of patching memory in place
+bool HotReloadRestarts();
+void HotReloadSetRestart(bool restart);
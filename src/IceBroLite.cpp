@@ -40,6 +40,8 @@
 #include "FileDialog.h"
 #include "Breakpoints.h"
 #include "Traces.h"
+#include "HotReload.h"
+#include "DebugLoad.h"
 #include "Sym.h"
 #include "StartVice.h"
 #include "SaveState.h"
@@ -133,7 +135,7 @@ static char forceLoadExtraDebug[PATH_MAX_LEN];
 // when "Reload" button is pressed as well
 void CheckForceLoadExtraDebug() {
 	if(forceLoadExtraDebug[0]) {
-		ReadC64DbgSrcExtra(forceLoadExtraDebug);
+		QueueDebugLoad(DebugLoadType::KickDbgExtra, forceLoadExtraDebug);
 	}
 }
 
@@ -232,6 +234,7 @@ int main(int argc, char* argv[])
 	InitStartFolder();
 	CreateMainCPU();
 	InitSymbols();
+	InitDebugLoad();
 	InitBreakpoints();
 	InitTraces();
 
@@ -294,9 +297,9 @@ int main(int argc, char* argv[])
 	CheckUserFont();
 	CheckCustomThemeAfterStateLoad();
 
-	// if only symbols provided just read those in immediately
+	// if only symbols provided start reading those in immediately
 	if (forceLoadProgram[0] == 0 && forceLoadSymbols[0] != 0) {
-		ReadSymbolsFile(forceLoadSymbols);
+		QueueDebugLoad(DebugLoadType::SymbolsFile, forceLoadSymbols);
 		forceLoadSymbols[0] = 0;
 	}
 
@@ -391,9 +394,9 @@ int main(int argc, char* argv[])
 		if (forceLoadProgram[0] != 0 && ViceConnected()) {
 			ViceStartProgram(forceLoadProgram);
 			if (forceLoadSymbols[0] != 0) {
-				ReadSymbolsFile(forceLoadSymbols);
+				QueueDebugLoad(DebugLoadType::SymbolsFile, forceLoadSymbols);
 			} else {
-				ReadSymbolsForBinary(forceLoadProgram);
+				QueueDebugLoad(DebugLoadType::SymbolsForBinary, forceLoadProgram);
 				CheckForceLoadExtraDebug();
 			}
 			forceLoadProgram[0] = 0;
@@ -401,21 +404,19 @@ int main(int argc, char* argv[])
 		}
 
 		if (const char* kickDbgFile = LoadKickDbgReady()) {
-			ReadC64DbgSrc(kickDbgFile);
+			QueueDebugLoad(DebugLoadType::KickDbg, kickDbgFile);
 		}
 		if (const char* kickDbgExtraFile = LoadKickDbgExtraReady()) {
-			ReadC64DbgSrcExtra(kickDbgExtraFile);
+			QueueDebugLoad(DebugLoadType::KickDbgExtra, kickDbgExtraFile);
 		}
 		if (const char* viceMonCmdFile = LoadViceCMDReady()) {
-			ReadViceCommandFile(viceMonCmdFile);
+			QueueDebugLoad(DebugLoadType::ViceCommands, viceMonCmdFile);
 		}
 		if (const char* symFile = LoadSymbolsReady()) {
-			ReadSymbols(symFile);
+			QueueDebugLoad(DebugLoadType::Symbols, symFile);
 		}
 		if (const char* listFile = LoadListingReady()) {
-			if (ReadListingFile(listFile)) {
-				ReviewListing();
-			}
+			QueueDebugLoad(DebugLoadType::Listing, listFile);
 		}
 		if (const char* themeFile = LoadThemeReady()) {
 			LoadCustomTheme(themeFile);
@@ -434,6 +435,8 @@ int main(int argc, char* argv[])
 		SaveState();
 	}
 
+	ShutdownHotReload();
+	ShutdownDebugLoad();
 	ShutdownTraces();
 	ShutdownBreakpoints();
 	ShutdownSourceDebug();
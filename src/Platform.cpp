@@ -61,7 +61,7 @@ bool IBCreateThread(IBThread* thread, size_t stackSize, IBThreadFunc func, void
 
 //	int pthread_create(pthread_t * thread, const pthread_attr_t * attr,
 //					   void* (*start_routine) (void*), void* arg);
-	return pthread_create(thread, &attr, func, param);
+	return pthread_create(thread, &attr, func, param) == 0;
 #endif
 }
 
@@ -79,6 +79,17 @@ bool IBDestroyThread(IBThread* thread)
 #endif
 }
 
+// let go of a thread that runs to completion by itself
+bool IBReleaseThread(IBThread* thread)
+{
+#ifdef _WIN32
+	return IBDestroyThread(thread);
+#else
+	*thread = IBThread_Clear;	// created detached
+	return true;
+#endif
+}
+
 #ifdef _WIN32
 HWND GetHWnd();
 #endif
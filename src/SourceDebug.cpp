@@ -5,10 +5,14 @@
 #include <stdlib.h>
 #include <vector>
 #include <assert.h>
+#include <atomic>
 #include "ViceInterface.h"
 #include "Breakpoints.h"
 #include "SourceDebug.h"
 #include "platform.h"
+#include "DebugLoad.h"
+#include "DebugCache.h"
+#include "HashTable.h"
 
 // Format:
 //	parse as XML
@@ -28,15 +32,21 @@ struct SourceDebugSegment {
 	uint16_t addrFirst, addrLast;
 	SourceDebugLine* lines;
 	strref* blockNames;	// indexed by lines->block
+	uint32_t numBlocks;
 	strref name;
 };
 
 struct SourceDebug {
 	std::vector<SourceDebugSegment> segments; // contains blocks which contains lines
 	std::vector<void*> files; // segments reference strings in these files directly
+	char* listing;	// loaded listing file waiting for the UI thread
+	size_t listingSize;
+	bool append;	// loaded debug info is added to the current debug info
+	SourceDebug() : listing(nullptr), listingSize(0), append(false) {}
 };
 
 SourceDebug* sSourceDebug = nullptr;
+static std::atomic<SourceDebug*> sLoadedSourceDebug(nullptr);	// loaded, waiting for the UI thread
 
 char* sListing = nullptr;
 size_t sListingSize = 0;
@@ -64,51 +74,71 @@ strref GetSourceAt(uint16_t addr, int &spaces)
 	return strref();
 }
 
-// clean just the source debug references not the original files
-void ClearSourceDebugMap()
+// keep is a file the segments reference that is owned elsewhere
+static void FreeSourceDebug(SourceDebug* dbg, const void* keep)
 {
-	if (SourceDebug* dbg = sSourceDebug) {
-		IBMutexLock(&sSrcDbgMutex);
-		while (!dbg->segments.empty()) {
-			SourceDebugSegment& seg = dbg->segments.back();
-			free(seg.lines);
-			free(seg.blockNames);
-			dbg->segments.pop_back();
-		}
-		while (!dbg->files.empty()) {
-			void* file = dbg->files.back();
-			if (file != sListing) {
-				free(file);
-			}
-			dbg->files.pop_back();
+	if (!dbg) { return; }
+	while (!dbg->segments.empty()) {
+		SourceDebugSegment& seg = dbg->segments.back();
+		free(seg.lines);
+		free(seg.blockNames);
+		dbg->segments.pop_back();
+	}
+	while (!dbg->files.empty()) {
+		void* file = dbg->files.back();
+		if (file != keep) {
+			free(file);
 		}
-		free(dbg);
-		sSourceDebug = nullptr;
-		IBMutexRelease(&sSrcDbgMutex);
+		dbg->files.pop_back();
 	}
+	if (dbg->listing) { free(dbg->listing); }
+	delete dbg;
 }
 
-void ClearSourceDebug()
+// moves the segments and files of add into dbg
+static void AppendSourceDebug(SourceDebug* dbg, SourceDebug* add)
 {
-	IBMutexLock(&sSrcDbgMutex);
-	if (SourceDebug* dbg = sSourceDebug) {
-		sSourceDebug = nullptr;
-		while (dbg->segments.size()) {
-			SourceDebugSegment& seg = dbg->segments[dbg->segments.size() - 1];
-			free(seg.lines);
-			free(seg.blockNames);
-			dbg->segments.pop_back();
-		}
-		while (dbg->files.size()) {
-			void* file = dbg->files[dbg->files.size() - 1];
-			if (file != sListing) {
-				free(dbg->files[dbg->files.size() - 1]);
-			}
-			dbg->files.pop_back();
+	dbg->segments.insert(dbg->segments.end(), add->segments.begin(), add->segments.end());
+	dbg->files.insert(dbg->files.end(), add->files.begin(), add->files.end());
+	add->segments.clear();
+	add->files.clear();
+	if (add->listing) {
+		if (dbg->listing) { free(dbg->listing); }
+		dbg->listing = add->listing;
+		dbg->listingSize = add->listingSize;
+		add->listing = nullptr;
+	}
+}
+
+// loading thread
+static void HandOverSourceDebug(SourceDebug* load)
+{
+	// combine with a load the UI thread hasn't picked up yet
+	if (SourceDebug* prev = sLoadedSourceDebug.exchange(nullptr)) {
+		if (load->append) {
+			AppendSourceDebug(prev, load);
+			delete load;
+			load = prev;
+		} else {
+			FreeSourceDebug(prev, nullptr);
 		}
-		free(dbg);
 	}
+	sLoadedSourceDebug.store(load);
+}
+
+// clean just the source debug references not the original files
+void ClearSourceDebugMap()
+{
+	IBMutexLock(&sSrcDbgMutex);
+	SourceDebug* dbg = sSourceDebug;
+	sSourceDebug = nullptr;
 	IBMutexRelease(&sSrcDbgMutex);
+	FreeSourceDebug(dbg, sListing);
+}
+
+void ClearSourceDebug()
+{
+	ClearSourceDebugMap();
 	if (sListing) {
 		free(sListing);
 		sListing = nullptr;
@@ -116,6 +146,31 @@ void ClearSourceDebug()
 	}
 }
 
+bool UpdateLoadedSourceDebug()
+{
+	SourceDebug* load = sLoadedSourceDebug.exchange(nullptr);
+	if (!load) { return false; }
+	if (!load->append) { ClearSourceDebug(); }
+	bool listing = load->listing != nullptr;
+	if (listing) {
+		// a previous listing takes the source debug made from it along
+		if (sListing) { ClearSourceDebug(); }
+		sListing = load->listing;
+		sListingSize = load->listingSize;
+		load->listing = nullptr;
+	}
+	IBMutexLock(&sSrcDbgMutex);
+	if (sSourceDebug) {
+		AppendSourceDebug(sSourceDebug, load);
+	} else if (load->segments.size() || load->files.size()) {
+		sSourceDebug = load;
+		load = nullptr;
+	}
+	IBMutexRelease(&sSrcDbgMutex);
+	FreeSourceDebug(load, nullptr);
+	return listing;
+}
+
 void InitSourceDebug()
 {
 	IBMutexInit(&sSrcDbgMutex, "Source Debug");
@@ -124,6 +179,7 @@ void InitSourceDebug()
 void ShutdownSourceDebug()
 {
 	ClearSourceDebug();
+	FreeSourceDebug(sLoadedSourceDebug.exchange(nullptr), nullptr);
 
 	IBMutexDestroy(&sSrcDbgMutex);
 }
@@ -154,16 +210,19 @@ struct ParseDebugSegment {
 };
 
 struct ParseDebugText {
+	strref text; // the whole debug file
 	strref path; // the path from the filename with the trailing slash, or empty
 	strref segment;
 	std::vector<ParseDebugSource*> files;
 	std::vector<ParseDebugSegment*> segments;
-	bool leaveExistingSymbols;
+	std::vector<uint16_t> breaks;
+	DebugCacheWriter cache;
 };
 
 bool C64DbgXMLCB(void* user, strref tag_or_data, const strref* tag_stack, int size_stack, XML_TYPE type)
 {
 	ParseDebugText* parse = (ParseDebugText*)user;
+	DebugLoadStep((size_t)(tag_or_data.get() - parse->text.get()), parse->text.get_len());
 
 	if (type == XML_TYPE::XML_TYPE_TEXT && size_stack) {
 		if (tag_stack->get_word().same_str("Sources")) {
@@ -178,6 +237,7 @@ bool C64DbgXMLCB(void* user, strref tag_or_data, const strref* tag_stack, int si
 				ParseDebugSource* source = new ParseDebugSource();
 				parse->files[id] = source;
 				source->file = LoadBinary(file.c_str(), source->size);
+				parse->cache.AddSource(file.c_str(), source->file, source->size);
 				if (source->file) {
 					const char* start = (const char*)source->file;
 					strref read(start, (strl_t)source->size);
@@ -246,7 +306,6 @@ bool C64DbgXMLCB(void* user, strref tag_or_data, const strref* tag_stack, int si
 			tag_or_data.trim_whitespace();
 			if (tag_or_data) {
 				//ViceSetUpdateSymbols(false);
-				if (!parse->leaveExistingSymbols) { ClearSymbols(); }
 				while (strref label = tag_or_data.line()) {
 					strref seg = label.split_token_trim(',');
 					strref addr = label.split_token_trim(',');
@@ -258,18 +317,21 @@ bool C64DbgXMLCB(void* user, strref tag_or_data, const strref* tag_stack, int si
 								  seg.get(), seg.get_len());
 					}
 				}
-				FilterSectionSymbols();
 			}
 		} else if (tag_stack->get_word().same_str("Breakpoints")) {
 			//<Breakpoints values="SEGMENT,ADDRESS,ARGUMENT">
+			// set when the parse is done
 			tag_or_data.trim_whitespace();
-			if (tag_or_data) { RemoveAllBreakpoints(); }
+			if (tag_or_data) {
+				parse->breaks.clear();
+				parse->cache.breakFlags |= DCB_RemoveAll;
+			}
 			while (strref bkpt = tag_or_data.line()) {
 				/*strref seg =*/ bkpt.split_token_trim(',');
 				strref addr = bkpt.split_token_trim(',');
 				/*strref cond =*/ bkpt.split_token_trim(',');
 				if (addr.get_first() == '$') { ++addr; }
-				ViceAddBreakpoint((uint16_t)addr.ahextoui());
+				parse->breaks.push_back((uint16_t)addr.ahextoui());
 				// TODO: Also send condition for breakpoint void ViceSetCondition(int checkPoint, strref condition)
 			}
 
@@ -286,7 +348,7 @@ bool ReadC64DbgInternal(SourceDebug *dbg, ParseDebugText &parse) {
 	// remember the file pointers for later cleanup
 	dbg->files.reserve(parse.files.size());
 	for (size_t f = 0; f < parse.files.size(); ++f) {
-		dbg->files.push_back(parse.files[f]->file);
+		if (parse.files[f]) { dbg->files.push_back(parse.files[f]->file); }
 	}
 
 	// segments depend on if they have data or not, could be empty.
@@ -312,6 +374,7 @@ bool ReadC64DbgInternal(SourceDebug *dbg, ParseDebugText &parse) {
 			segSrc->addrLast = addrLast;
 			segSrc->lines = (SourceDebugLine*)calloc((size_t)addrLast + 1 - (size_t)addrFirst, sizeof(SourceDebugLine));
 			segSrc->blockNames = (strref*)calloc(seg->blocks.size(), sizeof(strref));
+			segSrc->numBlocks = (uint32_t)seg->blocks.size();
 			segSrc->name = seg->name;
 			for (size_t b = 0; b < seg->blocks.size(); ++b) {
 				ParseDebugBlock* blk = seg->blocks[b];
@@ -346,64 +409,131 @@ bool ReadC64DbgInternal(SourceDebug *dbg, ParseDebugText &parse) {
 
 }
 
-// Load a source debug file without clearing out the current one
-bool ReadC64DbgSrcExtra(const char* filename) {
-	ParseDebugText parse;
-	parse.path = strref(filename).before_last('/', '\\');
-	parse.segment.clear(); // just in case there are blocks without segments I guess
-	parse.leaveExistingSymbols = true;
-	if (parse.path.get_len()) { parse.path = strref(parse.path.get(), parse.path.get_len() + 1); }
-	size_t size;
-	bool success = false;
-	if (void* voidbuf = LoadBinary(filename, size)) {
-		IBMutexLock(&sSrcDbgMutex);
-		if (ParseXML(strref((const char*)voidbuf, (strl_t)size), C64DbgXMLCB, &parse)) {
-			SourceDebug* dbg = sSourceDebug;
-			if (!dbg) {
-				SourceDebug* dbg = new SourceDebug;
-				sSourceDebug = dbg;
-			}
-			if (dbg) {
-				success = ReadC64DbgInternal(dbg, parse);
+static DebugCacheName CacheName(DebugCacheWriter& cache, strref name)
+{
+	DebugCacheName cacheName = { cache.Text(DCA_SourceText, name), (uint32_t)name.get_len() };
+	return cacheName;
+}
+
+static strref CachedName(const DebugCacheReader& cache, const DebugCacheName& name)
+{
+	if (!cache.ValidText(DCA_SourceText, name.text, name.len)) { return strref(); }
+	return strref(cache.Text(DCA_SourceText, name.text), (strl_t)name.len);
+}
+
+// the source lines are copied into the cache, lines shared by addresses only once
+static void CacheSourceDebug(DebugCacheWriter& cache, const SourceDebug* dbg)
+{
+	HashTable<uint64_t, uint32_t> written;
+	for (size_t s = 0, n = dbg->segments.size(); s < n; ++s) {
+		const SourceDebugSegment& seg = dbg->segments[s];
+		DebugCacheSegment cacheSeg = { seg.addrFirst, seg.addrLast, CacheName(cache, seg.name),
+			cache.Count<DebugCacheName>(DCA_Blocks), seg.numBlocks, cache.Count<DebugCacheLine>(DCA_Lines) };
+		cache.Add(DCA_Segments, cacheSeg);
+		for (uint32_t b = 0; b < seg.numBlocks; ++b) { cache.Add(DCA_Blocks, CacheName(cache, seg.blockNames[b])); }
+		for (uint32_t a = seg.addrFirst; a <= seg.addrLast; ++a) {
+			const SourceDebugLine& line = seg.lines[a - seg.addrFirst];
+			DebugCacheLine cacheLine = { (uint32_t)DebugCacheLine::NO_TEXT, line.len, line.spaces, line.block, 0 };
+			if (line.line) {
+				if (uint32_t* text = written.Value((uint64_t)(size_t)line.line)) {
+					cacheLine.text = *text;
+				} else {
+					cacheLine.text = cache.Text(DCA_SourceText, strref(line.line, (strl_t)line.len));
+					written.Insert((uint64_t)(size_t)line.line, cacheLine.text);
+				}
 			}
+			cache.Add(DCA_Lines, cacheLine);
 		}
-		// clear up ParseDebugText
-		while (parse.files.size()) {
-			delete parse.files[parse.files.size() - 1];
-			parse.files.pop_back();
+	}
+}
+
+// the segments point into the cache data which the debug info keeps
+static void ReadC64DbgCache(DebugCacheReader& cache, bool extra)
+{
+	SourceDebug* dbg = new SourceDebug;
+	dbg->append = extra;
+	const DebugCacheSegment* segments = cache.Array<DebugCacheSegment>(DCA_Segments);
+	const DebugCacheName* blocks = cache.Array<DebugCacheName>(DCA_Blocks);
+	const DebugCacheLine* lines = cache.Array<DebugCacheLine>(DCA_Lines);
+	uint32_t numBlocks = cache.Count<DebugCacheName>(DCA_Blocks);
+	uint32_t numLines = cache.Count<DebugCacheLine>(DCA_Lines);
+	for (uint32_t s = 0, n = cache.Count<DebugCacheSegment>(DCA_Segments); s < n; ++s) {
+		const DebugCacheSegment& cacheSeg = segments[s];
+		if (cacheSeg.addrFirst > cacheSeg.addrLast || cacheSeg.addrLast > 0xffff) { continue; }
+		uint32_t count = cacheSeg.addrLast + 1 - cacheSeg.addrFirst;
+		if (cacheSeg.firstLine > numLines || count > (numLines - cacheSeg.firstLine) ||
+			cacheSeg.firstBlock > numBlocks || cacheSeg.numBlocks > (numBlocks - cacheSeg.firstBlock)) { continue; }
+
+		SourceDebugSegment seg;
+		seg.addrFirst = (uint16_t)cacheSeg.addrFirst;
+		seg.addrLast = (uint16_t)cacheSeg.addrLast;
+		seg.lines = (SourceDebugLine*)calloc(count, sizeof(SourceDebugLine));
+		seg.blockNames = (strref*)calloc(cacheSeg.numBlocks ? cacheSeg.numBlocks : 1, sizeof(strref));
+		seg.numBlocks = cacheSeg.numBlocks;
+		seg.name = CachedName(cache, cacheSeg.name);
+		if (!seg.lines || !seg.blockNames) {
+			free(seg.lines);
+			free(seg.blockNames);
+			continue;
 		}
-		while (parse.segments.size()) {
-			ParseDebugSegment* segment = parse.segments[parse.segments.size() - 1];
-			while (segment->blocks.size()) {
-				delete segment->blocks[segment->blocks.size() - 1];
-				segment->blocks.pop_back();
+		for (uint32_t b = 0; b < cacheSeg.numBlocks; ++b) { seg.blockNames[b] = CachedName(cache, blocks[cacheSeg.firstBlock + b]); }
+		for (uint32_t l = 0; l < count; ++l) {
+			const DebugCacheLine& cacheLine = lines[cacheSeg.firstLine + l];
+			if (cacheLine.text != DebugCacheLine::NO_TEXT && cache.ValidText(DCA_SourceText, cacheLine.text, cacheLine.len)) {
+				SourceDebugLine& line = seg.lines[l];
+				line.line = cache.Text(DCA_SourceText, cacheLine.text);
+				line.len = cacheLine.len;
+				line.spaces = cacheLine.spaces;
+				line.block = cacheLine.block < cacheSeg.numBlocks ? cacheLine.block : 0;
 			}
-			parse.segments.pop_back();
 		}
-		IBMutexRelease(&sSrcDbgMutex);
+		dbg->segments.push_back(seg);
 	}
-	return success;
+	dbg->files.push_back(cache.Release());
+	HandOverSourceDebug(dbg);
 }
 
-bool ReadC64DbgSrc(const char* filename)
+// loading thread, the debug info is handed over to the UI thread when complete
+static bool ReadC64Dbg(const char* filename, bool extra)
 {
+	DebugCacheReader cache;
+	if (cache.Load(filename)) {
+		if (!extra) { BeginAddingSymbols(); }
+		AddCachedSymbols(cache);
+		SetDebugFileBreakpoints(cache.breakFlags, cache.Array<uint16_t>(DCA_Breaks), cache.Count<uint16_t>(DCA_Breaks));
+		ReadC64DbgCache(cache, extra);
+		EndAddingSymbols();
+		return true;
+	}
+
 	ParseDebugText parse;
 	parse.path = strref(filename).before_last('/', '\\');
 	parse.segment.clear(); // just in case there are blocks without segments I guess
-	parse.leaveExistingSymbols = false;
 	if (parse.path.get_len()) { parse.path = strref(parse.path.get(), parse.path.get_len() + 1); }
 	size_t size;
 	bool success = false;
 	if (void* voidbuf = LoadBinary(filename, size)) {
-		ClearSourceDebug();
-		ClearSymbols();
-		IBMutexLock(&sSrcDbgMutex);
-		if (ParseXML(strref((const char*)voidbuf, (strl_t)size), C64DbgXMLCB, &parse)) {
-			SourceDebug* dbg = new SourceDebug;
-			sSourceDebug = dbg;
-
+		if (!extra) { BeginAddingSymbols(); }
+		parse.text = strref((const char*)voidbuf, (strl_t)size);
+		SourceDebug* dbg = new SourceDebug;
+		dbg->append = extra;
+		dbg->files.push_back(voidbuf);	// segment and block names are in the debug file
+		bool parsed = ParseXML(parse.text, C64DbgXMLCB, &parse);
+		SetDebugFileBreakpoints(parse.cache.breakFlags, parse.breaks.size() ? &parse.breaks[0] : nullptr, parse.breaks.size());
+		if (parsed) {
 			success = ReadC64DbgInternal(dbg, parse);
+			for (size_t b = 0; b < parse.breaks.size(); ++b) { parse.cache.Add(DCA_Breaks, parse.breaks[b]); }
+			CacheAddingSymbols(parse.cache);
+			CacheSourceDebug(parse.cache, dbg);
+			parse.cache.Save(filename, voidbuf, size);
+			HandOverSourceDebug(dbg);
+		} else {
+			for (size_t f = 0; f < parse.files.size(); ++f) {
+				if (parse.files[f] && parse.files[f]->file) { free(parse.files[f]->file); }
+			}
+			FreeSourceDebug(dbg, nullptr);
 		}
+		EndAddingSymbols();
 		// clear up ParseDebugText
 		while (parse.files.size()) {
 			delete parse.files[parse.files.size() - 1];
@@ -415,24 +545,34 @@ bool ReadC64DbgSrc(const char* filename)
 				delete segment->blocks[segment->blocks.size() - 1];
 				segment->blocks.pop_back();
 			}
+			delete segment;
 			parse.segments.pop_back();
 		}
-
-		IBMutexRelease(&sSrcDbgMutex);
 	}
 	return success;
 }
 
+// Load a source debug file without clearing out the current one
+bool ReadC64DbgSrcExtra(const char* filename)
+{
+	return ReadC64Dbg(filename, true);
+}
+
+bool ReadC64DbgSrc(const char* filename)
+{
+	return ReadC64Dbg(filename, false);
+}
+
+// loading thread
 bool ReadListingFile(const char* filename)
 {
 	size_t listSize;
 	if (uint8_t* listingFile = LoadBinary(filename, listSize)) {
-		if (sListing) {
-			ClearSourceDebug();
-			free(sListing);
-		}
-		sListing = (char*)listingFile;
-		sListingSize = listSize;
+		SourceDebug* load = new SourceDebug;
+		load->append = true;	// current source debug stays until the listing is used
+		load->listing = (char*)listingFile;
+		load->listingSize = listSize;
+		HandOverSourceDebug(load);
 		return true;
 	}
 	return false;
@@ -499,6 +639,7 @@ void ListingToSrcDebug(int column)
 		segSrc->addrLast = addrLast;
 		segSrc->lines = (SourceDebugLine*)calloc(size_t(addrLast) + 1 - size_t(addrFirst), sizeof(SourceDebugLine));
 		segSrc->blockNames = (strref*)calloc(1, sizeof(strref));
+		segSrc->numBlocks = 1;
 		segSrc->name = "Listing";
 		if (segSrc->blockNames) { segSrc->blockNames[0] = "Listing"; }
 			// fill in addresses with line info
@@ -1,9 +1,12 @@
 #pragma once
 
+// loading thread, the results are swapped in by UpdateLoadedSourceDebug
 bool ReadC64DbgSrcExtra(const char* filename);
 
 bool ReadC64DbgSrc(const char* filename);
 bool ReadListingFile(const char* filename);
+// UI thread, returns true if a listing file was loaded
+bool UpdateLoadedSourceDebug();
 strref GetSourceAt(uint16_t addr, int &spaces);
 strref GetListingFile();
 void ListingToSrcDebug(int column);
@@ -3,6 +3,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include "struse/struse.h"
 #include "6510.h"
 #include <string.h>
@@ -14,104 +19,284 @@
 #include "Breakpoints.h"
 #include "platform.h"
 #include "Config.h"
+#include "DebugLoad.h"
+#include "DebugCache.h"
 
+#ifndef _WIN32
+#define WINAPI
+#endif
+
+// labels of an address are SymbolTables::addressLabels[first..first+count-1]
 struct SymEntry {
-	int16_t count;
+	uint32_t first;
+	uint32_t count;
+};
+
+struct SymbolInfo {
+	uint32_t address;
+	uint32_t section;
+	const char* label;	// in SymbolLoad::strings
 };
 
-struct SymList {
-	enum {
-		MIN_LIST = 7,
-		GROW_LIST = 8
+// label and section text of a load lives in a few large blocks, the same
+// text is only stored once and everything is released together when the
+// load and every symbol table built from it let go of it
+struct SymbolStrings {
+	enum { BLOCK_SIZE = 0x10000 };
+	struct Block {
+		Block* next;
+		size_t used, size;
+		char* Data() { return (char*)(this + 1); }
 	};
-	size_t capacity;
-	const char* names[ 1 ];
+	Block* blocks;
+	HashTable<uint64_t, const char*> interned;	// fnv1a_64 of the text
+	std::atomic<uint32_t> refs;
+
+	SymbolStrings() : blocks(nullptr), refs(1) {}
+	~SymbolStrings() { Clear(); }
+
+	void AddRef() { refs.fetch_add(1, std::memory_order_relaxed); }
+	void Release() { if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) { delete this; } }
+
+	char* Alloc(size_t bytes) {
+		if (!blocks || (blocks->size - blocks->used) < bytes) {
+			size_t size = bytes > BLOCK_SIZE ? bytes : BLOCK_SIZE;
+			Block* block = (Block*)malloc(sizeof(Block) + size);
+			if (!block) { return nullptr; }
+			block->used = 0;
+			block->size = size;
+			// keep filling the current block if this one was oversized
+			if (blocks && size > BLOCK_SIZE) {
+				block->next = blocks->next;
+				blocks->next = block;
+			} else {
+				block->next = blocks;
+				blocks = block;
+			}
+			block->used = bytes;
+			return block->Data();
+		}
+		char* mem = blocks->Data() + blocks->used;
+		blocks->used += bytes;
+		return mem;
+	}
+
+	const char* Intern(strref str) { return Intern(str, str.fnv1a_64()); }
+	const char* Intern(strref str, uint64_t hash) {
+		const char** found = interned.Value(hash);
+		if (found && str.same_str_case(*found)) { return *found; }
+		char* copy = Alloc((size_t)str.get_len() + 1);
+		if (copy) {
+			if (str.get_len()) { memcpy(copy, str.get(), str.get_len()); }
+			copy[str.get_len()] = 0;
+			if (!found) { interned.Insert(hash, copy); }	// a hash collision just isn't shared
+		}
+		return copy;
+	}
+
+	void Clear() {
+		while (Block* block = blocks) {
+			blocks = block->next;
+			free(block);
+		}
+		interned.Clear();
+	}
 };
 
-union SymRef {
-	const char* unique;
-	SymList* multi;
+// the labels and sections of a load. a loading thread fills one out and
+// builds the lookups from it, the UI thread swaps them in
+struct SymbolLoad {
+	HashTable<uint64_t, uint32_t> duplicateCheck;	// look up from section + symbol + value
+	SymbolStrings* strings;							// text of labelList and sectionNames
+	std::vector<const char*> sectionNames;
+	std::vector<SymbolInfo> labelList;
+	bool append;									// add to the current symbols rather than replace them
+
+	SymbolLoad(bool add) : strings(new SymbolStrings()), append(add) {}
+	// shares the text, the duplicate check is rebuilt if more labels are added
+	SymbolLoad(const SymbolLoad& from) : strings(from.strings), sectionNames(from.sectionNames),
+		labelList(from.labelList), append(false) { strings->AddRef(); }
+	~SymbolLoad() { strings->Release(); }
+
+	void Add(uint32_t address, strref sym, strref sect);
+	// hash is the duplicate check of section + symbol + value, symHash fnv1a_64 of sym
+	void Add(uint32_t address, strref sym, strref sect, uint64_t hash, uint64_t symHash);
+	void Append(const SymbolLoad& load);
+	void RebuildDuplicateCheck();
 };
 
-struct SymbolInfo {
-	uint32_t address;
-	uint32_t section;
-	char* label;
+// lookups built by BuildSymbolTables, never changed after they are
+// published so the disassembly can look up labels without taking a lock.
+// a replaced table is dropped on the next frame so label pointers handed
+// out stay valid for the rest of the frame they were looked up in
+struct SymbolTables {
+	std::atomic<uint32_t> refs;
+	SymbolTables* nextRetired;
+	SymbolStrings* strings;					// label text
+	SymEntry* labelCount;					// 64K, by address
+	std::vector<const char*> addressLabels;	// labels grouped by address
+	std::vector<uint16_t> sortedAddrs;		// addresses with labels
+	HashTable<uint64_t, uint32_t> reverseLookup;	// fnv1a_64 of label to address
+
+	SymbolTables(SymbolStrings* text) : refs(1), nextRetired(nullptr), strings(text) {
+		if (strings) { strings->AddRef(); }
+		labelCount = (SymEntry*)calloc(0x10000, sizeof(SymEntry));
+	}
+	~SymbolTables() {
+		if (labelCount) { free(labelCount); }
+		if (strings) { strings->Release(); }
+	}
+
+	size_t LabelSlot(uint16_t addr) const;
+	bool LabelAssignedToAddress(uint16_t address, strref lbl) const;
+};
+
+// the labels of the shown sections in list order and their search index
+struct SymbolList {
+	std::vector<SymbolInfo> sortedLabelList;	// copy of SymbolLoad::labelList without ownership of values
+	HashTable<uint32_t, uint32_t> searchGrams;	// search trigram -> index in searchGramFirst
+	std::vector<uint32_t> searchShortGrams;		// one and two character search grams
+	std::vector<uint32_t> searchGramFirst;		// postings of gram g are searchPostings[first[g]..first[g+1]-1]
+	std::vector<uint32_t> searchPostings;		// sortedLabelList indices, ascending for each gram
+};
+
+// everything built from a finished load, the UI thread only swaps it in
+struct SymbolHandover {
+	SymbolLoad* symbols;
+	SymbolTables* tables;
+	SymbolList* list;
+	uint32_t viewGeneration;	// sViewGeneration it was filtered and sorted for
+
+	SymbolHandover() : symbols(nullptr), tables(nullptr), list(nullptr), viewGeneration(0) {}
+	~SymbolHandover() {
+		delete symbols;
+		delete tables;	// not published yet
+		delete list;
+	}
 };
 
 void CheckForceLoadExtraDebug();
 
-static SymEntry* sLabelCount = nullptr;
-static SymRef* sLabelEntries = nullptr;
-static std::vector<uint16_t> sortedSymAddrs;
-static HashTable<uint64_t, uint32_t> sReverseLookup;
-static HashTable<uint64_t, uint32_t> sDuplicateCheck;	// look up from section + symbol + value
-static std::vector<char*> sectionNames;
-static std::vector<SymbolInfo> labelList;
-static std::vector<SymbolInfo> sortedLabelList;			// this is a copy of labelList without ownership of values
-static std::vector<uint64_t> hiddenSections;			// hashed value of section name
+static std::atomic<SymbolTables*> sSymbolTables(nullptr);
+static std::atomic<uint32_t> sSymbolReaders(0);
+static std::atomic<SymbolTables*> sRetiredSymbols(nullptr);	// published before, freed next frame
+static SymbolLoad* sSymbols = nullptr;					// UI thread, what the published tables are built from
+static SymbolList* sSymbolList = nullptr;				// UI thread, built along with the published tables
+static SymbolLoad* sLoaderSymbols = nullptr;			// loading thread, everything loaded so far
+static SymbolLoad* sAddingSymbols = nullptr;			// loading thread
+static std::atomic<SymbolHandover*> sLoadedSymbols(nullptr);	// loaded, waiting for the UI thread
+static std::vector<uint64_t> hiddenSections;			// hashed value of section name, changed under symbolMutex
+static uint32_t sViewGeneration = 0;					// bumped when hiddenSections or the sort order change
 static std::vector<uint32_t> matchedLabelList;			// search result
-static bool lastSortedName = false;
+static std::vector<uint32_t> sSearchCandidates;
+static strown<512> sLastSearch;							// extending it only filters matchedLabelList
+static bool sLastSearchCase = false;
+static const strref sWildcardControl("*?#[<>@^\\");		// and escapes
+static bool lastSortedName = false;						// changed under symbolMutex
 static bool lastSortedUp = true;
 static IBMutex symbolMutex;
 
+static SymbolTables* BuildSymbolTables(const SymbolLoad& symbols, const std::vector<uint64_t>& hiddenNames,
+	std::vector<SymbolInfo>& sortedLabelList);
+static void BuildSymbolSearchIndex(SymbolList& list);
+static void SortLabels(std::vector<SymbolInfo>& labels, bool up, bool name);
+static void RepeatSymbolSearch();
 
-bool SymbolsLoaded() { return sortedSymAddrs.size() > 0; }
 
-void InitSymbols()
+// any thread, returns nullptr if there are no symbols
+static SymbolTables* AcquireSymbols()
 {
-	IBMutexInit(&symbolMutex, "Symbol");
+	// replaced tables are only freed once no reader is between these two steps
+	sSymbolReaders.fetch_add(1);
+	SymbolTables* tables = sSymbolTables.load();
+	if (tables) { tables->refs.fetch_add(1, std::memory_order_relaxed); }
+	sSymbolReaders.fetch_sub(1);
+	return tables;
 }
 
-void ShutdownSymbols()
+static void ReleaseSymbols(SymbolTables* tables)
 {
-	IBMutexDestroy(&symbolMutex);
+	if (tables && tables->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) { delete tables; }
 }
 
-char* StringCopy(strref orig)
+// swap in new tables, the reference of the replaced ones is dropped by FreeReplacedSymbols
+static void PublishSymbols(SymbolTables* tables)
 {
-	char* copy = (char*)malloc((size_t)orig.get_len() + 1);
-	if (copy) {
-		if (orig.get_len()) { memcpy(copy, orig.get(), orig.get_len()); }
-		copy[orig.get_len()] = 0;
+	SymbolTables* prev = sSymbolTables.exchange(tables);
+	if (!prev) { return; }
+	prev->nextRetired = sRetiredSymbols.load();
+	while (!sRetiredSymbols.compare_exchange_weak(prev->nextRetired, prev)) {}
+}
+
+void FreeReplacedSymbols()
+{
+	SymbolTables* retired = sRetiredSymbols.exchange(nullptr);
+	// a reader that loaded one of these has raised sSymbolReaders, try again next frame
+	if (sSymbolReaders.load()) {
+		while (retired) {
+			SymbolTables* next = retired->nextRetired;
+			retired->nextRetired = sRetiredSymbols.load();
+			while (!sRetiredSymbols.compare_exchange_weak(retired->nextRetired, retired)) {}
+			retired = next;
+		}
+		return;
+	}
+	while (retired) {
+		SymbolTables* next = retired->nextRetired;
+		ReleaseSymbols(retired);
+		retired = next;
 	}
-	return copy;
 }
 
-void StringFree(char* str)
+bool SymbolsLoaded()
+{
+	SymbolTables* tables = AcquireSymbols();
+	bool loaded = tables && tables->sortedAddrs.size() > 0;
+	ReleaseSymbols(tables);
+	return loaded;
+}
+
+void InitSymbols()
+{
+	IBMutexInit(&symbolMutex, "Symbol");
+	sSymbols = new SymbolLoad(false);
+	sSymbolList = new SymbolList;
+}
+
+void ShutdownSymbols()
 {
-	if (str) { free(str); }
+	ClearSymbols();
+	FreeReplacedSymbols();
+	delete sSymbols;
+	sSymbols = nullptr;
+	delete sSymbolList;
+	sSymbolList = nullptr;
+	delete sLoaderSymbols;
+	sLoaderSymbols = nullptr;
+	delete sAddingSymbols;
+	sAddingSymbols = nullptr;
+	delete sLoadedSymbols.exchange(nullptr);
+	IBMutexDestroy(&symbolMutex);
 }
 
 void ResetSymbols()
 {
 	IBMutexLock(&symbolMutex);
-	sReverseLookup.Clear();
-	sortedSymAddrs.clear();
-	sortedLabelList.clear();
-	if( sLabelCount ) {
-		for( size_t adr = 0; adr < 0x10000; ++adr ) {
-			if( sLabelCount[ adr ].count > 1 ) {
-				if (sLabelEntries && sLabelEntries[adr].multi) {
-					free(sLabelEntries[adr].multi);
-				}
-			}
-		}
-		free( sLabelCount );
-		sLabelCount = nullptr;
-		free( sLabelEntries );
-		sLabelEntries = nullptr;
-	}
+	PublishSymbols(nullptr);
+	delete sSymbolList;
+	sSymbolList = new SymbolList;
+	matchedLabelList.clear();
+	sLastSearch.clear();
 	IBMutexRelease(&symbolMutex);
 }
 
-size_t GetLabelSlot(uint16_t addr)
+size_t SymbolTables::LabelSlot(uint16_t addr) const
 {
-	size_t lb = 0, ub = sortedSymAddrs.size();
+	size_t lb = 0, ub = sortedAddrs.size();
 
 	while ((ub-lb)>1) {
 		size_t cb = (ub + lb) >> 1;
-		uint16_t addr_cmp = sortedSymAddrs[cb];
+		uint16_t addr_cmp = sortedAddrs[cb];
 		if (addr == addr_cmp) {
 			return cb;
 		} else if (addr > addr_cmp) {
@@ -125,20 +310,19 @@ size_t GetLabelSlot(uint16_t addr)
 
 const char* NearestLabel(uint16_t addr, uint16_t& offs)
 {
-	IBMutexLock(&symbolMutex);
-	size_t i = GetLabelSlot(addr);
 	const char* ret = nullptr;
 	offs = addr;
-	if (i < sortedSymAddrs.size() && addr >= sortedSymAddrs[i]) {
-		uint16_t prevAddr = sortedSymAddrs[i];
-		offs = addr - prevAddr;
-		if (sLabelEntries[prevAddr].unique) {
-			ret = sLabelEntries[prevAddr].unique;
-		} else if (SymList* syms = sLabelEntries[prevAddr].multi) {
-			ret = sLabelCount[prevAddr].count ? syms->names[0] : nullptr;
+	if (SymbolTables* tables = AcquireSymbols()) {
+		size_t i = tables->LabelSlot(addr);
+		if (i < tables->sortedAddrs.size() && addr >= tables->sortedAddrs[i]) {
+			uint16_t prevAddr = tables->sortedAddrs[i];
+			offs = addr - prevAddr;
+			if (tables->labelCount[prevAddr].count) {
+				ret = tables->addressLabels[tables->labelCount[prevAddr].first];
+			}
 		}
+		ReleaseSymbols(tables);
 	}
-	IBMutexRelease(&symbolMutex);
 	return ret;
 }
 
@@ -180,14 +364,111 @@ static int _compareSymNameDown(const void* A, const void* B)
 	return -1;
 }
 
-void SortSymbols(bool up, bool name)
+// search grams are the one, two and three character strings of the case
+// folded label text, and the first one and two characters of the labels
+// for the default search from the start of the label
+enum {
+	SEARCH_GRAM_SHORT = 0x1000000,	// trigrams are below this, the rest in sSearchShortGrams
+	SEARCH_GRAM_START1 = 0x1000000,
+	SEARCH_GRAM_START2 = 0x2000000,
+	SEARCH_GRAM_CHAR = 0x3000000,
+	SEARCH_GRAM_PAIR = 0x4000000,
+	SEARCH_GRAM_NONE = 0xffffffff
+};
+
+static uint8_t SearchFold(uint8_t c)
 {
-	IBMutexLock(&symbolMutex);
-	lastSortedName = name;
-	lastSortedUp = up;
-	size_t numSymbols = sortedLabelList.size();
+	return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 'a' - 'A') : c;
+}
+
+static uint32_t* SearchShortGram(SymbolList& list, uint32_t key)
+{
+	return &list.searchShortGrams[((key >> 24) - 1) * 0x10000 + (key & 0xffff)];
+}
+
+// gram index of a key or SEARCH_GRAM_NONE if no label has it
+static uint32_t SearchGram(SymbolList& list, uint32_t key)
+{
+	if (key >= SEARCH_GRAM_SHORT) { return list.searchShortGrams.size() ? *SearchShortGram(list, key) : SEARCH_GRAM_NONE; }
+	uint32_t* gram = list.searchGrams.Value(key);
+	return gram ? *gram : SEARCH_GRAM_NONE;
+}
+
+static void AddSearchGram(SymbolList& list, uint32_t key, uint32_t label, std::vector<uint32_t>& labelGrams, std::vector<uint32_t>& gramLast)
+{
+	uint32_t* gram;
+	bool added;
+	if (key >= SEARCH_GRAM_SHORT) {
+		gram = SearchShortGram(list, key);
+		added = *gram == SEARCH_GRAM_NONE;
+	} else {
+		size_t used = list.searchGrams.GetUsed();
+		gram = list.searchGrams.Insert(key);
+		added = list.searchGrams.GetUsed() != used;
+	}
+	if (added) {
+		*gram = (uint32_t)gramLast.size();
+		gramLast.push_back(SEARCH_GRAM_NONE);
+		list.searchGramFirst.push_back(0);
+	}
+	if (gramLast[*gram] == label) { return; }	// once per label
+	gramLast[*gram] = label;
+	++list.searchGramFirst[*gram];
+	labelGrams.push_back(*gram);
+}
+
+// posting lists of the search grams in sortedLabelList order, rebuilt when it changes
+static void BuildSymbolSearchIndex(SymbolList& list)
+{
+	const std::vector<SymbolInfo>& sortedLabelList = list.sortedLabelList;
+	list.searchGrams.Clear();
+	list.searchShortGrams.assign(4 * 0x10000, SEARCH_GRAM_NONE);
+	list.searchGramFirst.clear();
+	list.searchPostings.clear();
+	size_t numLabels = sortedLabelList.size();
+
+	// count the labels of each gram while keeping the grams of each label in order
+	std::vector<uint32_t> labelGrams, labelEnd, gramLast;
+	labelGrams.reserve(numLabels * 16);
+	labelEnd.reserve(numLabels);
+	for (size_t i = 0; i < numLabels; ++i) {
+		if (const uint8_t* label = (const uint8_t*)sortedLabelList[i].label) {
+			uint32_t gram = 0;
+			for (const uint8_t* c = label; *c; ++c) {
+				gram = ((gram << 8) | SearchFold(*c)) & 0xffffff;
+				if (c == label) {
+					AddSearchGram(list, SEARCH_GRAM_START1 | gram, (uint32_t)i, labelGrams, gramLast);
+				} else if (c == (label + 1)) {
+					AddSearchGram(list, SEARCH_GRAM_START2 | gram, (uint32_t)i, labelGrams, gramLast);
+				}
+				AddSearchGram(list, SEARCH_GRAM_CHAR | (gram & 0xff), (uint32_t)i, labelGrams, gramLast);
+				if (c > label) { AddSearchGram(list, SEARCH_GRAM_PAIR | (gram & 0xffff), (uint32_t)i, labelGrams, gramLast); }
+				if (c > (label + 1)) { AddSearchGram(list, gram, (uint32_t)i, labelGrams, gramLast); }
+			}
+		}
+		labelEnd.push_back((uint32_t)labelGrams.size());
+	}
+
+	// counts to offsets, then place the labels
+	uint32_t first = 0;
+	for (size_t g = 0, n = list.searchGramFirst.size(); g < n; ++g) {
+		uint32_t count = list.searchGramFirst[g];
+		list.searchGramFirst[g] = first;
+		gramLast[g] = first;
+		first += count;
+	}
+	list.searchGramFirst.push_back(first);
+	list.searchPostings.resize(first);
+	for (size_t i = 0, g = 0; i < numLabels; ++i) {
+		for (; g < labelEnd[i]; ++g) { list.searchPostings[gramLast[labelGrams[g]]++] = (uint32_t)i; }
+	}
+}
+
+static void SortLabels(std::vector<SymbolInfo>& labels, bool up, bool name)
+{
+	size_t numSymbols = labels.size();
 	if (numSymbols) {
-		SymbolInfo* symbols = &sortedLabelList[0];
+		SymbolInfo* symbols = &labels[0];
 		if (name) {
 			if (up) {
 				qsort(symbols, numSymbols, sizeof(SymbolInfo), _compareSymNameUp);
@@ -202,18 +483,30 @@ void SortSymbols(bool up, bool name)
 			}
 		}
 	}
+}
+
+void SortSymbols(bool up, bool name)
+{
+	IBMutexLock(&symbolMutex);
+	lastSortedName = name;
+	lastSortedUp = up;
+	++sViewGeneration;
 	IBMutexRelease(&symbolMutex);
+	SortLabels(sSymbolList->sortedLabelList, up, name);
+	BuildSymbolSearchIndex(*sSymbolList);
+	RepeatSymbolSearch();
 }
 
-size_t NumSymbolSearchMatches() { return matchedLabelList.size() ? matchedLabelList.size() : sortedLabelList.size(); }
+size_t NumSymbolSearchMatches() { return matchedLabelList.size() ? matchedLabelList.size() : sSymbolList->sortedLabelList.size(); }
 const char* GetSymbolSearchMatch(size_t i, uint32_t* address, const char** section)
 {
+	const std::vector<SymbolInfo>& sortedLabelList = sSymbolList->sortedLabelList;
 	IBMutexLock(&symbolMutex);
 	if (!matchedLabelList.size()) {
 		if (i < sortedLabelList.size()) {
 			SymbolInfo sym = sortedLabelList[i];
-			if ((size_t)sym.section < sectionNames.size()) {
-				*section = sectionNames[sym.section];
+			if ((size_t)sym.section < sSymbols->sectionNames.size()) {
+				*section = sSymbols->sectionNames[sym.section];
 			} else { *section = ""; }
 			*address = sym.address;
 			IBMutexRelease(&symbolMutex);
@@ -223,8 +516,8 @@ const char* GetSymbolSearchMatch(size_t i, uint32_t* address, const char** secti
 		uint32_t o = matchedLabelList[i];
 		if ((size_t)o < sortedLabelList.size()) {
 			SymbolInfo sym = sortedLabelList[o];
-			if ((size_t)sym.section < sectionNames.size()) {
-				*section = sectionNames[sym.section];
+			if ((size_t)sym.section < sSymbols->sectionNames.size()) {
+				*section = sSymbols->sectionNames[sym.section];
 			} else { *section = ""; }
 			*address = sym.address;
 			IBMutexRelease(&symbolMutex);
@@ -235,10 +528,97 @@ const char* GetSymbolSearchMatch(size_t i, uint32_t* address, const char** secti
 	return nullptr;
 }
 
+// the search grams every match of the wildcard contains
+static void WildcardSearchGrams(strref wild, std::vector<uint32_t>& grams)
+{
+	uint32_t gram = 0;
+	int run = 0;			// literal characters in a row
+	size_t runGrams = 0;	// grams before the run
+	bool start = false;		// the run is at the start of the label
+	bool search = true;		// find_wildcard skips a run followed by ? after a * or at the start
+	for (strl_t i = 0, n = wild.get_len(); i <= n; ++i) {
+		char c = i < n ? wild[i] : 0;
+		if (i < n && sWildcardControl.find(c) < 0) {
+			gram = ((gram << 8) | SearchFold((uint8_t)c)) & 0xffffff;
+			++run;
+			if (start && run == 2) { grams.push_back(SEARCH_GRAM_START2 | gram); }
+			if (run >= 3) { grams.push_back(gram); }
+			continue;
+		}
+		if (run == 1) { grams.push_back((start ? SEARCH_GRAM_START1 : SEARCH_GRAM_CHAR) | gram); }
+		if (run == 2 && !start) { grams.push_back(SEARCH_GRAM_PAIR | gram); }
+		if (c == '?' && search) { grams.resize(runGrams); }
+		start = c == '@';
+		run = 0;
+		gram = 0;
+		if (c == '*') {
+			search = true;
+			// skip the filter of any substring
+			if ((i + 1) < n && wild[i + 1] == '{') {
+				int end = wild.find_after('}', i + 1);
+				i = end > 0 ? (strl_t)end : (i + 1);
+			} else if ((i + 1) < n && (wild[i + 1] == '%' || wild[i + 1] == '@' || wild[i + 1] == '$')) {
+				++i;
+			}
+		} else if (c == '[') {
+			int end = wild.find_after(']', i + 1);
+			if (end < 0) { break; }	// not a range, the grams so far are enough
+			i = (strl_t)end;
+			search = false;
+		} else if (c == '\\') {
+			break;	// escapes aren't worth reading either
+		} else if (c != '?' || !search) {
+			search = false;
+		}
+		runGrams = grams.size();
+	}
+}
+
+// keeps the candidates that are in the ascending list
+static void IntersectSearch(std::vector<uint32_t>& candidates, const uint32_t* list, const uint32_t* end)
+{
+	size_t kept = 0, n = candidates.size();
+	if ((size_t)(end - list) < n * 16) {
+		// merge lists of similar length
+		for (size_t c = 0; c < n && list != end; ++c) {
+			while (list != end && *list < candidates[c]) { ++list; }
+			if (list != end && *list == candidates[c]) { candidates[kept++] = candidates[c]; }
+		}
+	} else {
+		for (size_t c = 0; c < n && list != end; ++c) {
+			list = std::lower_bound(list, end, candidates[c]);
+			if (list != end && *list == candidates[c]) { candidates[kept++] = candidates[c]; }
+		}
+	}
+	candidates.resize(kept);
+}
+
+static size_t SearchGramLabels(uint32_t gram)
+{
+	return sSymbolList->searchGramFirst[gram + 1] - sSymbolList->searchGramFirst[gram];
+}
+
+static bool SortGramsBySize(uint32_t a, uint32_t b)
+{
+	return SearchGramLabels(a) < SearchGramLabels(b);
+}
+
+// the labels that contain all grams of the wildcard are checked against it, an
+// extended search only checks what the previous search found
 void SearchSymbols(const char* pattern, bool case_sensitive)
 {
-	matchedLabelList.clear();
-	if (!*pattern) { return; }	// clear search string -> show all
+	SymbolList& list = *sSymbolList;
+	// more text typed at the end of a search that ends in text can only match fewer labels
+	strref prevSearch = sLastSearch.get_strref();
+	bool refine = prevSearch && case_sensitive == sLastSearchCase && prevSearch.is_prefix_case_of(strref(pattern)) &&
+		sWildcardControl.find(prevSearch.get_last()) < 0 && prevSearch.find_any_char_of(strref("[{\\")) < 0 &&
+		strref(pattern + prevSearch.get_len()).find_any_char_of(sWildcardControl) < 0;
+	sLastSearch.copy(pattern);
+	sLastSearchCase = case_sensitive;
+	if (!*pattern) {	// clear search string -> show all
+		matchedLabelList.clear();
+		return;
+	}
 
 	strown<512> wildcard;
 	if (*pattern == '*') {
@@ -247,12 +627,65 @@ void SearchSymbols(const char* pattern, bool case_sensitive)
 		wildcard.append('@').append(pattern);
 	}
 
-	for (size_t i = 0, n = sortedLabelList.size(); i < n; ++i) {
-		const char* str = sortedLabelList[i].label;
+	std::vector<uint32_t> grams, keys;
+	WildcardSearchGrams(wildcard.get_strref(), keys);
+	for (size_t k = 0; k < keys.size(); ++k) {
+		uint32_t gram = SearchGram(list, keys[k]);
+		if (gram == SEARCH_GRAM_NONE) {	// no label has it
+			matchedLabelList.clear();
+			return;
+		}
+		grams.push_back(gram);
+	}
+	std::sort(grams.begin(), grams.end());
+	grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+	std::sort(grams.begin(), grams.end(), SortGramsBySize);
+
+	// most searches are plain text which doesn't need the wildcard
+	strref wild = wildcard.get_strref();
+	bool start = wild.get_first() == '@';
+	strref text = start ? (wild + 1) : wild;
+	bool plain = text && text.find_any_char_of(sWildcardControl) < 0;
+
+	// start from the fewest candidates
+	std::vector<uint32_t>& candidates = sSearchCandidates;
+	size_t g = 0;
+	if (refine && (!grams.size() || matchedLabelList.size() <= SearchGramLabels(grams[0]))) {
+		candidates.swap(matchedLabelList);
+	} else if (grams.size()) {
+		candidates.assign(&list.searchPostings[0] + list.searchGramFirst[grams[0]], &list.searchPostings[0] + list.searchGramFirst[grams[0] + 1]);
+		g = 1;
+		// a single gram of the whole text is the same as comparing it
+		if (plain && !case_sensitive && grams.size() == 1 && text.get_len() <= (start ? 2 : 3)) {
+			matchedLabelList.swap(candidates);
+			return;
+		}
+		if (refine && !plain) { IntersectSearch(candidates, matchedLabelList.data(), matchedLabelList.data() + matchedLabelList.size()); }
+	} else {
+		candidates.resize(list.sortedLabelList.size());
+		for (size_t i = 0, n = candidates.size(); i < n; ++i) { candidates[i] = (uint32_t)i; }
+	}
+	// plain text is quicker to check than more lists are to intersect
+	for (; !plain && g < grams.size() && candidates.size(); ++g) {
+		IntersectSearch(candidates, &list.searchPostings[0] + list.searchGramFirst[grams[g]], &list.searchPostings[0] + list.searchGramFirst[grams[g] + 1]);
+	}
+
+	matchedLabelList.clear();
+	for (size_t c = 0, n = candidates.size(); c < n; ++c) {
+		const char* str = list.sortedLabelList[candidates[c]].label;
 		if (str && str[0]) {
-			if (strref(str).find_wildcard(wildcard.get_strref(), 0, case_sensitive)) {
-				matchedLabelList.push_back((uint32_t)i);
+			bool match;
+			if (plain) {
+				strref label(str);
+				if (start) {
+					match = case_sensitive ? text.is_prefix_case_of(label) : text.is_prefix_of(label);
+				} else {
+					match = (case_sensitive ? label.find_case(text) : label.find(text)) >= 0;
+				}
+			} else {
+				match = !!strref(str).find_wildcard(wild, 0, case_sensitive);
 			}
+			if (match) { matchedLabelList.push_back(candidates[c]); }
 		}
 	}
 }
@@ -264,29 +697,41 @@ void HideSection(uint64_t section, bool hide)
 	for (std::vector<uint64_t>::iterator h = hiddenSections.begin(); h != hiddenSections.end(); ++h) {
 		if (*h == section) {
 			if (!hide) {
+				IBMutexLock(&symbolMutex);
 				hiddenSections.erase(h);
+				++sViewGeneration;
+				IBMutexRelease(&symbolMutex);
 				FilterSectionSymbols();
 			}
 			return; // removed if shown or already hidden
 		}
 	}
+	IBMutexLock(&symbolMutex);
 	hiddenSections.push_back(section);
+	++sViewGeneration;
+	IBMutexRelease(&symbolMutex);
 	FilterSectionSymbols();
 }
-size_t NumSections() { return sectionNames.size(); }
-const char* GetSectionName(size_t index) { return sectionNames[index]; }
+size_t NumSections() { return sSymbols->sectionNames.size(); }
+const char* GetSectionName(size_t index) { return sSymbols->sectionNames[index]; }
 
 void HideAllSections() {
+	IBMutexLock(&symbolMutex);
 	hiddenSections.clear();
-	size_t numSects = sectionNames.size();
+	size_t numSects = sSymbols->sectionNames.size();
 	for (size_t j = 0; j < numSects; ++j) {
-		strref section(sectionNames[j]);
+		strref section(sSymbols->sectionNames[j]);
 		hiddenSections.push_back(section.fnv1a_64());
 	}
+	++sViewGeneration;
+	IBMutexRelease(&symbolMutex);
 }
 
 void ShowAllSections() {
+	IBMutexLock(&symbolMutex);
 	hiddenSections.clear();
+	++sViewGeneration;
+	IBMutexRelease(&symbolMutex);
 }
 
 bool IsSectionVisible(uint64_t section)
@@ -301,51 +746,100 @@ bool IsSectionVisible(uint64_t section)
 
 void BeginAddingSymbols()
 {
-	IBMutexLock(&symbolMutex);
-	sDuplicateCheck.Clear();
-	for (size_t i = 0, n = sectionNames.size(); i < n; ++i) {
-		if (char* sectName = sectionNames[i]) {
-			sectionNames[i] = nullptr;
-			StringFree(sectName);
-		}
-	}
-	sectionNames.clear();
-	for (size_t i = 0, n = labelList.size(); i < n; ++i) {
-		if (char* symName = labelList[i].label) {
-			labelList[i].label = nullptr;
-			StringFree(symName);
-		}
+	delete sAddingSymbols;
+	sAddingSymbols = new SymbolLoad(false);
+}
+
+// loading thread, builds everything the UI thread needs to show the symbols
+void EndAddingSymbols()
+{
+	SymbolLoad* load = sAddingSymbols;
+	sAddingSymbols = nullptr;
+	if (!load) { return; }
+	if (load->append && sLoaderSymbols) {
+		sLoaderSymbols->Append(*load);
+		delete load;
+	} else {
+		delete sLoaderSymbols;
+		sLoaderSymbols = load;
 	}
-	labelList.clear();
+
+	IBMutexLock(&symbolMutex);
+	std::vector<uint64_t> hidden(hiddenSections);
+	bool up = lastSortedUp, name = lastSortedName;
+	uint32_t viewGeneration = sViewGeneration;
 	IBMutexRelease(&symbolMutex);
+
+	// the UI thread gets its own label list, the text is shared and only added to here
+	SymbolHandover* handover = new SymbolHandover;
+	handover->symbols = new SymbolLoad(*sLoaderSymbols);
+	handover->list = new SymbolList;
+	handover->tables = BuildSymbolTables(*handover->symbols, hidden, handover->list->sortedLabelList);
+	handover->viewGeneration = viewGeneration;
+	SortLabels(handover->list->sortedLabelList, up, name);
+	BuildSymbolSearchIndex(*handover->list);
+
+	// replaces a load the UI thread hasn't picked up yet
+	delete sLoadedSymbols.exchange(handover);
+}
+
+// UI thread
+void UpdateLoadedSymbols()
+{
+	SymbolHandover* handover = sLoadedSymbols.exchange(nullptr);
+	if (!handover) { return; }
+	// published symbol tables keep the previous text until they are replaced
+	std::swap(sSymbols, handover->symbols);
+	std::swap(sSymbolList, handover->list);
+	SymbolTables* tables = handover->tables;
+	handover->tables = nullptr;
+	bool current = tables && handover->viewGeneration == sViewGeneration;
+	delete handover;
+	if (!current) {	// sections or sort order changed while loading
+		delete tables;
+		FilterSectionSymbols();
+		return;
+	}
+	PublishSymbols(tables);
+	RepeatSymbolSearch();
+}
+
+// the search result of the previous list for the current one
+static void RepeatSymbolSearch()
+{
+	strown<512> search(sLastSearch.get_strref());
+	sLastSearch.clear();
+	matchedLabelList.clear();
+	if (search.get_len()) { SearchSymbols(search.c_str(), sLastSearchCase); }
 }
 
-bool LabelAssignedToAddress(uint16_t address, strref lbl)
+bool SymbolTables::LabelAssignedToAddress(uint16_t address, strref lbl) const
 {
-	if (const int16_t count = sLabelCount[address].count) {
+	if (const uint32_t count = labelCount[address].count) {
+		const char* const* ppStr = &addressLabels[labelCount[address].first];
 		if (count == 1) {
-			if (lbl.same_str_case(sLabelEntries[address].unique)) { return true; }
+			if (lbl.same_str_case(*ppStr)) { return true; }
 		} else {
-			if (const char** ppStr = sLabelEntries[address].multi->names) {
-				for (size_t i = 0, n = count; i < n; ++i) {
-					if (lbl.same_str(*ppStr)) { return true; }
-					++ppStr;
-				}
+			for (size_t i = 0, n = count; i < n; ++i) {
+				if (lbl.same_str(*ppStr)) { return true; }
+				++ppStr;
 			}
 		}
 	}
 	return false;
 }
 
-// discard all symbol lookups and fill out with a filtered set of sections
-// call after loading symbols
-void FilterSectionSymbols()
+// symbol lookups of the labels in sections that are not hidden, sortedLabelList
+// gets the same labels in load order
+static SymbolTables* BuildSymbolTables(const SymbolLoad& symbols, const std::vector<uint64_t>& hiddenNames,
+	std::vector<SymbolInfo>& sortedLabelList)
 {
-#if 1
+	const std::vector<const char*>& sectionNames = symbols.sectionNames;
+	const std::vector<SymbolInfo>& labelList = symbols.labelList;
 	size_t numSects = sectionNames.size();
-	uint8_t* hidden = (uint8_t*)calloc(1, numSects);
-	if (hidden == nullptr) { return; }
-	for (std::vector<uint64_t>::iterator i = hiddenSections.begin(); i != hiddenSections.end(); ++i) {
+	uint8_t* hidden = (uint8_t*)calloc(1, numSects + 1);
+	if (hidden == nullptr) { return nullptr; }
+	for (std::vector<uint64_t>::const_iterator i = hiddenNames.begin(); i != hiddenNames.end(); ++i) {
 		uint64_t hiddenName = *i;
 		for (size_t j = 0; j < numSects; ++j ) {
 			if (strref(sectionNames[j]).fnv1a_64() == hiddenName) {
@@ -354,139 +848,218 @@ void FilterSectionSymbols()
 			}
 		}
 	}
-	ResetSymbols();
-
-	sortedLabelList.clear();
-
-	IBMutexLock(&symbolMutex);
-	// make sure label array exists
-	if (!sLabelCount) {
-		sLabelCount = (SymEntry*)malloc(sizeof(SymEntry) * 0x10000);
-		sLabelEntries = (SymRef*)malloc(sizeof(SymRef) * 0x10000);
+	// readers keep using the current tables until the new ones are complete
+	SymbolTables* tables = new SymbolTables(symbols.strings);
+	if (tables->labelCount == nullptr) {
+		delete tables;
+		free(hidden);
+		return nullptr;
 	}
-	if (sLabelEntries == nullptr || sLabelCount == nullptr) { return; }
 
-	memset(sLabelCount, 0, sizeof(SymEntry) * 0x10000);
-	memset(sLabelEntries, 0, sizeof(SymRef) * 0x10000);
+	sortedLabelList.clear();
+	tables->reverseLookup.Reserve(labelList.size());
+	sortedLabelList.reserve(labelList.size());
 
-	for (std::vector<SymbolInfo>::iterator sym = labelList.begin(); sym != labelList.end(); ++sym) {
+	// the address tables are a counting sort on the 16 bit address: count the
+	// labels per address, turn the counts into offsets and place the labels
+	SymEntry* labelCount = tables->labelCount;
+	size_t numAddressLabels = 0;
+	for (std::vector<SymbolInfo>::const_iterator sym = labelList.begin(); sym != labelList.end(); ++sym) {
 		if (hidden[sym->section]) { continue; }	// if this section is hidden don't add it!
 		if (sym->label == nullptr) { continue; }
 
-		strref lbl(sym->label);
-
 		sortedLabelList.push_back(*sym);
 
 		// 32 bit vymbol support
-		uint64_t hash = lbl.fnv1a_64();
-		if (!sReverseLookup.Exists(hash)) {
-			sReverseLookup.Insert(hash, sym->address);
+		uint64_t hash = strref(sym->label).fnv1a_64();
+		if (!tables->reverseLookup.Exists(hash)) {
+			tables->reverseLookup.Insert(hash, sym->address);
 		}
 
 		// 16 bit symbol support
 		if (sym->address < 0x10000) {
-			const uint16_t address = (uint16_t)sym->address;
-			if (LabelAssignedToAddress(address, lbl)) { continue; }
-
-			if (!sLabelCount[address].count) {
-				sLabelCount[address].count = 1;
-				sLabelEntries[address].unique = sym->label;
-			} else if (sLabelCount[address].count == 1) {
-				const char* prev = sLabelEntries[address].unique;
-				sLabelEntries[address].multi = (SymList*)malloc(sizeof(SymList) +
-					sizeof(const char*) * (SymList::MIN_LIST - 1));
-				sLabelEntries[address].multi->capacity = SymList::MIN_LIST;
-				sLabelCount[address].count = 2;
-				sLabelEntries[address].multi->names[0] = prev;
-				sLabelEntries[address].multi->names[1] = sym->label;
-			} else {
-				SymList* entries = sLabelEntries[address].multi;
-				if (entries->capacity == (size_t)sLabelCount[address].count) {
-					size_t newCapacity = entries->capacity + SymList::GROW_LIST;
-					sLabelEntries[address].multi = (SymList*)malloc(
-						sizeof(SymList) + sizeof(const char*) * (newCapacity - 1));
-					if (sLabelEntries[address].multi) {
-						sLabelEntries[address].multi->capacity = newCapacity;
-						memcpy(sLabelEntries[address].multi->names, entries->names,
-							sizeof(const char*) * sLabelCount[address].count);
-						free(entries);
-						entries = sLabelEntries[address].multi;
-					}
-				}
-				assert(entries);
-				assert(entries->capacity > (size_t)sLabelCount[address].count);
-				entries->names[sLabelCount[address].count++] = sym->label;
-			}
+			++labelCount[sym->address].count;
+			++numAddressLabels;
+		}
+	}
 
-			// insert into range slot array
-			size_t slot = GetLabelSlot(address);
-			if (slot < sortedSymAddrs.size()) {
-				if (address < sortedSymAddrs[slot]) {
-					sortedSymAddrs.insert(sortedSymAddrs.begin() + slot, address);
-				} else if (address > sortedSymAddrs[slot]) {
-					sortedSymAddrs.insert(sortedSymAddrs.begin() + slot + 1, address);
-				}
-			} else {
-				sortedSymAddrs.push_back(address);
-			}
+	uint32_t first = 0;
+	for (size_t address = 0; address < 0x10000; ++address) {
+		labelCount[address].first = first;
+		first += labelCount[address].count;
+		labelCount[address].count = 0;
+	}
+
+	// stable so the labels of an address keep the order they were added in
+	tables->addressLabels.resize(numAddressLabels);
+	for (std::vector<SymbolInfo>::iterator sym = sortedLabelList.begin(); sym != sortedLabelList.end(); ++sym) {
+		if (sym->address < 0x10000) {
+			const uint16_t address = (uint16_t)sym->address;
+			strref lbl(sym->label);
+			if (tables->LabelAssignedToAddress(address, lbl)) { continue; }
+			tables->addressLabels[labelCount[address].first + labelCount[address].count++] = sym->label;
 		}
 	}
-	free(hidden);
-	IBMutexRelease(&symbolMutex);
 
-	SortSymbols(lastSortedUp, lastSortedName);
+	for (size_t address = 0; address < 0x10000; ++address) {
+		if (labelCount[address].count) { tables->sortedAddrs.push_back((uint16_t)address); }
+	}
+	free(hidden);
+	return tables;
+}
 
-#endif
+// discard all symbol lookups and fill out with a filtered set of sections
+// UI thread, loads are filtered on the loading thread
+void FilterSectionSymbols()
+{
+	SymbolList* list = new SymbolList;
+	SymbolTables* tables = BuildSymbolTables(*sSymbols, hiddenSections, list->sortedLabelList);
+	if (!tables) {
+		delete list;
+		return;
+	}
+	SortLabels(list->sortedLabelList, lastSortedUp, lastSortedName);
+	BuildSymbolSearchIndex(*list);
+	PublishSymbols(tables);
+	delete sSymbolList;
+	sSymbolList = list;
+	RepeatSymbolSearch();
 }
 
 
 
-void AddSymbol(uint32_t address, const char *symbol, size_t symbolLen, const char *section, size_t sectionLen)
+static uint64_t SymbolHash(uint32_t address, strref sym, strref sect)
 {
-	strref sym(symbol, (strl_t)symbolLen);
-	strref sect(section, (strl_t)sectionLen);
+	return sym.fnv1a_64(sect.fnv1a_64(((uint64_t)address<<16) + 14695981039346656037ULL));
+}
 
-	//sDuplicateCheck
-	uint64_t hash = sect.fnv1a_64(((uint64_t)address<<16) + 14695981039346656037ULL);
-	hash = sym.fnv1a_64(hash);
+void SymbolLoad::Add(uint32_t address, strref sym, strref sect)
+{
+	Add(address, sym, sect, SymbolHash(address, sym, sect), sym.fnv1a_64());
+}
 
-	if (sDuplicateCheck.Exists(hash)) { return; }
-	IBMutexLock(&symbolMutex);
-	sDuplicateCheck.Insert(hash, address);
+void SymbolLoad::Add(uint32_t address, strref sym, strref sect, uint64_t hash, uint64_t symHash)
+{
+	// labels read from a debug cache are only hashed when more are added
+	if (!duplicateCheck.GetUsed() && labelList.size()) { RebuildDuplicateCheck(); }
+	if (duplicateCheck.Exists(hash)) { return; }
+	duplicateCheck.Insert(hash, address);
 
 	size_t sectIdx = 0, numSects = sectionNames.size();
 	for (; sectIdx < numSects; ++sectIdx) {
-		if (sect.same_str(sectionNames[sectIdx]) || (!sect.valid() && !sectionNames[sectIdx][0])) {
+		if (sect.same_str(sectionNames[sectIdx]) || (!sect.get_len() && !sectionNames[sectIdx][0])) {
 			break;
 		}
 	}
 	if (sectIdx == numSects) {
-		if (char* sectionCopy = StringCopy(sect)) {
+		if (const char* sectionCopy = strings->Intern(sect)) {
 			sectionNames.push_back(sectionCopy);
 		}
 	}
-	if (char* copy = StringCopy(sym)) {
+	if (const char* copy = strings->Intern(sym, symHash)) {
 		SymbolInfo symInfo = { address, (uint32_t)sectIdx, copy };
 		labelList.push_back(symInfo);
 	}
-	IBMutexRelease(&symbolMutex);
+}
+
+void SymbolLoad::Append(const SymbolLoad& load)
+{
+	for (size_t i = 0, n = load.labelList.size(); i < n; ++i) {
+		const SymbolInfo& sym = load.labelList[i];
+		strref sect;
+		if (sym.section < load.sectionNames.size()) { sect = strref(load.sectionNames[sym.section]); }
+		Add(sym.address, strref(sym.label), sect);
+	}
+}
+
+void SymbolLoad::RebuildDuplicateCheck()
+{
+	duplicateCheck.Reserve(labelList.size());
+	for (size_t i = 0, n = labelList.size(); i < n; ++i) {
+		const SymbolInfo& sym = labelList[i];
+		duplicateCheck.Insert(SymbolHash(sym.address, strref(sym.label), strref(sectionNames[sym.section])), sym.address);
+	}
+}
+
+// loading thread, adds to the current symbols unless BeginAddingSymbols was called
+void AddSymbol(uint32_t address, const char *symbol, size_t symbolLen, const char *section, size_t sectionLen)
+{
+	if (!sAddingSymbols) { sAddingSymbols = new SymbolLoad(true); }
+	sAddingSymbols->Add(address, strref(symbol, (strl_t)symbolLen), strref(section, (strl_t)sectionLen));
+}
+
+// loading thread, the symbols added since BeginAddingSymbols
+void CacheAddingSymbols(DebugCacheWriter& cache)
+{
+	SymbolLoad* load = sAddingSymbols;
+	if (!load) { return; }
+	for (size_t s = 0, n = load->sectionNames.size(); s < n; ++s) {
+		cache.Add(DCA_Sections, cache.Text(DCA_SymbolText, strref(load->sectionNames[s])));
+	}
+	// interned labels share text in the cache as well
+	HashTable<uint64_t, uint32_t> written;
+	written.Reserve(load->labelList.size());
+	for (size_t i = 0, n = load->labelList.size(); i < n; ++i) {
+		const SymbolInfo& sym = load->labelList[i];
+		uint32_t* text = written.Value((uint64_t)(size_t)sym.label);
+		DebugCacheLabel label = { sym.address, sym.section,
+			text ? *text : *written.Insert((uint64_t)(size_t)sym.label, cache.Text(DCA_SymbolText, strref(sym.label))) };
+		cache.Add(DCA_Labels, label);
+	}
+}
+
+// loading thread
+void AddCachedSymbols(const DebugCacheReader& cache)
+{
+	const uint32_t* sections = cache.Array<uint32_t>(DCA_Sections);
+	const DebugCacheLabel* labels = cache.Array<DebugCacheLabel>(DCA_Labels);
+	uint32_t numSections = cache.Count<uint32_t>(DCA_Sections);
+	uint32_t numLabels = cache.Count<DebugCacheLabel>(DCA_Labels);
+	if (!sAddingSymbols) { sAddingSymbols = new SymbolLoad(true); }
+	SymbolLoad* load = sAddingSymbols;
+
+	if (load->labelList.size() || load->sectionNames.size()) {
+		for (uint32_t i = 0; i < numLabels; ++i) {
+			if (labels[i].section < numSections) {
+				load->Add(labels[i].address, strref(cache.Text(DCA_SymbolText, labels[i].text)),
+						  strref(cache.Text(DCA_SymbolText, sections[labels[i].section])));
+			}
+		}
+		return;
+	}
+
+	// nothing to check against, copy all the text at once and point into it
+	uint32_t textSize = cache.bytes[DCA_SymbolText];
+	char* text = textSize ? load->strings->Alloc(textSize) : nullptr;
+	if (!text) { return; }
+	memcpy(text, cache.Text(DCA_SymbolText, 0), textSize);
+	load->sectionNames.reserve(numSections);
+	for (uint32_t s = 0; s < numSections; ++s) {
+		load->sectionNames.push_back(cache.ValidText(DCA_SymbolText, sections[s], 0) ? (text + sections[s]) : "");
+	}
+	load->labelList.reserve(numLabels);
+	for (uint32_t i = 0; i < numLabels; ++i) {
+		if (labels[i].section < numSections) {
+			SymbolInfo sym = { labels[i].address, labels[i].section,
+				cache.ValidText(DCA_SymbolText, labels[i].text, 0) ? (text + labels[i].text) : "" };
+			load->labelList.push_back(sym);
+		}
+	}
 }
 
 void ClearSymbols()
 {
 	ResetSymbols();
-	BeginAddingSymbols();
+	delete sSymbols;
+	sSymbols = new SymbolLoad(false);
 }
 
 const char* GetSymbol(uint16_t address)
 {
 	const char* sym = nullptr;
-	if( sLabelCount ) {
-		IBMutexLock(&symbolMutex);
-		if( !sLabelCount[ address ].count ) { sym = nullptr; }
-		else if( sLabelCount[ address ].count == 1 ) { sym = sLabelEntries[ address ].unique; }
-		else { sym = sLabelEntries[address].multi->names[0]; }
-		IBMutexRelease(&symbolMutex);
+	if( SymbolTables* tables = AcquireSymbols() ) {
+		if( tables->labelCount[ address ].count ) { sym = tables->addressLabels[ tables->labelCount[ address ].first ]; }
+		ReleaseSymbols(tables);
 	}
 	return sym;
 }
@@ -494,92 +1067,241 @@ const char* GetSymbol(uint16_t address)
 bool GetAddress( const char *name, size_t chars, uint16_t &addr )
 {
 	uint64_t key = strref(name, (strl_t)chars).fnv1a_64();
-	IBMutexLock(&symbolMutex);
-	if( uint32_t* value = sReverseLookup.Value( key ) ) {
-		addr = (uint16_t)*value;
-		IBMutexRelease(&symbolMutex);
-		return true;
+	bool found = false;
+	if( SymbolTables* tables = AcquireSymbols() ) {
+		if( uint32_t* value = tables->reverseLookup.Value( key ) ) {
+			addr = (uint16_t)*value;
+			found = true;
+		}
+		ReleaseSymbols(tables);
+	}
+	return found;
+}
+
+// symbol files are split into chunks at line starts, the chunks are parsed
+// on their own threads and the results added in file order so the first of
+// duplicated symbols is the one kept, same as reading line by line
+struct ParsedSymbol {
+	uint32_t address;
+	strref label;
+	uint64_t hash;		// duplicate check, there are no sections in these files
+	uint64_t labelHash;
+};
+
+// the loading thread sleeps on this until the chunk threads are done
+struct SymbolChunkJoin {
+	std::mutex mutex;
+	std::condition_variable finished;
+	uint32_t chunksDone;
+	std::atomic<size_t> bytesDone;
+
+	SymbolChunkJoin() : chunksDone(0), bytesDone(0) {}
+};
+
+struct SymbolChunk {
+	strref text;
+	void (*parseLine)(SymbolChunk& chunk, strref line);
+	std::vector<ParsedSymbol> symbols;
+	std::vector<uint16_t> breaks;
+	SymbolChunkJoin* join;
+
+	void AddSymbol(uint32_t address, strref label) {
+		ParsedSymbol sym = { address, label, SymbolHash(address, label, strref()), label.fnv1a_64() };
+		symbols.push_back(sym);
+	}
+};
+
+enum {
+	SYMBOL_CHUNK_MIN = 0x40000,	// files smaller than this aren't worth a thread
+	SYMBOL_CHUNK_MAX_THREADS = 16
+};
+
+static void ParseSymbolChunk(SymbolChunk& chunk)
+{
+	strref text = chunk.text;
+	while (text) {
+		if (strref line = text.line()) { chunk.parseLine(chunk, line); }
+	}
+}
+
+static IBThreadRet WINAPI SymbolChunkThread(void* data)
+{
+	SymbolChunk* chunk = (SymbolChunk*)data;
+	ParseSymbolChunk(*chunk);
+	SymbolChunkJoin* join = chunk->join;
+	join->bytesDone.fetch_add(chunk->text.get_len());
+	// notify before unlocking, the join is gone as soon as the loading thread wakes up
+	std::lock_guard<std::mutex> lock(join->mutex);
+	++join->chunksDone;
+	join->finished.notify_one();
+	return 0;
+}
+
+// loading thread, adds the symbols of the file and returns the breakpoints in file order
+static void ParseSymbolFile(const char* text, size_t size, void (*parseLine)(SymbolChunk& chunk, strref line),
+							std::vector<uint16_t>& breaks)
+{
+	size_t numChunks = size / SYMBOL_CHUNK_MIN;
+	size_t cores = (size_t)std::thread::hardware_concurrency();
+	if (numChunks > cores) { numChunks = cores; }
+	if (numChunks > SYMBOL_CHUNK_MAX_THREADS) { numChunks = SYMBOL_CHUNK_MAX_THREADS; }
+	if (!numChunks) { numChunks = 1; }
+
+	SymbolChunkJoin join;
+	std::vector<SymbolChunk> chunks(numChunks);
+	size_t start = 0;
+	for (size_t c = 0; c < numChunks; ++c) {
+		size_t end = c + 1 < numChunks ? (size * (c + 1)) / numChunks : size;
+		if (end < start) { end = start; }
+		while (end < size && text[end - 1] != '\n') { ++end; }
+		chunks[c].text = strref(text + start, (strl_t)(end - start));
+		chunks[c].parseLine = parseLine;
+		chunks[c].join = &join;
+		start = end;
+	}
+
+	// this thread takes the first chunk
+	uint32_t threads = 0;
+	for (size_t c = 1; c < numChunks; ++c) {
+		IBThread thread;
+		if (IBCreateThread(&thread, 65536, SymbolChunkThread, &chunks[c])) {
+			IBReleaseThread(&thread);
+			++threads;
+		} else {
+			ParseSymbolChunk(chunks[c]);
+		}
+	}
+	ParseSymbolChunk(chunks[0]);
+	join.bytesDone.fetch_add(chunks[0].text.get_len());
+	{
+		std::unique_lock<std::mutex> lock(join.mutex);
+		while (join.chunksDone < threads) {
+			DebugLoadStep(join.bytesDone.load(), size);
+			join.finished.wait_for(lock, std::chrono::milliseconds(20));
+		}
+	}
+
+	if (!sAddingSymbols) { sAddingSymbols = new SymbolLoad(true); }
+	SymbolLoad* load = sAddingSymbols;
+	size_t numSymbols = load->labelList.size();
+	for (size_t c = 0; c < numChunks; ++c) { numSymbols += chunks[c].symbols.size(); }
+	load->labelList.reserve(numSymbols);
+	load->duplicateCheck.Reserve(numSymbols);
+	for (size_t c = 0; c < numChunks; ++c) {
+		const std::vector<ParsedSymbol>& symbols = chunks[c].symbols;
+		for (size_t i = 0, n = symbols.size(); i < n; ++i) {
+			const ParsedSymbol& sym = symbols[i];
+			load->Add(sym.address, sym.label, strref(), sym.hash, sym.labelHash);
+		}
+		breaks.insert(breaks.end(), chunks[c].breaks.begin(), chunks[c].breaks.end());
+	}
+}
+
+static void ParseViceCommandLine(SymbolChunk& chunk, strref line)
+{
+	if (strref command = line.get_word()) {
+		uint32_t addr;
+		line += command.get_len();
+		line.trim_whitespace();
+		if (command.same_str("break") || command.same_str("bk")) {
+			if (line.get_first() == '$') { ++line; }
+			chunk.breaks.push_back((uint16_t)(line + 1).ahextoui());
+		} else if (command.same_str("al") || command.same_str("add_label")) {
+			if (line.has_prefix("c:")) { line += 2; }
+			line.skip_whitespace();
+			if (line.get_first() == '$') { ++line; }
+			addr = (uint16_t)line.ahextoui_skip();
+			line.skip_whitespace();
+			if (addr < 0x10000) {
+				chunk.AddSymbol(addr, line);
+			}
+		}
 	}
-	IBMutexRelease(&symbolMutex);
-	return false;
 }
 
+// loading thread, a .sym or .vs file that hasn't changed since it was parsed
+static bool ReadSymbolCache(const char* filename)
+{
+	DebugCacheReader cache;
+	if (!cache.Load(filename)) { return false; }
+	BeginAddingSymbols();
+	AddCachedSymbols(cache);
+	SetDebugFileBreakpoints(cache.breakFlags, cache.Array<uint16_t>(DCA_Breaks), cache.Count<uint16_t>(DCA_Breaks));
+	EndAddingSymbols();
+	return true;
+}
+
+// cache was created before the file was read
+static void SaveSymbolCache(DebugCacheWriter& cache, const char* filename, const void* contents, size_t size,
+							uint32_t breakFlags, const std::vector<uint16_t>& breaks)
+{
+	cache.breakFlags = breakFlags;
+	for (size_t b = 0; b < breaks.size(); ++b) { cache.Add(DCA_Breaks, breaks[b]); }
+	CacheAddingSymbols(cache);
+	cache.Save(filename, contents, size);
+}
+
+// loading thread
 bool ReadViceCommandFile(const char *symFile)
 {
-	ResetSymbols();
+	if (ReadSymbolCache(symFile)) { return true; }
+	DebugCacheWriter cache;
 	size_t size = 0;
 	if (uint8_t* buf = LoadBinary(symFile, size)) {
 		BeginAddingSymbols();
-		for (int pass = 0; pass<2; pass++) {
-			strref file((const char*)buf, (strl_t)size);
-			while (strref line = file.line()) {
-				if (strref command = line.get_word()) {
-					uint32_t addr;
-					line += command.get_len();
-					line.trim_whitespace();
-					if (command.same_str("break") || command.same_str("bk")) {
-						if (pass) {
-							if (line.get_first() == '$') { ++line; }
-							ViceAddBreakpoint((uint16_t)(line + 1).ahextoui());
-						}
-					} else if (command.same_str("al") || command.same_str("add_label")) {
-						if (line.has_prefix("c:")) { line += 2; }
-						line.skip_whitespace();
-						if (line.get_first() == '$') { ++line; }
-						addr = (uint16_t)line.ahextoui_skip();
-						line.skip_whitespace();
-						if (addr < 0x10000) {
-							AddSymbol(addr, line.get(), line.get_len(), nullptr, 0);
-						}
-					}
-				}
-			}
-		}
-		FilterSectionSymbols();
+		// labels are all added before the breakpoints are set
+		std::vector<uint16_t> breaks;
+		ParseSymbolFile((const char*)buf, size, ParseViceCommandLine, breaks);
+		SetDebugFileBreakpoints(0, breaks.size() ? &breaks[0] : nullptr, breaks.size());
+		SaveSymbolCache(cache, symFile, buf, size, 0, breaks);
+		EndAddingSymbols();
 		free(buf);
 		return true;
 	}
 	return false;
 }
 
+static void ParseSymLine(SymbolChunk& chunk, strref line)
+{
+	line.skip_whitespace();
+	if (line.grab_prefix(".label")) {
+		line.skip_whitespace();
+		strref label = line.split_label();
+		line.skip_whitespace();
+		if (line.grab_char('=')) {
+			line.skip_whitespace();
+			if (line.grab_char('$')) {
+				size_t addr = line.ahextoui();
+				if (label.same_str("debugbreak")) {
+					chunk.breaks.push_back((uint16_t)addr);
+				} else {
+					chunk.AddSymbol((uint16_t)addr, label);
+				}
+			}
+		}
+	}
+}
+
+// loading thread
 bool ReadSymbols(const char *filename)
 {
-	ResetSymbols();
+	if (ReadSymbolCache(filename)) { return true; }
+	DebugCacheWriter cache;
 	size_t size = 0;
 	if (uint8_t* buf = LoadBinary(filename, size)) {
 		BeginAddingSymbols();
-		strref file((const char*)buf, (strl_t)size);
-		while (file) {
-			if (strref line = file.line()) {
-				line.skip_whitespace();
-				if (line.grab_prefix(".label")) {
-					line.skip_whitespace();
-					strref label = line.split_label();
-					line.skip_whitespace();
-					if (line.grab_char('=')) {
-						line.skip_whitespace();
-						if (line.grab_char('$')) {
-							size_t addr = line.ahextoui();
-							if (label.same_str("debugbreak")) {
-								Breakpoint bp;
-								if (!BreakpointAt((uint16_t)addr, bp)) {
-									ViceAddBreakpoint((uint16_t)addr);
-								}
-							} else {
-								AddSymbol((uint16_t)addr, label.get(), label.get_len(), nullptr, 0);
-							}
-						}
-					}
-				}
-			}
-		}
+		std::vector<uint16_t> breaks;
+		ParseSymbolFile((const char*)buf, size, ParseSymLine, breaks);
+		SetDebugFileBreakpoints(DCB_IfNone, breaks.size() ? &breaks[0] : nullptr, breaks.size());
+		SaveSymbolCache(cache, filename, buf, size, DCB_IfNone, breaks);
 		free(buf);
-		FilterSectionSymbols();
+		EndAddingSymbols();
 		return true;
 	}
 	return false;
 }
 
+// loading thread
 bool ReadSymbolsFile(const char* symbols) {
 	strref ext = strref(symbols).after_last('.');
 	if (ext.same_str("dbg")) return ReadC64DbgSrc(symbols);
@@ -588,6 +1310,7 @@ bool ReadSymbolsFile(const char* symbols) {
 	return false;
 }
 
+// loading thread
 void ReadSymbolsForBinary(const char *binname)
 {
 	strref origname = strref(binname).before_last('.');
@@ -607,10 +1330,15 @@ void ReadSymbolsForBinary(const char *binname)
 
 	symFile.copy(origname);
 	symFile.append(".vs");
-	ReadViceCommandFile(symFile.c_str());
+	if (!ReadViceCommandFile(symFile.c_str())) {
+		// no debug info for this program, don't keep showing the previous one
+		BeginAddingSymbols();
+		EndAddingSymbols();
+	}
 }
 
 void StateSaveHiddenSections(UserData &conf) {
+	const std::vector<const char*>& sectionNames = sSymbols->sectionNames;
 	size_t numSects = sectionNames.size();
 	for (std::vector<uint64_t>::iterator i = hiddenSections.begin(); i != hiddenSections.end(); ++i) {
 		uint64_t hiddenName = *i;
@@ -626,9 +1354,12 @@ void StateSaveHiddenSections(UserData &conf) {
 
 void StateLoadHiddenSections(strref conf)
 {
+	IBMutexLock(&symbolMutex);
 	hiddenSections.clear();
 	ConfigParse parse(conf);
 	while (strref sect = parse.ArrayElement()) {
 		hiddenSections.push_back(sect.fnv1a_64());
 	}
+	++sViewGeneration;
+	IBMutexRelease(&symbolMutex);
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 struct UserData;
+struct DebugCacheWriter;
+struct DebugCacheReader;
 class strref;
 
 bool ReadSymbols(const char *binname);
@@ -11,7 +13,14 @@ void ClearSymbols();
 bool GetAddress(const char *name, size_t chars, uint16_t &addr);
 bool SymbolsLoaded();
 const char* GetSymbol(uint16_t address);
+// loading thread. symbols added after BeginAddingSymbols replace the current
+// ones, otherwise they are added to them. EndAddingSymbols hands them over
+void BeginAddingSymbols();
 void AddSymbol(uint32_t address, const char* symbol, size_t symbolLen, const char* section, size_t sectionLen);
+void EndAddingSymbols();
+// loading thread, write the symbols being added to a debug cache or add the ones read from one
+void CacheAddingSymbols(DebugCacheWriter& cache);
+void AddCachedSymbols(const DebugCacheReader& cache);
 void FilterSectionSymbols();
 const char* NearestLabel(uint16_t addr, uint16_t& offs);
 
@@ -38,3 +47,7 @@ void StateLoadHiddenSections(strref conf);
 
 void InitSymbols();
 void ShutdownSymbols();
+// UI thread, once per frame. drops symbol tables replaced since the last frame
+void FreeReplacedSymbols();
+// UI thread, swaps in symbols handed over by EndAddingSymbols
+void UpdateLoadedSymbols();
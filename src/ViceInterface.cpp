@@ -6,23 +6,36 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/errno.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #endif
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <queue>
 #include <vector>
+#include <atomic>
+#include <chrono>
 #include <assert.h>
 
 #include "Files.h"
 #include "struse/struse.h"
+#include "HashTable.h"
 #include "6510.h"
 #include "Breakpoints.h"
 #include "Traces.h"
 
 #include "ViceInterface.h"
 #include "ViceBinInterface.h"
+#include "ViceReceiveRing.h"
 #include "platform.h"
 #include "views/Views.h"
 
@@ -30,8 +43,6 @@
 #define VICELOG
 #endif
 
-#define SEND_IMMEDIATE
-										 
 #ifdef _WIN32
 #define VI_SOCKET SOCKET
 #else
@@ -40,16 +51,326 @@
 #define strcpy_s strcpy
 #define OutputDebugStringA printf
 #define SOCKET_ERROR -1
-static void Sleep(int ms) {
-	timespec t = { 0, ms * 1000 };
-	nanosleep(&t, &t);
-}
 #endif
 
+// Requests waiting for a response from VICE. Request IDs are handed out in
+// order so only a window of IDs is outstanding at any time, the table is a
+// power of two slot array indexed by request ID that doubles whenever the
+// window outgrows it. Insert, find and remove are O(1).
+enum class ViceRequestKind : uint8_t {
+	Command,	// only tracked for the response timeout
+	MemGet,		// response is copied to the CPU memory
+	Checkpoint	// response updates the local checkpoint set
+};
+
+struct PendingRequest {
+	uint32_t requestID;
+	uint32_t issueTick;		// ViceConnection::Tick count when sent
+	ViceRequestKind kind;
+	uint8_t space;			// VICEMemSpaces for MemGet
+	uint8_t response;		// command type of the final response
+	uint16_t start, end, bank;
+	ViceRequestDone done;	// optional completion callback
+	void* user;
+	bool scheduled;			// sent by the stop refresh scheduler
+	uint8_t priority;		// ViceSchedule if scheduled
+	uint32_t checkpoint;	// checkpoint number for Checkpoint
+	bool enable;			// toggle state for Checkpoint
+};
+
+// stop refresh work in the order the user is waiting for it. VICE answers
+// in order so lower priorities are held back until the requests ahead of
+// them have been answered, a large display or memory transfer can't delay
+// the code page and a new stop or step drops whatever wasn't sent yet
+enum class ViceSchedule : uint8_t {
+	PCPage,			// zero page, stack and the code at PC
+	Visible,		// pages the views show
+	Checkpoints,
+	Display,
+	Background,		// memory nothing has shown yet
+	Count
+};
+
+struct PendingRequestTable {
+	enum { MIN_SLOTS = 256 };
+
+	PendingRequest* slots;
+	uint8_t* used;
+	uint32_t mask;
+	uint32_t count;
+	uint32_t oldest;		// lowest request ID that may still be pending
+	uint32_t newest;
+
+	PendingRequestTable() : slots(nullptr), used(nullptr), mask(0), count(0), oldest(0), newest(0) {}
+	~PendingRequestTable() { Free(); }
+
+	void Free() {
+		if (slots) { free(slots); }
+		if (used) { free(used); }
+		slots = nullptr;
+		used = nullptr;
+		mask = count = 0;
+	}
+
+	void Clear() {
+		if (used) { memset(used, 0, (size_t)mask + 1); }
+		count = 0;
+	}
+
+	bool Grow(uint32_t minSlots) {
+		uint32_t newSize = mask ? (mask + 1) : MIN_SLOTS;
+		while (newSize < minSlots) { newSize <<= 1; }
+		PendingRequest* newSlots = (PendingRequest*)calloc(newSize, sizeof(PendingRequest));
+		uint8_t* newUsed = (uint8_t*)calloc(newSize, 1);
+		if (!newSlots || !newUsed) {
+			if (newSlots) { free(newSlots); }
+			if (newUsed) { free(newUsed); }
+			return false;
+		}
+		// every pending ID is inside the window so they still get unique slots
+		for (uint32_t i = 0; used && i <= mask; ++i) {
+			if (used[i]) {
+				uint32_t slot = slots[i].requestID & (newSize - 1);
+				newSlots[slot] = slots[i];
+				newUsed[slot] = 1;
+			}
+		}
+		uint32_t moved = count;
+		Free();
+		slots = newSlots;
+		used = newUsed;
+		mask = newSize - 1;
+		count = moved;
+		return true;
+	}
+
+	bool Insert(const PendingRequest& request) {
+		if (!count) { oldest = newest = request.requestID; }
+		if (int32_t(request.requestID - oldest) < 0) { oldest = request.requestID; }
+		if (int32_t(request.requestID - newest) > 0) { newest = request.requestID; }
+		uint32_t window = newest - oldest + 1;
+		if (!slots || window > mask + 1) {
+			if (!Grow(window * 2)) { return false; }
+		}
+		uint32_t slot = request.requestID & mask;
+		slots[slot] = request;
+		if (!used[slot]) { ++count; }
+		used[slot] = 1;
+		return true;
+	}
+
+	PendingRequest* Find(uint32_t requestID) {
+		if (!count) { return nullptr; }
+		uint32_t slot = requestID & mask;
+		if (!used[slot] || slots[slot].requestID != requestID) { return nullptr; }
+		return &slots[slot];
+	}
+
+	// some commands answer with several responses sharing the request ID
+	// (checkpoint list), only the final one or an error completes them
+	bool Remove(uint32_t requestID, uint8_t responseType, uint8_t errorCode, PendingRequest& request) {
+		PendingRequest* found = Find(requestID);
+		if (!found || (found->response != responseType && !errorCode)) { return false; }
+		uint32_t slot = requestID & mask;
+		request = *found;
+		used[slot] = 0;
+		--count;
+		if (requestID == oldest) { Oldest(); }
+		return true;
+	}
+
+	// requests sent before tick are given up on, VICE won't answer them anymore
+	void TakeExpired(uint32_t tick, std::vector<PendingRequest>& out) {
+		for (uint32_t i = 0; used && i <= mask; ++i) {
+			if (used[i] && int32_t(tick - slots[i].issueTick) > 0) {
+				out.push_back(slots[i]);
+				used[i] = 0;
+				--count;
+			}
+		}
+		Oldest();
+	}
+
+	// hand back the requests that still expect a completion call and forget the rest
+	void TakeCallbacks(std::vector<PendingRequest>& out) {
+		for (uint32_t i = 0; used && i <= mask; ++i) {
+			if (used[i] && slots[i].done) { out.push_back(slots[i]); }
+		}
+		Clear();
+	}
+
+	// the request that has been waiting the longest, advances past answered IDs.
+	// every pending ID is inside the window so one pass over the slots finds it
+	PendingRequest* Oldest() {
+		if (!count) { return nullptr; }
+		for (uint32_t scan = 0; scan <= mask; ++scan, ++oldest) {
+			uint32_t slot = oldest & mask;
+			if (used[slot] && slots[slot].requestID == oldest) { return &slots[slot]; }
+		}
+		return nullptr;
+	}
+};
+
+// everything VICE reported since the last hand over, filled in by the
+// connection thread and given to the UI thread in one pointer swap once
+// the stop refresh is answered so a frame never shows half a stop.
+// completions of requests run on the UI thread after their data is visible
+struct ViceSnapshot {
+	enum Parts {
+		HasCheckpoints = 1,
+		HasDisplay = 2
+	};
+
+	struct MemoryRange {
+		uint16_t start, end;
+		uint32_t generation;	// CPU6510::MemoryGeneration when read
+		uint32_t requestID;
+	};
+
+	// single checkpoint changes applied on top of the local set
+	enum CheckpointOp : uint8_t {
+		CP_Update,		// full info from a set response or a hit
+		CP_Remove,
+		CP_Enable,
+		CP_Disable,
+		CP_Condition
+	};
+
+	struct Checkpoint {
+		uint32_t number;
+		uint32_t flags;
+		uint16_t start, end;
+		bool hasCondition;
+		bool hit;
+		uint8_t op;			// CheckpointOp, only for checkpointOps
+	};
+
+	struct Completion {
+		ViceRequestDone done;
+		void* user;
+		uint32_t requestID;
+		uint8_t errorCode;
+	};
+
+	uint32_t parts;
+	uint32_t regMask;		// CPU6510::RegMask of the registers in regs
+	CPU6510::Regs regs;
+	uint8_t* mem;			// 64K, only the ranges are filled in
+	std::vector<MemoryRange> ranges;
+	std::vector<Checkpoint> checkpoints;
+	std::vector<Checkpoint> checkpointOps;	// applied after checkpoints
+	std::vector<Completion> completions;
+	uint8_t* image;
+	size_t imageCapacity;
+	uint16_t imageWidth, imageHeight;
+	uint16_t screenLeft, screenTop, screenWidth, screenHeight;
+
+	ViceSnapshot() : parts(0), regMask(0), image(nullptr), imageCapacity(0), imageWidth(0), imageHeight(0),
+		screenLeft(0), screenTop(0), screenWidth(0), screenHeight(0) {
+		mem = (uint8_t*)malloc(0x10000);
+	}
+	~ViceSnapshot() {
+		if (mem) { free(mem); }
+		if (image) { free(image); }
+	}
+
+	bool Empty() const {
+		return !parts && !regMask && ranges.empty() && checkpointOps.empty() && completions.empty();
+	}
+
+	void Reset() {
+		parts = regMask = 0;
+		ranges.clear();
+		checkpoints.clear();
+		checkpointOps.clear();
+		completions.clear();
+	}
+
+	void SetRegs(const CPU6510::Regs& from, uint32_t mask) {
+		CopyRegs(regs, from, mask);
+		regMask |= mask;
+	}
+
+	static void CopyRegs(CPU6510::Regs& to, const CPU6510::Regs& from, uint32_t mask) {
+		if (mask & CPU6510::RM_A) { to.A = from.A; }
+		if (mask & CPU6510::RM_X) { to.X = from.X; }
+		if (mask & CPU6510::RM_Y) { to.Y = from.Y; }
+		if (mask & CPU6510::RM_SP) { to.SP = from.SP; }
+		if (mask & CPU6510::RM_FL) { to.FL = from.FL; }
+		if (mask & CPU6510::RM_ZP00) { to.ZP00 = from.ZP00; }
+		if (mask & CPU6510::RM_ZP01) { to.ZP01 = from.ZP01; }
+		if (mask & CPU6510::RM_PC) { to.PC = from.PC; }
+		if (mask & CPU6510::RM_LIN) { to.LIN = from.LIN; }
+		if (mask & CPU6510::RM_CYC) { to.CYC = from.CYC; }
+	}
+
+	void SetMemory(uint16_t start, uint16_t end, const uint8_t* bytes, uint32_t generation, uint32_t requestID) {
+		if (!mem || end < start) { return; }
+		memcpy(mem + start, bytes, (size_t)end - (size_t)start + 1);
+		MemoryRange range = { start, end, generation, requestID };
+		ranges.push_back(range);
+	}
+
+	bool SetImage(const uint8_t* img, uint16_t w, uint16_t h) {
+		size_t size = (size_t)w * (size_t)h;
+		if (size > imageCapacity) {
+			uint8_t* grown = (uint8_t*)realloc(image, size);
+			if (!grown) { return false; }
+			image = grown;
+			imageCapacity = size;
+		}
+		memcpy(image, img, size);
+		imageWidth = w;
+		imageHeight = h;
+		parts |= HasDisplay;
+		return true;
+	}
+
+	// fold a newer snapshot into this one that the UI hasn't picked up yet
+	void Merge(ViceSnapshot& newer) {
+		for (size_t r = 0, n = newer.ranges.size(); r < n; ++r) {
+			const MemoryRange& range = newer.ranges[r];
+			SetMemory(range.start, range.end, newer.mem + range.start, range.generation, range.requestID);
+		}
+		SetRegs(newer.regs, newer.regMask);
+		if (newer.parts & HasCheckpoints) {
+			// a newer full list already includes the changes before it
+			checkpoints.swap(newer.checkpoints);
+			checkpointOps.clear();
+			parts |= HasCheckpoints;
+		}
+		checkpointOps.insert(checkpointOps.end(), newer.checkpointOps.begin(), newer.checkpointOps.end());
+		if (newer.parts & HasDisplay) {
+			uint8_t* img = image; image = newer.image; newer.image = img;
+			size_t cap = imageCapacity; imageCapacity = newer.imageCapacity; newer.imageCapacity = cap;
+			imageWidth = newer.imageWidth; imageHeight = newer.imageHeight;
+			screenLeft = newer.screenLeft; screenTop = newer.screenTop;
+			screenWidth = newer.screenWidth; screenHeight = newer.screenHeight;
+			parts |= HasDisplay;
+		}
+		completions.insert(completions.end(), newer.completions.begin(), newer.completions.end());
+	}
+};
+
 class ViceConnection {
-	enum { RECEIVE_SIZE = 10*1024*1024 };
+	enum {
+		MAX_SEND_BATCH = 64,		// encoded commands per writev / WSASend
+		MAX_SCHEDULED_IN_FLIGHT = 4,	// scheduled requests sent ahead of their responses
+		BACKGROUND_FETCH_TICKS = 30,	// ticks after a stop before fetching memory nothing showed
+		BACKGROUND_FETCH_PAGES = 16,	// pages per tick for the background fetch
+		PING_TICKS = 100,				// ticks without a response before pinging VICE
+		EXPIRE_TICKS = 600				// ticks before a request is given up on
+	};
+	// encoded command waiting to be sent, data follows after the struct
 	struct ViceMessage {
-		int size;	// data follows after len..
+		ViceMessage* next;
+		int size;
+	};
+	// held back by the scheduler, data follows after the struct
+	struct ScheduledMessage {
+		ScheduledMessage* next;
+		PendingRequest request;
+		int size;
 	};
 
 	size_t waitCount;
@@ -58,9 +379,83 @@ class ViceConnection {
 	bool connected;
 	bool stopped;
 
-#ifndef SEND_IMMEDIATE
-	std::queue<ViceMessage*> toSend;
+	enum WaitEvents {
+		WAIT_RECEIVE = 1,	// socket has data or was closed
+		WAIT_WAKE = 2		// outbound queue or close request
+	};
+
+	// outbound commands are pushed lock free by any thread and flushed in
+	// batches by the connection thread so a burst of commands costs one syscall
+	std::atomic<ViceMessage*> sendQueue;
+	std::atomic<bool> wakePending;
+
+	// a break or resume has been sent but VICE hasn't reported it yet
+	std::atomic<bool> breakPending;
+	std::atomic<bool> resumePending;
+	std::atomic<uint32_t> stopCount;
+	uint32_t lastStopCount;		// UI thread
+	uint32_t stoppedTicks;
+
+	std::atomic<bool> stepPending;
+
+	// a request VICE has answered whose snapshot the UI hasn't applied yet, a
+	// continuation attached in between still has to wait for that snapshot
+	struct AnsweredRequest {
+		ViceRequestDone done;
+		void* user;
+	};
+
+	// guarded by msgSendMutex
+	PendingRequestTable pending;
+	HashTable<uint32_t, AnsweredRequest> answered;	// by request ID
+	uint32_t tickCount;
+	uint32_t lastPingTick;
+	ScheduledMessage* scheduleHead[(int)ViceSchedule::Count];
+	ScheduledMessage* scheduleTail[(int)ViceSchedule::Count];
+	uint32_t scheduledInFlight;
+	uint32_t refreshInFlight;		// scheduled ahead of the display
+
+	std::atomic<bool> expirePending;	// Tick found a request to give up on
+
+	// connection thread only
+	ViceSnapshot* building;
+	uint32_t checkpointListID;		// scheduled checkpoint list being answered
+
+	// checkpoint changes are applied one at a time, the full list is only
+	// requested on the next stop after connecting or when they got out of step
+	std::atomic<bool> relistCheckpoints;
+
+	// closed under msgSendMutex, Wake checks them under it
+#ifdef _WIN32
+	WSAEVENT socketEvent;
+	WSAEVENT wakeEvent;
+#else
+	int wakeRead, wakeWrite;	// same eventfd on linux, pipe ends elsewhere
 #endif
+
+	ViceReceiveRing recvRing;
+
+	bool sendBatch(ViceMessage* first);
+	void queueMessage(uint8_t* message, int size);
+	void pushMessage(ViceMessage* msg);
+	void abortRequests();
+	void expireRequests();
+	void completeAnswered();
+	void schedule(ViceSchedule priority, uint8_t* message, int size, const PendingRequest& request);
+	void scheduleMemory(ViceSchedule priority, CPU6510* cpu, const uint64_t* pages, uint32_t maxPages, int maxRequests);
+	bool scheduleIdle();
+	bool refreshOutstanding();
+	ViceSnapshot* snapshot();
+	void publishSnapshot();
+	void pumpSchedule();
+	void dropSchedule();
+	void syncMemory();
+	void handleResponse(VICEBinResponse* resp);
+	void handleCheckpointResponse(VICEBinResponse* resp, const PendingRequest& request);
+	bool openWake();
+	void closeWake();
+	void clearWake();
+	int waitForEvents();
 public:
 	ViceConnection(const char* ip, uint32_t port);
 	~ViceConnection();
@@ -68,11 +463,11 @@ public:
 	static IBThreadRet WINAPI ViceConnectThread(void *data);
 	void connectionThread();
 
-	void updateGetMemory(VICEBinMemGetResponse* resp);
+	void updateGetMemory(VICEBinMemGetResponse* resp, const PendingRequest* request);
 
 	void handleCheckpointList(VICEBinCheckpointList* cpList);
 
-	void handleCheckpointGet(VICEBinCheckpointResponse* cp);
+	void handleCheckpointGet(VICEBinCheckpointResponse* cp, uint32_t requestID);
 
 	void updateRegisters(VICEBinRegisterResponse* resp);
 
@@ -86,39 +481,65 @@ public:
 
 	bool open();
 	void Tick();
-	void AddMessage(uint8_t *message, int size, bool wantResponse = false);
+	ViceRequest AddMessage(uint8_t *message, int size);
+	ViceRequest AddRequest(uint8_t* message, int size, const PendingRequest& request);
+	ViceRequest AddMemSet(uint16_t start, const uint8_t* data, uint32_t bytes, VICEMemSpaces mem,
+		ViceRequestDone done, void* user);
+	bool Then(ViceRequest request, ViceRequestDone done, void* user);
+	void TakeAnswered(uint32_t requestID, ViceRequestDone& done, void*& user);
+	bool IsPending(ViceRequest request);
+	void FlushMessages();
+	void DiscardMessages();
+	void Wake();
 
 	bool isConnected() { return connected; }
 	bool isStopped() { return stopped; }
+	// VICE is stopped by the time a command queued now is processed
+	bool willBeStopped() { return stopped || breakPending; }
+	void BreakSent() { breakPending = true; }
+	void ResumeSent() { resumePending = true; dropSchedule(); }
+	void StepSent() { stepPending = true; dropSchedule(); }
 	void ImWaiting() { waitCount++; }
+	void RelistCheckpoints() { relistCheckpoints = true; }
 
 	IBMutex msgSendMutex;
 
 };
 
-struct GetMemoryRequest {
-	uint32_t requestID;
-	uint16_t start, end, bank;
-	uint8_t space;
-};
-
-struct MessageRequestTimeout {
-	uint32_t requestID;
-	uint32_t timeSincePing;
-};
-
 static VI_SOCKET s;
 static IBThread threadHandle;
 static ViceConnection* viceCon = nullptr;
-static uint32_t lastRequestID = 0x0fff;
-static std::vector<GetMemoryRequest> sMemRequests;
-static std::vector<MessageRequestTimeout> sMessageTimeouts;
-static IBMutex userRequestMutex;
+static std::atomic<uint32_t> lastRequestID(0x0fff);
 static ViceLogger logConsole = nullptr;
 static void* logUser = nullptr;
 static bool sCloseConnectRequest = false;
 
 static bool sResumeMeansStopped = false;
+static thread_local bool sOnConnectionThread = false;
+static std::atomic<int64_t> sStopEventTime(0);	// steady clock microseconds when the last stop arrived
+static std::atomic<ViceSnapshot*> sReadySnapshot(nullptr);	// published, not yet applied
+static std::atomic<ViceSnapshot*> sSpareSnapshot(nullptr);	// applied, can be filled in again
+static uint32_t sSnapshotGeneration = 0;
+
+static uint32_t sUploadDone = 0;		// UI thread
+static uint32_t sUploadTotal = 0;
+
+enum { VICE_UPLOAD_CHUNK = 0x1000 };	// bytes per MemSet in an upload, small enough to show progress
+static int64_t sStopLatency = 0;				// stop event to UI frame in microseconds
+
+// tracepoint hits go from the connection thread to the UI thread through a
+// single producer single consumer ring, nothing is allocated or locked per hit
+enum { VICE_TRACE_HITS = 0x4000 };		// power of two
+static ViceTraceHit sTraceHits[VICE_TRACE_HITS];
+static std::atomic<uint32_t> sTraceHitWrite(0);		// written by the connection thread
+static std::atomic<uint32_t> sTraceHitRead(0);		// written by the UI thread
+static std::atomic<uint64_t> sTraceHitsDropped(0);
+
+static int64_t ViceTimeMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 struct { const char* name; uint8_t id; } aCommandNames[] = {
 	{ "MemGet",1 },
@@ -165,15 +586,49 @@ void ViceSetEmuType(VICEEmuType value)
 }
 
 
-ViceConnection::ViceConnection(const char* ip, uint32_t port) : waitCount(0), ipPort(port), connected(false), stopped(false)
+// request IDs are handed out from both the UI and the connection thread,
+// 0 means no request and 0xffffffff is used by VICE for events
+static uint32_t ViceNextRequestID()
+{
+	uint32_t id = ++lastRequestID;
+	while (id == 0 || id == 0xffffffff) { id = ++lastRequestID; }
+	return id;
+}
+
+// type of the response that completes a command
+static uint8_t ViceResponseType(uint8_t command)
+{
+	switch (command) {
+		case VICE_CheckpointSet: return VICE_CheckpointGet;
+		case VICE_RegistersSet: return VICE_RegistersGet;
+	}
+	return command;
+}
+
+ViceConnection::ViceConnection(const char* ip, uint32_t port) : waitCount(0), ipPort(port), connected(false), stopped(false),
+	sendQueue(nullptr), wakePending(false), breakPending(false), resumePending(false),
+	stopCount(0), lastStopCount(0), stoppedTicks(0), stepPending(false), tickCount(0), lastPingTick(0),
+	scheduledInFlight(0), refreshInFlight(0), expirePending(false), building(nullptr), checkpointListID(0),
+	relistCheckpoints(true)
+#ifdef _WIN32
+	, socketEvent(WSA_INVALID_EVENT), wakeEvent(WSA_INVALID_EVENT)
+#else
+	, wakeRead(-1), wakeWrite(-1)
+#endif
 {
 	IBMutexInit(&msgSendMutex, "VICE Send Message Mutex");
 	strcpy_s(ipAddress, ip);
+	for (int p = 0; p < (int)ViceSchedule::Count; ++p) {
+		scheduleHead[p] = scheduleTail[p] = nullptr;
+	}
 }
 
 
 ViceConnection::~ViceConnection()
 {
+	DiscardMessages();
+	dropSchedule();
+	if (building) { delete building; }
 	IBMutexDestroy(&msgSendMutex);
 }
 
@@ -197,7 +652,7 @@ void VicePing()
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinHeader pingMsg;
-		pingMsg.Setup(0, ++lastRequestID, VICE_Ping);
+		pingMsg.Setup(0, ViceNextRequestID(), VICE_Ping);
 		viceCon->AddMessage((uint8_t*)&pingMsg, sizeof(VICEBinHeader));
 	}
 }
@@ -216,208 +671,245 @@ void ViceDisconnect()
 {
 	if (viceCon && viceCon->isConnected()) {
 		sCloseConnectRequest = true;
-		VicePing();
+		viceCon->Wake();
 	}
 }
 
-void ViceQuit()
+ViceRequest ViceQuit()
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinHeader viceQuit;
-		viceQuit.Setup(0, ++lastRequestID, VICE_Quit);
-		viceCon->AddMessage((uint8_t*)&viceQuit, sizeof(viceQuit));
+		viceQuit.Setup(0, ViceNextRequestID(), VICE_Quit);
+		ViceRequest request = viceCon->AddMessage((uint8_t*)&viceQuit, sizeof(viceQuit));
 		VicePing(); // this will fail but will cause the connection thread exit cleanly
+		return request;
 	}
+	return 0;
 }
 
-void ViceBreak()
+ViceRequest ViceBreak()
 {
-	if (viceCon && viceCon->isConnected() && !viceCon->isStopped()) {
-		VICEBinRegisters regMsg(++lastRequestID, false);
-		viceCon->AddMessage((uint8_t*)&regMsg, sizeof(regMsg), true);
+	if (viceCon && viceCon->isConnected() && !viceCon->willBeStopped()) {
+		VICEBinRegisters regMsg(ViceNextRequestID(), false);
+		viceCon->BreakSent();
+		return viceCon->AddMessage((uint8_t*)&regMsg, sizeof(regMsg));
 	}
+	return 0;
 }
 
-void ViceGo()
+// local memory edits have to reach VICE before it runs or is read back
+static void ViceFlushWrites()
+{
+	if (CPU6510* cpu = GetMainCPU()) { cpu->FlushWrites(); }
+}
+
+ViceRequest ViceGo()
 {
 	ClearBreapointsHit();
-	if (viceCon && viceCon->isConnected() && viceCon->isStopped()) {
+	ViceFlushWrites();
+	if (viceCon && viceCon->isConnected() && viceCon->willBeStopped()) {
 		VICEBinHeader resumeMsg;
-		resumeMsg.Setup(0, ++lastRequestID, VICE_Exit);
-		viceCon->AddMessage((uint8_t*)&resumeMsg, sizeof(VICEBinHeader), true);
+		resumeMsg.Setup(0, ViceNextRequestID(), VICE_Exit);
+		viceCon->ResumeSent();
+		return viceCon->AddMessage((uint8_t*)&resumeMsg, sizeof(VICEBinHeader));
 	}
+	return 0;
 }
 
-void ViceStep()
+ViceRequest ViceStep()
 {
 	ClearBreapointsHit();
+	ViceFlushWrites();
 	if (viceCon && viceCon->isConnected() && viceCon->isStopped()) {
 		VICEBinStep stepMsg;
-		stepMsg.Setup(++lastRequestID, false);
-		viceCon->AddMessage((uint8_t*)&stepMsg, sizeof(VICEBinStep), true);
+		stepMsg.Setup(ViceNextRequestID(), false);
 		//sResumeMeansStopped = true;
+		viceCon->StepSent();
+		return viceCon->AddMessage((uint8_t*)&stepMsg, sizeof(VICEBinStep));
 	}
+	return 0;
 }
 
-void ViceStepOver()
+ViceRequest ViceStepOver()
 {
 	ClearBreapointsHit();
+	ViceFlushWrites();
 	if (viceCon && viceCon->isConnected() && viceCon->isStopped()) {
 		VICEBinStep stepMsg;
-		stepMsg.Setup(++lastRequestID, true);
-		viceCon->AddMessage((uint8_t*)&stepMsg, sizeof(VICEBinStep), true);
+		stepMsg.Setup(ViceNextRequestID(), true);
 		//sResumeMeansStopped = true;
+		viceCon->StepSent();
+		return viceCon->AddMessage((uint8_t*)&stepMsg, sizeof(VICEBinStep));
 	}
+	return 0;
 }
 
-void ViceStepOut()
+ViceRequest ViceStepOut()
 {
 	ClearBreapointsHit();
+	ViceFlushWrites();
 	if (viceCon && viceCon->isConnected() && viceCon->isStopped()) {
 		VICEBinHeader stepOutMsg;
-		stepOutMsg.Setup(0, ++lastRequestID, VICE_StepOut);
-		viceCon->AddMessage((uint8_t*)&stepOutMsg, sizeof(VICEBinHeader), true);
+		stepOutMsg.Setup(0, ViceNextRequestID(), VICE_StepOut);
 		//sResumeMeansStopped = true;
+		viceCon->StepSent();
+		return viceCon->AddMessage((uint8_t*)&stepOutMsg, sizeof(VICEBinHeader));
 	}
+	return 0;
 }
 
 
-void ViceRemoveBreakpointNoList(uint32_t number)
+// the response to a checkpoint command is applied to the local checkpoint set
+static ViceRequest ViceCheckpointRequest(uint8_t* message, int size, uint32_t number, bool enable = false)
+{
+	VICEBinHeader* hdr = (VICEBinHeader*)message;
+	PendingRequest request = { hdr->GetReqID(), 0, ViceRequestKind::Checkpoint, 0, ViceResponseType(hdr->commandType),
+		0, 0, 0, nullptr, nullptr, false, 0, number, enable };
+	return viceCon->AddRequest(message, size, request);
+}
+
+ViceRequest ViceRemoveBreakpointNoList(uint32_t number)
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinCheckpoint chkpt;
-		chkpt.Setup(4, ++lastRequestID, VICE_CheckpointDelete);
+		chkpt.Setup(4, ViceNextRequestID(), VICE_CheckpointDelete);
 		chkpt.SetNumber(number);
-		viceCon->AddMessage((uint8_t*)&chkpt, sizeof(chkpt));
+		return viceCon->AddMessage((uint8_t*)&chkpt, sizeof(chkpt));
 	}
+	return 0;
 }
 
-void ViceRemoveBreakpoint(uint32_t number)
+ViceRequest ViceRemoveBreakpoint(uint32_t number)
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinCheckpoint chkpt;
-		chkpt.Setup(4, ++lastRequestID, VICE_CheckpointDelete);
+		chkpt.Setup(4, ViceNextRequestID(), VICE_CheckpointDelete);
 		chkpt.SetNumber(number);
-		viceCon->AddMessage((uint8_t*)&chkpt, sizeof(chkpt));
-		
-		// reset breakpoints
-		ClearBreakpoints();
-		VICEBinHeader breakList;
-		breakList.Setup(0, ++lastRequestID, VICE_CheckpointList);
-		viceCon->AddMessage((uint8_t*)&breakList, sizeof(VICEBinHeader));
+		return ViceCheckpointRequest((uint8_t*)&chkpt, sizeof(chkpt), number);
 	}
+	return 0;
 }
 
-void ViceToggleBreakpoint(uint32_t number, bool enable)
+ViceRequest ViceToggleBreakpoint(uint32_t number, bool enable)
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinCheckpointToggle chkpt;
-		chkpt.Setup(5, ++lastRequestID, VICE_CheckpointToggle);
+		chkpt.Setup(5, ViceNextRequestID(), VICE_CheckpointToggle);
 		chkpt.SetNumber(number);
 		chkpt.enabled = enable ? 1 : 0;
-		viceCon->AddMessage((uint8_t*)&chkpt, sizeof(chkpt));
-
-		// reset breakpoints
-		ClearBreakpoints();
-		VICEBinHeader breakList;
-		breakList.Setup(0, ++lastRequestID, VICE_CheckpointList);
-		viceCon->AddMessage((uint8_t*)&breakList, sizeof(VICEBinHeader));
+		return ViceCheckpointRequest((uint8_t*)&chkpt, sizeof(chkpt), number, enable);
 	}
+	return 0;
 }
 
-void ViceAddCheckpoint(uint16_t start, uint16_t end, bool stop, bool load, bool store, bool exec)
+ViceRequest ViceAddCheckpoint(uint16_t start, uint16_t end, bool stop, bool load, bool store, bool exec)
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinCheckpointSet chkpt;
-		chkpt.Setup(8, ++lastRequestID, VICE_CheckpointSet);
+		chkpt.Setup(8, ViceNextRequestID(), VICE_CheckpointSet);
 		chkpt.SetStart(start);
 		chkpt.SetEnd(end);
 		chkpt.stopWhenHit = stop ? 1 : 0;
 		chkpt.enabled = 1;
 		chkpt.operation = (load ? VICE_LoadMem : 0) | (store ? VICE_StoreMem : 0) | (exec ? VICE_Exec : 0);
 		chkpt.temporary = 0;
-		viceCon->AddMessage((uint8_t*)&chkpt, sizeof(chkpt));
-
-		// reset breakpoints
-		ClearBreakpoints();
-		VICEBinHeader breakList;
-		breakList.Setup(0, ++lastRequestID, VICE_CheckpointList);
-		viceCon->AddMessage((uint8_t*)&breakList, sizeof(VICEBinHeader));
+		// VICE answers with the new checkpoint info
+		return ViceCheckpointRequest((uint8_t*)&chkpt, sizeof(chkpt), 0);
 	}
+	return 0;
 }
 
-void ViceAddBreakpoint(uint16_t address)
+ViceRequest ViceAddBreakpoint(uint16_t address)
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinCheckpointSet chkpt;
-		chkpt.Setup(8, ++lastRequestID, VICE_CheckpointSet);
+		chkpt.Setup(8, ViceNextRequestID(), VICE_CheckpointSet);
 		chkpt.SetStart(address);
 		chkpt.SetEnd(address);
 		chkpt.stopWhenHit = 1;
 		chkpt.enabled = 1;
 		chkpt.operation = VICE_Exec;
 		chkpt.temporary = 0;
-		viceCon->AddMessage((uint8_t*)&chkpt, sizeof(chkpt));
-
-		// reset breakpoints
-		ClearBreakpoints();
-		VICEBinHeader breakList;
-		breakList.Setup(0, ++lastRequestID, VICE_CheckpointList);
-		viceCon->AddMessage((uint8_t*)&breakList, sizeof(VICEBinHeader));
+		// VICE answers with the new checkpoint info
+		return ViceCheckpointRequest((uint8_t*)&chkpt, sizeof(chkpt), 0);
 	}
+	return 0;
 }
 
-void ViceSetCondition(int checkPoint, strref condition)
+ViceRequest ViceSetCondition(int checkPoint, strref condition)
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinSetCondition cond;
-		cond.Setup(++lastRequestID, checkPoint, (uint8_t)condition.get_len(), condition.get());
-		viceCon->AddMessage((uint8_t*)&cond, sizeof(VICEBinCheckpoint) + 1 + condition.get_len());
+		cond.Setup(ViceNextRequestID(), checkPoint, (uint8_t)condition.get_len(), condition.get());
+		return ViceCheckpointRequest((uint8_t*)&cond, sizeof(VICEBinCheckpoint) + 1 + condition.get_len(), (uint32_t)checkPoint);
 	}
+	return 0;
 }
 
-void ViceRunTo(uint16_t addr)
+ViceRequest ViceRunTo(uint16_t addr)
 {
 	ClearBreapointsHit();
-	if (viceCon && viceCon->isConnected() && viceCon->isStopped()) {
+	if (viceCon && viceCon->isConnected() && viceCon->willBeStopped()) {
 		VICEBinCheckpointSet checkSet;
-		checkSet.Setup(8, ++lastRequestID, VICE_CheckpointSet);
+		checkSet.Setup(8, ViceNextRequestID(), VICE_CheckpointSet);
 		checkSet.SetStart(addr);
 		checkSet.SetEnd(addr);
 		checkSet.stopWhenHit = true;
 		checkSet.enabled = true;
 		checkSet.operation = (uint8_t)VICE_Exec;
 		checkSet.temporary = true;
-		viceCon->AddMessage((uint8_t*)&checkSet, sizeof(checkSet), true);
-		ViceGo();
+		ViceCheckpointRequest((uint8_t*)&checkSet, sizeof(checkSet), 0);
+		// VICE drops the temporary checkpoint by itself once hit
+		viceCon->RelistCheckpoints();
+		return ViceGo();
 	}
+	return 0;
 }
 
-void ViceStartProgram(const char* loadPrg)
+ViceRequest ViceStartProgram(const char* loadPrg)
 {
 	if (viceCon && viceCon->isConnected()) {
 		size_t loadFileLen = strlen(loadPrg);
 		VICEBinAutoStart autoStart;
-		autoStart.Setup((uint32_t)loadFileLen + 4, ++lastRequestID, VICE_AutoStart);
+		autoStart.Setup((uint32_t)loadFileLen + 4, ViceNextRequestID(), VICE_AutoStart);
 		autoStart.startImmediately = 1;
 		autoStart.fileIndex[0] = 0;
 		autoStart.fileIndex[1] = 0;
 		autoStart.fileNameLength = (uint8_t)loadFileLen;
 		memcpy(autoStart.filename, loadPrg, loadFileLen);
-		viceCon->AddMessage((uint8_t*)&autoStart, (uint32_t)(sizeof(VICEBinHeader) + 4 + loadFileLen), true);
+		return viceCon->AddMessage((uint8_t*)&autoStart, (uint32_t)(sizeof(VICEBinHeader) + 4 + loadFileLen));
 	}
+	return 0;
 }
 
-void ViceReset(uint8_t resetType)
+ViceRequest ViceReset(uint8_t resetType)
 {
 	if (viceCon && viceCon->isConnected()) {
 		VICEBinReset reset;
-		reset.Setup(1, ++lastRequestID, VICE_Reset);
+		reset.Setup(1, ViceNextRequestID(), VICE_Reset);
 		reset.resetType = resetType;
-		viceCon->AddMessage((uint8_t*)&reset, sizeof(VICEBinReset), false);
+		return viceCon->AddMessage((uint8_t*)&reset, sizeof(VICEBinReset));
+	}
+	return 0;
+}
+
+
+size_t ViceTraceHits(ViceTraceHit* hits, size_t maxHits)
+{
+	uint32_t read = sTraceHitRead.load(std::memory_order_relaxed);
+	uint32_t avail = sTraceHitWrite.load(std::memory_order_acquire) - read;
+	size_t count = avail < maxHits ? avail : maxHits;
+	for (size_t h = 0; h < count; ++h) {
+		hits[h] = sTraceHits[(read + h) & (VICE_TRACE_HITS - 1)];
 	}
+	sTraceHitRead.store(read + (uint32_t)count, std::memory_order_release);
+	return count;
 }
 
+uint64_t ViceTraceHitsDropped()
+{
+	return sTraceHitsDropped.load(std::memory_order_relaxed);
+}
 
 void ViceWaiting()
 {
@@ -426,9 +918,88 @@ void ViceWaiting()
 	}
 }
 
+// UI thread, take over the latest snapshot from the connection thread
+static bool ViceApplySnapshot()
+{
+	ViceSnapshot* snap = sReadySnapshot.exchange(nullptr);
+	if (!snap) { return false; }
+	if (CPU6510* cpu = GetMainCPU()) {
+		for (size_t r = 0, n = snap->ranges.size(); r < n; ++r) {
+			const ViceSnapshot::MemoryRange& range = snap->ranges[r];
+			cpu->MemoryFromVICE(range.start, range.end, snap->mem + range.start, range.generation, range.requestID);
+		}
+		ViceSnapshot::CopyRegs(cpu->regs, snap->regs, snap->regMask);
+	}
+	if (snap->parts & ViceSnapshot::HasCheckpoints) {
+		ClearBreakpoints();
+		for (size_t c = 0, n = snap->checkpoints.size(); c < n; ++c) {
+			const ViceSnapshot::Checkpoint& cp = snap->checkpoints[c];
+			if (cp.hit) { SetBreakpointHit(cp.number); }
+			AddBreakpoint(cp.number, cp.flags, cp.start, cp.end, cp.hasCondition ? "yes" : nullptr);
+		}
+	}
+	for (size_t c = 0, n = snap->checkpointOps.size(); c < n; ++c) {
+		const ViceSnapshot::Checkpoint& cp = snap->checkpointOps[c];
+		switch (cp.op) {
+			case ViceSnapshot::CP_Update:
+				if (cp.hit) { SetBreakpointHit(cp.number); }
+				UpdateBreakpoint(cp.number, cp.flags, cp.start, cp.end, cp.hasCondition ? "yes" : nullptr);
+				break;
+			case ViceSnapshot::CP_Remove:
+				RemoveBreakpoint(cp.number);
+				break;
+			case ViceSnapshot::CP_Enable:
+			case ViceSnapshot::CP_Disable:
+				EnableBreakpoint(cp.number, cp.op == ViceSnapshot::CP_Enable);
+				break;
+			case ViceSnapshot::CP_Condition:
+				SetBreakpointCondition(cp.number, "yes");
+				break;
+		}
+	}
+	if (snap->parts & ViceSnapshot::HasDisplay) {
+		RefreshScreen(snap->image, snap->imageWidth, snap->imageHeight, snap->screenLeft,
+			snap->screenTop, snap->screenWidth, snap->screenHeight);
+	}
+	++sSnapshotGeneration;
+	for (size_t c = 0, n = snap->completions.size(); c < n; ++c) {
+		const ViceSnapshot::Completion& done = snap->completions[c];
+		ViceRequestDone callback = done.done;
+		void* user = done.user;
+		if (!callback && viceCon) { viceCon->TakeAnswered(done.requestID, callback, user); }
+		if (callback) { callback(user, done.requestID, done.errorCode); }
+	}
+	snap->Reset();
+	if (ViceSnapshot* spare = sSpareSnapshot.exchange(snap)) { delete spare; }
+	return true;
+}
+
+uint32_t ViceSnapshotGeneration()
+{
+	return sSnapshotGeneration;
+}
+
 void ViceTickMessage()
 {
+	ViceFlushWrites();
+	bool applied = ViceApplySnapshot();
 	if (viceCon) { viceCon->Tick(); }
+
+	// first UI frame after a stop, registers are visible from here on
+	int64_t stopTime = applied ? sStopEventTime.exchange(0) : 0;
+	if (stopTime) {
+		sStopLatency = ViceTimeMicros() - stopTime;
+#ifdef VICELOG
+		strown<64> msg("Stop to UI: ");
+		msg.append_num((uint32_t)sStopLatency, 0, 10).append(" us");
+		ViceLog(msg.get_strref());
+#endif
+	}
+}
+
+int64_t ViceStopLatencyMicros()
+{
+	return sStopLatency;
 }
 
 static const int numNames = sizeof(aCommandNames) / sizeof(aCommandNames[0]);
@@ -442,7 +1013,7 @@ const char* ViceBinCmdName(uint8_t cmd)
 
 #define MAX_REGS_BUF 64
 
-bool ViceSetRegisters(const CPU6510& cpu, uint32_t regMask)
+ViceRequest ViceSetRegisters(const CPU6510& cpu, uint32_t regMask)
 {
 	if (viceCon) {
 		const CPU6510::Regs& regs = cpu.regs;
@@ -518,53 +1089,136 @@ bool ViceSetRegisters(const CPU6510& cpu, uint32_t regMask)
 			++ri;// = (VICEBinRegisterSetSingle*)((uint8_t*)ri + 4);
 			++count;
 		}
-		rm->Setup(size, ++lastRequestID, VICE_RegistersSet);
+		rm->Setup(size, ViceNextRequestID(), VICE_RegistersSet);
 		rm->memSpace = (uint8_t)mem;
 		rm->count[0] = (uint8_t)count;
 		rm->count[1] = (uint8_t)(count >> 8);
-		viceCon->AddMessage((uint8_t*)rm, size + sizeof(VICEBinHeader), true);
-		return true;
+		return viceCon->AddMessage((uint8_t*)rm, size + sizeof(VICEBinHeader));
 	}
-	return false;
+	return 0;
 }
 
 
-bool ViceGetMemory(uint16_t start, uint16_t end, VICEMemSpaces mem)
+ViceRequest ViceGetMemory(uint16_t start, uint16_t end, VICEMemSpaces mem)
 {
-	if (viceCon && viceCon->isConnected() && viceCon->isStopped()) {
-		VICEBinMemGetSet getNem(++lastRequestID, false, true, start, end, 0, mem);
-		GetMemoryRequest reqInfo = { lastRequestID, start, end, 0, (uint8_t)mem };
-		IBMutexLock(&userRequestMutex);
-		sMemRequests.push_back(reqInfo);
-		IBMutexRelease(&userRequestMutex);
+	ViceFlushWrites();
+	if (viceCon && viceCon->isConnected() && viceCon->willBeStopped()) {
+		uint32_t requestID = ViceNextRequestID();
+		VICEBinMemGetSet getNem(requestID, false, true, start, end, 0, mem);
+		PendingRequest reqInfo = { requestID, 0, ViceRequestKind::MemGet, (uint8_t)mem, VICE_MemGet, start, end, 0, nullptr, nullptr };
 #ifdef VICELOG
 		strown<128> msg("Requested VICE Memory $");
 		msg.append_num(start, 4, 16).append("-$").append_num(end, 4, 16).append("\n");
 		ViceLog(msg.get_strref());
 		OutputDebugStringA(msg.c_str());
 #endif
-		viceCon->AddMessage((uint8_t*)&getNem, sizeof(getNem), true);
-		return true;
+		return viceCon->AddRequest((uint8_t*)&getNem, sizeof(getNem), reqInfo);
 	}
-	return false;
+	return 0;
 }
 
-bool ViceSetMemory(uint16_t start, uint16_t len, uint8_t* bytes, VICEMemSpaces mem)
+ViceRequest ViceSetMemory(uint16_t start, uint16_t len, uint8_t* bytes, VICEMemSpaces mem)
 {
-	if (viceCon && viceCon->isConnected() && viceCon->isStopped()) {
-		VICEBinMemGetSet* setMem = (VICEBinMemGetSet*)calloc(1, sizeof(VICEBinMemGetSet) + len);
-		setMem->Setup(++lastRequestID, false, false, start, start + len - 1, 0, mem);
-		memcpy(setMem + 1, bytes, len);
+	if (viceCon && viceCon->isConnected() && viceCon->willBeStopped() && len) {
 #ifdef VICELOG
 		strown<128> msg("Setting VICE Memory $");
 		msg.append_num(start, 4, 16).append("-$").append_num(start + len - 1, 4, 16).append("\n");
 		ViceLog(msg.get_strref());
 		OutputDebugStringA(msg.c_str());
 #endif
-		viceCon->AddMessage((uint8_t*)setMem, sizeof(VICEBinMemGetSet) + len, true);
-		return true;
+		return viceCon->AddMemSet(start, bytes, len, mem, nullptr, nullptr);
 	}
-	return false;
+	return 0;
+}
+
+// chunk done on the UI thread, user is the chunk size. a failed chunk ends
+// the progress display, the chunks after it still complete on their own
+static void ViceUploadChunkDone(void* user, ViceRequest request, uint8_t errorCode)
+{
+	if (errorCode) {
+		strown<128> msg("Upload to VICE failed, request $");
+		msg.append_num(request, 0, 16).append(" error $").append_num(errorCode, 2, 16).append("\n");
+		ViceLog(msg.get_strref());
+	}
+	uint32_t done = sUploadDone += (uint32_t)(size_t)user;
+	if (done >= sUploadTotal || errorCode) {
+		sUploadDone = 0;
+		sUploadTotal = 0;
+	}
+}
+
+ViceRequest ViceUpload(uint16_t start, const uint8_t* data, uint32_t bytes, VICEMemSpaces mem)
+{
+	if (!viceCon || !viceCon->isConnected() || !viceCon->willBeStopped()) { return 0; }
+	if (bytes > (0x10000 - (uint32_t)start)) { bytes = 0x10000 - (uint32_t)start; }
+#ifdef VICELOG
+	strown<128> msg("Uploading VICE Memory $");
+	msg.append_num(start, 4, 16).append(" $").append_num(bytes, 4, 16).append(" bytes\n");
+	ViceLog(msg.get_strref());
+#endif
+	// only queued chunks count, one that couldn't be queued never completes
+	ViceRequest last = 0;
+	for (uint32_t offs = 0; offs < bytes; offs += VICE_UPLOAD_CHUNK) {
+		uint32_t chunk = (bytes - offs) < VICE_UPLOAD_CHUNK ? (bytes - offs) : VICE_UPLOAD_CHUNK;
+		ViceRequest request = viceCon->AddMemSet((uint16_t)(start + offs), data + offs, chunk, mem,
+			ViceUploadChunkDone, (void*)(size_t)chunk);
+		if (!request) { break; }
+		sUploadTotal += chunk;
+		last = request;
+	}
+	return last;
+}
+
+bool ViceUploadProgress(uint32_t& done, uint32_t& total)
+{
+	total = sUploadTotal;
+	done = sUploadDone;
+	return total != 0;
+}
+
+bool ViceRequestPending(ViceRequest request)
+{
+	return request && viceCon && viceCon->IsPending(request);
+}
+
+void ViceThen(ViceRequest request, ViceRequestDone done, void* user)
+{
+	if (!request || !viceCon || !viceCon->Then(request, done, user)) {
+		done(user, request, 0);
+	}
+}
+
+struct ViceRequestGroup {
+	std::atomic<size_t> remaining;
+	std::atomic<uint8_t> errorCode;
+	ViceRequestDone done;
+	void* user;
+};
+
+static void ViceGroupRequestDone(void* user, ViceRequest request, uint8_t errorCode)
+{
+	ViceRequestGroup* group = (ViceRequestGroup*)user;
+	if (errorCode) {
+		uint8_t none = 0;
+		group->errorCode.compare_exchange_strong(none, errorCode);
+	}
+	if (--group->remaining == 0) {
+		group->done(group->user, 0, group->errorCode);
+		delete group;
+	}
+}
+
+void ViceWhenAll(const ViceRequest* requests, size_t count, ViceRequestDone done, void* user)
+{
+	ViceRequestGroup* group = new ViceRequestGroup;
+	group->remaining = count + 1;	// held until every continuation is attached
+	group->errorCode = 0;
+	group->done = done;
+	group->user = user;
+	for (size_t i = 0; i < count; ++i) {
+		ViceThen(requests[i], ViceGroupRequestDone, group);
+	}
+	ViceGroupRequestDone(group, 0, 0);
 }
 
 void ViceAddLogger(ViceLogger logger, void* user)
@@ -575,15 +1229,17 @@ void ViceAddLogger(ViceLogger logger, void* user)
 
 void ViceConnection::connectionThread()
 {
-	char* recvBuf = (char*)malloc(RECEIVE_SIZE);
-	if (!recvBuf) { return; }
+	if (!recvRing.Init()) { return; }
 
 	// Open the connection
 	if (!open()) { return; }
 
-	int32_t timeout = 100000;// SOCKET_READ_TIMEOUT_SEC*1000;
-	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO | SO_DEBUG, (char*)&timeout, sizeof(timeout));
-
+	if (!openWake()) {
+		closeWake();
+		close();
+		recvRing.Free();
+		return;
+	}
 
 	bool activeConnection = true;
 	{
@@ -594,7 +1250,7 @@ void ViceConnection::connectionThread()
 //		AddMessage((uint8_t*)&regMsg, sizeof(regMsg));
 	}
 
-	size_t bufferRead = 0;
+	sOnConnectionThread = true;
 	connected = true;
 
 	while (activeConnection) {
@@ -608,183 +1264,175 @@ void ViceConnection::connectionThread()
 			break;
 		}
 
+		if (expirePending.exchange(false)) { expireRequests(); }
+
+		// send anything queued, including commands issued by the response handlers, as one batch
+		pumpSchedule();
+		FlushMessages();
+
+		// sleep until VICE sends something or another thread has something to send
+		int events = waitForEvents();
+		if (events < 0) {
+			activeConnection = false;
+			break;
+		}
+		if (events & WAIT_WAKE) { clearWake(); }
+		if (!(events & WAIT_RECEIVE)) { continue; }
+
 		// messages to receive
-		assert(bufferRead < (RECEIVE_SIZE * 3 / 4));
-		int bytesReceived = recv(s, recvBuf + bufferRead, int(RECEIVE_SIZE - bufferRead), 0);
+		size_t space = 0;
+		uint8_t* recvTo = recvRing.WriteSpace(space);
+		if (!space) {
+			activeConnection = false;	// ring couldn't grow to fit a response
+			break;
+		}
+		int bytesReceived = recv(s, (char*)recvTo, int(space), 0);
 		if (bytesReceived == SOCKET_ERROR) {
 		#ifdef _WIN32
-			if (WSAGetLastError() == WSAETIMEDOUT) {
-//				if ((state == Vice_None || state == Vice_Running) && stopRequest) {
-//					offs = 0;
-//					send(s, "r\n", 2, NULL);
-//					stopRequest = false;
-//				} else if (syncRequest) {
-//					syncRequest = false;
-//					ClearAllPCBreakpoints();
-//					ResetViceBP();
-//					send(s, sBundle, (int)strlen(sBundle), NULL);
-//					state = Vice_Sync;
-//					syncing = true;
-//					monitorOn = true;
-//					offs = 0;
-//					viceRunning = false;
-//					viceReloadSymbols = true;
-//				}
-				Sleep(50);
-			} else {
+			if (WSAGetLastError() != WSAEWOULDBLOCK) {
+		#else
+			if (errno != EINTR && errno != EAGAIN) {
+		#endif
 				activeConnection = false;
 				break;
 			}
-		#else
-			Sleep(50);
-		#endif
+		} else if (bytesReceived == 0) {
+			// VICE closed the connection
+			activeConnection = false;
+			break;
 		} else {
-			bufferRead += bytesReceived;
+			recvRing.Written((size_t)bytesReceived);
 
-			while (bufferRead >= sizeof(VICEBinResponse) && recvBuf[0] == 2) {
-				VICEBinResponse* resp = (VICEBinResponse*)recvBuf;
-				uint32_t bytes = resp->GetSize();
-				if (bufferRead >= bytes) {
+			uint32_t bytes = 0;
+			while (VICEBinResponse* resp = recvRing.NextFrame(bytes)) {
+				handleResponse(resp);
+				recvRing.Consume(bytes);
+			}
+			if (building && !refreshOutstanding()) { publishSnapshot(); }
+		}
+	}
+	// connection with VICE was terminated for some reason
+	recvRing.Free();
+	closeWake();
+	DiscardMessages();
+	connected = false;
+	breakPending = false;
+	resumePending = false;
+	stepPending = false;
+	dropSchedule();
+	abortRequests();
+	completeAnswered();
+	publishSnapshot();
+}
+
+// resp points into the receive ring and is only valid during this call
+void ViceConnection::handleResponse(VICEBinResponse* resp)
+{
 #ifdef VICELOG
-					strown<128> msg("Got resp: $");
-					msg.append_num(resp->commandType, 2, 16);
-					msg.append(" (").append(ViceBinCmdName(resp->commandType)).append(")");
-					msg.append(" ReqID:").append_num(resp->GetReqID(), 0, 16);
-					if (resp->errorCode) {
-						msg.append(" err: ").append_num(resp->errorCode, 2, 16);
-					}
-					msg.append("\n");
-					ViceLog(msg.get_strref());
-					OutputDebugStringA(msg.c_str());
+	strown<128> msg("Got resp: $");
+	msg.append_num(resp->commandType, 2, 16);
+	msg.append(" (").append(ViceBinCmdName(resp->commandType)).append(")");
+	msg.append(" ReqID:").append_num(resp->GetReqID(), 0, 16);
+	if (resp->errorCode) {
+		msg.append(" err: ").append_num(resp->errorCode, 2, 16);
+	}
+	msg.append("\n");
+	ViceLog(msg.get_strref());
+	OutputDebugStringA(msg.c_str());
 #endif
-					uint32_t id = resp->GetReqID();
-					if (id != 0xffffffff) {
-						IBMutexLock(&msgSendMutex);
-						for (size_t i = 0, n = sMessageTimeouts.size(); i < n; ++i) {
-							if (sMessageTimeouts[i].requestID == id) {
-								sMessageTimeouts.erase(sMessageTimeouts.begin() + i);
-								break;
-							}
-						}
-						IBMutexRelease(&msgSendMutex);
-					}
+	uint32_t id = resp->GetReqID();
+	PendingRequest request;
+	bool found = false;
+	if (id != 0xffffffff) {
+		IBMutexLock(&msgSendMutex);
+		found = pending.Remove(id, resp->commandType, resp->errorCode, request);
+		if (found && request.scheduled) {
+			if (scheduledInFlight) { --scheduledInFlight; }
+			if (request.priority < (uint8_t)ViceSchedule::Display && refreshInFlight) { --refreshInFlight; }
+		}
+		if (found && !request.done) {
+			// ViceThen may still be called before the UI has applied this response
+			AnsweredRequest* waiting = answered.Insert(id);
+			waiting->done = nullptr;
+			waiting->user = nullptr;
+		}
+		IBMutexRelease(&msgSendMutex);
+	}
 
-					switch (resp->commandType) {
-						case VICE_RegistersGet:
-							updateRegisters((VICEBinRegisterResponse*)resp);
-							break;
-						case VICE_RegistersAvailable:
-							updateRegisterNames((VICEBinRegisterAvailableResponse*)resp);
-							break;
-						case VICE_Resumed:
+	switch (resp->commandType) {
+		case VICE_RegistersGet:
+			updateRegisters((VICEBinRegisterResponse*)resp);
+			break;
+		case VICE_RegistersAvailable:
+			updateRegisterNames((VICEBinRegisterAvailableResponse*)resp);
+			break;
+		case VICE_Resumed:
 #ifdef _DEBUG
-							OutputDebugStringA("Vice resumed\n");
+			OutputDebugStringA("Vice resumed\n");
 #endif
-							handleStopResume((VICEBinStopResponse*)resp);
-							break;
-						case VICE_MemGet:
-							updateGetMemory((VICEBinMemGetResponse*)resp);
-							break;
-						case VICE_CheckpointList:
-							handleCheckpointList((VICEBinCheckpointList*)resp);
-							break;
-						case VICE_CheckpointGet:
-							handleCheckpointGet((VICEBinCheckpointResponse*)resp);
-							break;
-						case VICE_Step:
+			handleStopResume((VICEBinStopResponse*)resp);
+			break;
+		case VICE_MemGet:
+			updateGetMemory((VICEBinMemGetResponse*)resp, found ? &request : nullptr);
+			break;
+		case VICE_CheckpointList:
+			handleCheckpointList((VICEBinCheckpointList*)resp);
+			if (id == checkpointListID) {
+				// changes answered before the list are already in it
+				snapshot()->parts |= ViceSnapshot::HasCheckpoints;
+				snapshot()->checkpointOps.clear();
+				checkpointListID = 0;
+			}
+			break;
+		case VICE_CheckpointGet:
+			handleCheckpointGet((VICEBinCheckpointResponse*)resp, id);
+			break;
+		case VICE_Step:
 #ifdef _DEBUG
-							OutputDebugStringA("Vice stepped!\n");
+			OutputDebugStringA("Vice stepped!\n");
 #endif
-							break;
-						case VICE_Stopped:
-						case VICE_JAM:
+			break;
+		case VICE_Stopped:
+		case VICE_JAM:
 #ifdef _DEBUG
-							OutputDebugStringA("Vice stopped\n");
+			OutputDebugStringA("Vice stopped\n");
 #endif
-							handleStopResume((VICEBinStopResponse*)resp);
-							break;
-						case VICE_DisplayGet:
-							handleDisplayGet((VICEBinDisplayResponse*)resp);
-							break;
-						case VICE_AutoStart:
+			handleStopResume((VICEBinStopResponse*)resp);
+			break;
+		case VICE_DisplayGet:
+			handleDisplayGet((VICEBinDisplayResponse*)resp);
+			break;
+		case VICE_AutoStart:
 #ifdef _DEBUG
-							OutputDebugStringA("Loaded!\n");
-#endif
-							break;
-					}
-					if (bufferRead > bytes) {
-						memmove(recvBuf, recvBuf + bytes, bufferRead - bytes);
-						bufferRead -= bytes;
-					} else {
-						bufferRead = 0;
-					}
-
-				} else {
-					break;
-				}
-			}
-		}
-
-#ifndef SEND_IMMEDIATE
-		// messages to send
-		{
-			ViceMessage* msg = nullptr;
-			IBMutexLock(&msgSendMutex);
-			if (toSend.size()) {
-				msg = toSend.front(); toSend.pop();
-			}
-			IBMutexRelease(&msgSendMutex);
-			if (msg) {
-				send(s, (const char*)(&msg->size + 1), msg->size, 0);
-				free(msg);
-			}
-		}
+			OutputDebugStringA("Loaded!\n");
 #endif
+			break;
+	}
+	if (found && request.kind == ViceRequestKind::Checkpoint) {
+		handleCheckpointResponse(resp, request);
+	}
+	if (found) {
+		ViceSnapshot::Completion done = { request.done, request.user, id, resp->errorCode };
+		snapshot()->completions.push_back(done);
 	}
-	// connection with VICE was terminated for some reason
-	free(recvBuf);
-	IBMutexLock(&msgSendMutex);
-	sMessageTimeouts.clear();
-	sMemRequests.clear();
-	connected = false;
-	IBMutexRelease(&msgSendMutex);
 }
 
-void ViceConnection::updateGetMemory(VICEBinMemGetResponse* resp)
+void ViceConnection::updateGetMemory(VICEBinMemGetResponse* resp, const PendingRequest* request)
 {
-	IBMutexLock(&userRequestMutex);
 	// TODO: Check memory range for end
-	uint32_t id = resp->GetReqID();
-	uint16_t start = 0;
-	uint8_t space = 0;
-#ifdef VICELOG
-	uint16_t bank = 0;
-#endif
-	bool found = false;
-	for (size_t i = 0; i < sMemRequests.size(); ++i) {
-		if (sMemRequests[i].requestID == id) {
-			start = sMemRequests[i].start;
-			//end = sMemRequests[i].end;
-#ifdef VICELOG
-			bank = sMemRequests[i].bank;
-#endif
-			space = sMemRequests[i].space;
-			found = true;
-			sMemRequests.erase(sMemRequests.begin() + i);
-			break;
-		}
-	}
-	IBMutexRelease(&userRequestMutex);
-
-	assert(found);
+	// a response to an expired request is no longer tracked
+	if (!request || request->kind != ViceRequestKind::MemGet) { return; }
+	uint16_t start = request->start;
+	uint8_t space = request->space;
 	if (CPU6510* cpu = GetCPU((VICEMemSpaces)space)) {
 #ifdef VICELOG
 		strown<128> msg("updating $");
 		msg.append_num(start, 4, 16).append("-$").append_num(start + resp->bytes[0] + (((uint16_t)resp->bytes[1]) << 8) - 1, 4, 16);
-		msg.append(" mem/bank:").append_num(space, 0, 10).append("/").append_num(bank, 0, 10);
+		msg.append(" mem/bank:").append_num(space, 0, 10).append("/").append_num(request->bank, 0, 10);
 		ViceLog(msg.get_strref());
 #endif
-		cpu->MemoryFromVICE(start, start + resp->bytes[0] + (((uint16_t)resp->bytes[1]) << 8) - 1, resp->data);
+		snapshot()->SetMemory(start, start + resp->bytes[0] + (((uint16_t)resp->bytes[1]) << 8) - 1, resp->data,
+			cpu->MemoryGeneration(), request->requestID);
 	}
 }
 
@@ -798,52 +1446,93 @@ void ViceConnection::handleCheckpointList(VICEBinCheckpointList* cpList)
 }
 
 // this also gets called every tracepoint!
-void ViceConnection::handleCheckpointGet(VICEBinCheckpointResponse* cp)
+void ViceConnection::handleCheckpointGet(VICEBinCheckpointResponse* cp, uint32_t requestID)
 {
-	uint32_t flags = 0;
-	if (cp->enabled) flags |= Breakpoint::Enabled;
-	if (cp->stopWhenHit) flags |= Breakpoint::Stop;
-	if (cp->operation & VICE_Exec) flags |= Breakpoint::Exec;
-	if (cp->operation & VICE_LoadMem) flags |= Breakpoint::Load;
-	if (cp->operation & VICE_StoreMem) flags |= Breakpoint::Store;
-	if (cp->wasHit) {
-		flags |= Breakpoint::Current;
-		SetBreakpointHit(cp->GetNumber());
+	// hit events of checkpoints that don't stop can arrive thousands of times a second
+	if (requestID == 0xffffffff && !cp->stopWhenHit) {
+		uint32_t write = sTraceHitWrite.load(std::memory_order_relaxed);
+		if (write - sTraceHitRead.load(std::memory_order_acquire) >= VICE_TRACE_HITS) {
+			sTraceHitsDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		ViceTraceHit& hit = sTraceHits[write & (VICE_TRACE_HITS - 1)];
+		hit.time = ViceTimeMicros();
+		hit.number = cp->GetNumber();
+		hit.count = cp->GetCount();
+		hit.address = cp->GetStart();
+		sTraceHitWrite.store(write + 1, std::memory_order_release);
+		return;
+	}
+
+	ViceSnapshot::Checkpoint info = { cp->GetNumber(), 0, cp->GetStart(), cp->GetEnd(),
+		cp->hasCondition != 0, cp->wasHit != 0, ViceSnapshot::CP_Update };
+	if (cp->enabled) info.flags |= Breakpoint::Enabled;
+	if (cp->stopWhenHit) info.flags |= Breakpoint::Stop;
+	if (cp->operation & VICE_Exec) info.flags |= Breakpoint::Exec;
+	if (cp->operation & VICE_LoadMem) info.flags |= Breakpoint::Load;
+	if (cp->operation & VICE_StoreMem) info.flags |= Breakpoint::Store;
+	if (cp->wasHit) info.flags |= Breakpoint::Current;
+	if (cp->temporary) info.flags |= Breakpoint::Temporary;
+
+	// the list requested on stop shows up with the rest of the stop,
+	// otherwise this is a new checkpoint or a hit and VICE sends everything about it
+	if (requestID == checkpointListID) {
+		snapshot()->checkpoints.push_back(info);
+	} else {
+		snapshot()->checkpointOps.push_back(info);
+	}
+	// no command for receiving checkpoint condition?
+}
+
+// delete, toggle and condition only answer with an empty response
+void ViceConnection::handleCheckpointResponse(VICEBinResponse* resp, const PendingRequest& request)
+{
+	if (resp->errorCode) {
+		// the local set may not match VICE anymore
+		relistCheckpoints = true;
+		return;
 	}
-	if (cp->temporary) flags |= Breakpoint::Temporary;
-	AddBreakpoint(cp->GetNumber(), flags, cp->GetStart(), cp->GetEnd(),
-				  cp->hasCondition ? "yes" : nullptr);
-	if (cp->hasCondition) {
-		// no command for receiving checkpoint condition?
+	ViceSnapshot::Checkpoint info = { request.checkpoint, 0, 0, 0, false, false, ViceSnapshot::CP_Update };
+	switch (request.response) {
+		case VICE_CheckpointDelete: info.op = ViceSnapshot::CP_Remove; break;
+		case VICE_CheckpointToggle: info.op = request.enable ? ViceSnapshot::CP_Enable : ViceSnapshot::CP_Disable; break;
+		case VICE_ConditionSet: info.op = ViceSnapshot::CP_Condition; break;
+		default: return;	// set is answered with the checkpoint info
 	}
+	snapshot()->checkpointOps.push_back(info);
 }
 
 void ViceConnection::updateRegisters(VICEBinRegisterResponse* resp)
 {
-	if (CPU6510* cpu = GetMainCPU()) {
-		for (uint16_t r = 0, n = resp->GetCount(); r < n; ++r) {
-			VICEBinRegisterResponse::regInfo& info = resp->aRegs[r];
-			switch (info.registerID) {
-				case VICE_Acc: cpu->regs.A = info.GetValue8(); break;
-				case VICE_X: cpu->regs.X = info.GetValue8(); break;
-				case VICE_Y: cpu->regs.Y = info.GetValue8(); break;
-				case VICE_PC: cpu->regs.PC = info.GetValue16(); break;
-				case VICE_SP: cpu->regs.SP = info.GetValue8(); break;
-				case VICE_FL: cpu->regs.FL = info.GetValue8(); break;
-				case VICE_LIN: cpu->regs.LIN = info.GetValue16(); break;
-				case VICE_CYC: cpu->regs.CYC = info.GetValue16(); break;
-				case VICE_00: cpu->regs.ZP00 = info.GetValue8(); break;
-				case VICE_01: cpu->regs.ZP01 = info.GetValue8(); break;
-			}
+	CPU6510::Regs regs;
+	uint32_t mask = 0;
+	for (uint16_t r = 0, n = resp->GetCount(); r < n; ++r) {
+		VICEBinRegisterResponse::regInfo& info = resp->aRegs[r];
+		switch (info.registerID) {
+			case VICE_Acc: regs.A = info.GetValue8(); mask |= CPU6510::RM_A; break;
+			case VICE_X: regs.X = info.GetValue8(); mask |= CPU6510::RM_X; break;
+			case VICE_Y: regs.Y = info.GetValue8(); mask |= CPU6510::RM_Y; break;
+			case VICE_PC: regs.PC = info.GetValue16(); mask |= CPU6510::RM_PC; break;
+			case VICE_SP: regs.SP = info.GetValue8(); mask |= CPU6510::RM_SP; break;
+			case VICE_FL: regs.FL = info.GetValue8(); mask |= CPU6510::RM_FL; break;
+			case VICE_LIN: regs.LIN = info.GetValue16(); mask |= CPU6510::RM_LIN; break;
+			case VICE_CYC: regs.CYC = info.GetValue16(); mask |= CPU6510::RM_CYC; break;
+			case VICE_00: regs.ZP00 = info.GetValue8(); mask |= CPU6510::RM_ZP00; break;
+			case VICE_01: regs.ZP01 = info.GetValue8(); mask |= CPU6510::RM_ZP01; break;
 		}
 	}
+	snapshot()->SetRegs(regs, mask);
 }
 
 void ViceConnection::handleDisplayGet(VICEBinDisplayResponse* resp)
 {
-	RefreshScreen(resp->image, resp->GetWidthImage(), resp->GetHeightImage(),
-		resp->GetLeftScreen(), resp->GetTopScreen(),
-		resp->GetWidthScreen(), resp->GetHeightScreen());
+	ViceSnapshot* snap = snapshot();
+	if (snap->SetImage(resp->image, resp->GetWidthImage(), resp->GetHeightImage())) {
+		snap->screenLeft = resp->GetLeftScreen();
+		snap->screenTop = resp->GetTopScreen();
+		snap->screenWidth = resp->GetWidthScreen();
+		snap->screenHeight = resp->GetHeightScreen();
+	}
 }
 
 void ViceConnection::handleStopResume(VICEBinStopResponse* resp)
@@ -853,29 +1542,52 @@ void ViceConnection::handleStopResume(VICEBinStopResponse* resp)
 	msg.append_num(resp->GetPC(), 4, 16);
 	ViceLog(msg.get_strref());
 #endif
-	if (CPU6510* cpu = GetCurrCPU()) {
-		cpu->regs.PC = resp->GetPC();
-	}
+	CPU6510::Regs regs;
+	regs.PC = resp->GetPC();
+	snapshot()->SetRegs(regs, CPU6510::RM_PC);
 	switch (resp->commandType) {
 		case VICE_Resumed:
 			stopped = false;
+			breakPending = false;
+			resumePending = false;
+			// memory requests would stop VICE again
+			dropSchedule();
 			break;
 		case VICE_Stopped:
 		case VICE_JAM: {
 			stopped = true;
-			ViceGetMemory(0x0000, 0x7fff, VICEMemSpaces::MainMemory);
-			ViceGetMemory(0x8000, 0xffff, VICEMemSpaces::MainMemory);
+			stepPending = false;
+			++stopCount;
+			sStopEventTime = ViceTimeMicros();
+			// anything still waiting from the previous stop is out of date
+			dropSchedule();
+			CPU6510* cpu = GetMainCPU();
+			if (cpu) { cpu->InvalidateMemory(); }
+			// a queued resume gets to VICE before anything sent from here
+			if (resumePending) { break; }
+
+			// only fetch what was on screen along with zero page, stack and
+			// the instruction at PC, the rest follows as it gets shown
+			if (cpu) {
+				uint64_t pages[CPU6510::PAGE_WORDS] = {};
+				CPU6510::PagesInRange(pages, 0x0000, 0x01ff);
+				CPU6510::PagesInRange(pages, resp->GetPC(), resp->GetPC() + 2);
+				scheduleMemory(ViceSchedule::PCPage, cpu, pages, CPU6510::NUM_PAGES, CPU6510::NUM_PAGES);
+				cpu->WantedPages(pages);
+				scheduleMemory(ViceSchedule::Visible, cpu, pages, CPU6510::NUM_PAGES, CPU6510::NUM_PAGES);
+			}
 
 			// breakpoint list is just an empty message
-			ClearBreakpoints();
-			VICEBinHeader breakList;
-			breakList.Setup(0, ++lastRequestID, VICE_CheckpointList);
-			AddMessage((uint8_t*)&breakList, sizeof(VICEBinHeader));
+			if (relistCheckpoints.exchange(false)) {
+				VICEBinHeader breakList;
+				breakList.Setup(0, ViceNextRequestID(), VICE_CheckpointList);
+				schedule(ViceSchedule::Checkpoints, (uint8_t*)&breakList, sizeof(VICEBinHeader), PendingRequest());
+			}
 
 			// update the vice display
 			// TODO: skip if ScreenView is hidden
-			VICEBinDisplay getDisplay(++lastRequestID, VICEDisplay_Indexed);
-			AddMessage((uint8_t*)&getDisplay, sizeof(VICEBinDisplay));
+			VICEBinDisplay getDisplay(ViceNextRequestID(), VICEDisplay_Indexed);
+			schedule(ViceSchedule::Display, (uint8_t*)&getDisplay, sizeof(VICEBinDisplay), PendingRequest());
 
 			break;
 		}
@@ -946,47 +1658,263 @@ bool ViceConnection::open()
 	}
 
 	iResult = ::connect(s, (struct sockaddr*)&saGNI, sizeof(saGNI));
+
+	// commands are already coalesced before sending so don't let Nagle hold them back
+	int noDelay = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
 	sCloseConnectRequest = false;
 	return iResult == 0;
 }
 
+// queue a request behind the ones with higher priority. the pending
+// request info is filled in from the header unless given
+void ViceConnection::schedule(ViceSchedule priority, uint8_t* message, int size, const PendingRequest& request)
+{
+	ScheduledMessage* msg = (ScheduledMessage*)malloc(sizeof(ScheduledMessage) + size);
+	if (!msg) { return; }
+	VICEBinHeader* hdr = (VICEBinHeader*)message;
+	msg->next = nullptr;
+	msg->request = request;
+	if (!msg->request.requestID) {
+		msg->request.requestID = hdr->GetReqID();
+		msg->request.kind = ViceRequestKind::Command;
+		msg->request.response = ViceResponseType(hdr->commandType);
+	}
+	msg->request.scheduled = true;
+	msg->request.priority = (uint8_t)priority;
+	msg->size = size;
+	memcpy(msg + 1, message, size);
+
+	IBMutexLock(&msgSendMutex);
+	if (scheduleTail[(int)priority]) { scheduleTail[(int)priority]->next = msg; }
+	else { scheduleHead[(int)priority] = msg; }
+	scheduleTail[(int)priority] = msg;
+	IBMutexRelease(&msgSendMutex);
+	if (!sOnConnectionThread) { Wake(); }
+}
+
+void ViceConnection::scheduleMemory(ViceSchedule priority, CPU6510* cpu, const uint64_t* pages, uint32_t maxPages, int maxRequests)
+{
+	uint16_t start, end;
+	while (maxRequests-- && cpu->NextMemoryRequest(pages, maxPages, start, end)) {
+		uint32_t requestID = ViceNextRequestID();
+		VICEBinMemGetSet getMem(requestID, false, true, start, end, 0, cpu->space);
+		PendingRequest request = { requestID, 0, ViceRequestKind::MemGet, (uint8_t)cpu->space, VICE_MemGet, start, end, 0, nullptr, nullptr, true };
+		schedule(priority, (uint8_t*)&getMem, sizeof(getMem), request);
+	}
+}
+
+// the stop refresh ahead of the display hasn't been answered yet
+bool ViceConnection::refreshOutstanding()
+{
+	IBMutexLock(&msgSendMutex);
+	bool outstanding = refreshInFlight != 0;
+	for (int p = 0; !outstanding && p < (int)ViceSchedule::Display; ++p) {
+		if (scheduleHead[p]) { outstanding = true; }
+	}
+	IBMutexRelease(&msgSendMutex);
+	return outstanding;
+}
+
+ViceSnapshot* ViceConnection::snapshot()
+{
+	if (!building) {
+		building = sSpareSnapshot.exchange(nullptr);
+		if (!building) { building = new ViceSnapshot; }
+	}
+	return building;
+}
+
+// hand the snapshot to the UI, merged into the previous one if that is still waiting
+void ViceConnection::publishSnapshot()
+{
+	if (!building || building->Empty()) { return; }
+	if (ViceSnapshot* unread = sReadySnapshot.exchange(nullptr)) {
+		unread->Merge(*building);
+		building->Reset();
+		if (ViceSnapshot* spare = sSpareSnapshot.exchange(building)) { delete spare; }
+		building = unread;
+	}
+	sReadySnapshot.store(building);
+	building = nullptr;
+}
+
+bool ViceConnection::scheduleIdle()
+{
+	IBMutexLock(&msgSendMutex);
+	bool idle = !scheduledInFlight;
+	for (int p = 0; idle && p < (int)ViceSchedule::Count; ++p) {
+		if (scheduleHead[p]) { idle = false; }
+	}
+	IBMutexRelease(&msgSendMutex);
+	return idle;
+}
+
+// connection thread, release scheduled requests while few enough are unanswered.
+// display and background memory are large so they go out alone
+void ViceConnection::pumpSchedule()
+{
+	IBMutexLock(&msgSendMutex);
+	while (scheduledInFlight < MAX_SCHEDULED_IN_FLIGHT) {
+		int priority = 0;
+		while (priority < (int)ViceSchedule::Count && !scheduleHead[priority]) { ++priority; }
+		if (priority == (int)ViceSchedule::Count) { break; }
+		if (priority >= (int)ViceSchedule::Display && scheduledInFlight) { break; }
+
+		ScheduledMessage* msg = scheduleHead[priority];
+		scheduleHead[priority] = msg->next;
+		if (!msg->next) { scheduleTail[priority] = nullptr; }
+
+		msg->request.issueTick = tickCount;
+		pending.Insert(msg->request);
+		++scheduledInFlight;
+		if (priority < (int)ViceSchedule::Display) { ++refreshInFlight; }
+		IBMutexRelease(&msgSendMutex);
+
+		if (((VICEBinHeader*)(msg + 1))->commandType == VICE_CheckpointList) { checkpointListID = msg->request.requestID; }
+		queueMessage((uint8_t*)(msg + 1), msg->size);
+		free(msg);
+
+		IBMutexLock(&msgSendMutex);
+	}
+	IBMutexRelease(&msgSendMutex);
+}
+
+// forget scheduled requests that weren't sent, their pages go back to stale
+void ViceConnection::dropSchedule()
+{
+	ScheduledMessage* dropped = nullptr;
+	IBMutexLock(&msgSendMutex);
+	for (int p = 0; p < (int)ViceSchedule::Count; ++p) {
+		if (scheduleTail[p]) {
+			scheduleTail[p]->next = dropped;
+			dropped = scheduleHead[p];
+		}
+		scheduleHead[p] = scheduleTail[p] = nullptr;
+	}
+	IBMutexRelease(&msgSendMutex);
+	while (dropped) {
+		ScheduledMessage* next = dropped->next;
+		if (dropped->request.kind == ViceRequestKind::MemGet) {
+			if (CPU6510* cpu = GetCPU((VICEMemSpaces)dropped->request.space)) {
+				cpu->MemoryRequestFailed(dropped->request.start, dropped->request.end);
+			}
+		}
+		free(dropped);
+		dropped = next;
+	}
+}
+
+// UI thread, fetch pages the views asked for and eventually everything else
+void ViceConnection::syncMemory()
+{
+	CPU6510* cpu = GetMainCPU();
+	if (!cpu) { return; }
+	cpu->PublishWantedMemory();
+	if (!connected || !stopped || stepPending || resumePending) { return; }
+
+	uint32_t stops = stopCount;
+	if (stops != lastStopCount) {
+		lastStopCount = stops;
+		stoppedTicks = 0;
+	}
+	uint64_t pages[CPU6510::PAGE_WORDS];
+	cpu->WantedPages(pages);
+	scheduleMemory(ViceSchedule::Visible, cpu, pages, CPU6510::NUM_PAGES, CPU6510::NUM_PAGES);
+	if (++stoppedTicks > BACKGROUND_FETCH_TICKS && scheduleIdle()) {
+		scheduleMemory(ViceSchedule::Background, cpu, nullptr, BACKGROUND_FETCH_PAGES, 1);
+	}
+}
+
 void ViceConnection::Tick()
 {
+	syncMemory();
 	IBMutexLock(&msgSendMutex);
 	uint32_t maxTime = 0;
-	for (size_t i = 0, n = sMessageTimeouts.size(); i < n; ++i) {
-		sMessageTimeouts[i].timeSincePing++;
-		if (sMessageTimeouts[i].timeSincePing > maxTime) {
-			maxTime = sMessageTimeouts[i].timeSincePing;
-		}
+	bool expire = false;
+	++tickCount;
+	if (PendingRequest* oldest = pending.Oldest()) {
+		uint32_t since = int32_t(oldest->issueTick - lastPingTick) > 0 ? oldest->issueTick : lastPingTick;
+		maxTime = tickCount - since;
+		expire = (tickCount - oldest->issueTick) > EXPIRE_TICKS;
 	}
 	IBMutexRelease(&msgSendMutex);
-	if (maxTime > 100) {
+	if (expire && !expirePending.exchange(true)) { Wake(); }
+	if (maxTime > PING_TICKS) {
 #ifdef VICELOG
 		strown<256> msg("No response for:");
 		IBMutexLock(&msgSendMutex);
-//		uint32_t maxTime = 0;
-		for (size_t i = 0, n = sMessageTimeouts.size(); i < n; ++i) {
-			if (i) { msg.append(", "); }
-			msg.append_num(sMessageTimeouts[i].requestID, 0, 16);
-		}
+		msg.append(" ").append_num(pending.count, 0, 10).append(" requests, oldest ");
+		msg.append_num(pending.oldest, 0, 16);
 		IBMutexRelease(&msgSendMutex);
 		msg.append(". Sending Ping to VICE");
 		ViceLog(msg.get_strref());
 #endif
 		VicePing();
 		IBMutexLock(&msgSendMutex);
-		for (size_t i = 0, n = sMessageTimeouts.size(); i < n; ++i) {
-			sMessageTimeouts[i].timeSincePing = 0;
-		}
+		lastPingTick = tickCount;
 		IBMutexRelease(&msgSendMutex);
 	}
 }
 
-void ViceConnection::AddMessage(uint8_t* message, int size, bool wantResponse)
+// every command is tracked until its response arrives, returns the request ID
+ViceRequest ViceConnection::AddMessage(uint8_t* message, int size)
 {
-#ifdef VICELOG
 	VICEBinHeader* hdr = (VICEBinHeader*)message;
+	PendingRequest request = { hdr->GetReqID(), 0, ViceRequestKind::Command, 0, ViceResponseType(hdr->commandType), 0, 0, 0, nullptr, nullptr };
+	return AddRequest(message, size, request);
+}
+
+// register a request for its response before queueing it so the response can't beat it
+ViceRequest ViceConnection::AddRequest(uint8_t* message, int size, const PendingRequest& request)
+{
+	IBMutexLock(&msgSendMutex);
+	PendingRequest tracked = request;
+	tracked.issueTick = tickCount;
+	pending.Insert(tracked);
+	IBMutexRelease(&msgSendMutex);
+	queueMessage(message, size);
+	return request.requestID;
+}
+
+// MemSet built straight into the send queue so the bytes are only copied once
+ViceRequest ViceConnection::AddMemSet(uint16_t start, const uint8_t* data, uint32_t bytes, VICEMemSpaces mem,
+	ViceRequestDone done, void* user)
+{
+	int size = (int)(sizeof(VICEBinMemGetSet) + bytes);
+	ViceMessage* msg = (ViceMessage*)malloc(sizeof(ViceMessage) + size);
+	if (!msg) { return 0; }
+	msg->size = size;
+	uint32_t requestID = ViceNextRequestID();
+	uint16_t end = (uint16_t)(start + bytes - 1);
+	VICEBinMemGetSet* setMem = (VICEBinMemGetSet*)(msg + 1);
+	setMem->Setup(requestID, false, false, start, end, 0, mem);
+	memcpy(setMem + 1, data, bytes);
+
+	PendingRequest request = { requestID, 0, ViceRequestKind::Command, (uint8_t)mem, VICE_MemSet, start, end, 0, done, user };
+	IBMutexLock(&msgSendMutex);
+	request.issueTick = tickCount;
+	pending.Insert(request);
+	IBMutexRelease(&msgSendMutex);
+	pushMessage(msg);
+	return requestID;
+}
+
+void ViceConnection::queueMessage(uint8_t* message, int size)
+{
+	ViceMessage* msg = (ViceMessage*)malloc(sizeof(ViceMessage) + size);
+	if (!msg) { return; }
+	msg->size = size;
+	memcpy(msg + 1, message, size);
+	pushMessage(msg);
+}
+
+void ViceConnection::pushMessage(ViceMessage* msg)
+{
+#ifdef VICELOG
+	VICEBinHeader* hdr = (VICEBinHeader*)(msg + 1);
+	int size = msg->size;
 	strown<128> str("Send cmd: $");
 	str.append_num(hdr->commandType, 2, 16).append(" (").append(ViceBinCmdName(hdr->commandType));
 	str.append(") ReqID: ").append_num(hdr->GetReqID(), 0, 16);
@@ -995,36 +1923,318 @@ void ViceConnection::AddMessage(uint8_t* message, int size, bool wantResponse)
 	OutputDebugStringA(str.c_str());
 #endif
 
-#ifdef SEND_IMMEDIATE
-	if (wantResponse) {
-		MessageRequestTimeout to = { ((VICEBinHeader*)message)->GetReqID(), 0 };
-		IBMutexLock(&msgSendMutex);
-		sMessageTimeouts.push_back(to);
-		IBMutexRelease(&msgSendMutex);
+	// push onto the lock free send stack, the flush reverses it back into order
+	ViceMessage* head = sendQueue.load(std::memory_order_relaxed);
+	do {
+		msg->next = head;
+	} while (!sendQueue.compare_exchange_weak(head, msg, std::memory_order_release, std::memory_order_relaxed));
+
+	// the connection thread flushes before it goes back to waiting so commands
+	// issued from response handlers are coalesced, other threads wake it up
+	if (!sOnConnectionThread) { Wake(); }
+}
+
+// attach a continuation, false if the request is done and its data applied
+bool ViceConnection::Then(ViceRequest request, ViceRequestDone done, void* user)
+{
+	IBMutexLock(&msgSendMutex);
+	PendingRequest* found = pending.Find(request);
+	bool attached = found != nullptr;
+	if (found) {
+		found->done = done;
+		found->user = user;
+	} else if (AnsweredRequest* waiting = answered.Value(request)) {
+		waiting->done = done;
+		waiting->user = user;
+		attached = true;
+	}
+	IBMutexRelease(&msgSendMutex);
+	return attached;
+}
+
+// UI thread, the continuation attached after the response arrived
+void ViceConnection::TakeAnswered(uint32_t requestID, ViceRequestDone& done, void*& user)
+{
+	IBMutexLock(&msgSendMutex);
+	if (AnsweredRequest* waiting = answered.Value(requestID)) {
+		done = waiting->done;
+		user = waiting->user;
+		answered.Erase(requestID);
 	}
-	send(s, (const char*)message, size, 0);
+	IBMutexRelease(&msgSendMutex);
+}
+
+// connection thread, the connection is going away before the UI has applied the
+// answers, so their continuations get a completion of their own
+void ViceConnection::completeAnswered()
+{
+	std::vector<ViceSnapshot::Completion> waiting;
+	IBMutexLock(&msgSendMutex);
+	for (auto& entry : answered) {
+		if (entry.Value().done) {
+			ViceSnapshot::Completion done = { entry.Value().done, entry.Value().user, entry.Key(), 0 };
+			waiting.push_back(done);
+		}
+	}
+	answered.Clear();
+	IBMutexRelease(&msgSendMutex);
+	snapshot()->completions.insert(snapshot()->completions.end(), waiting.begin(), waiting.end());
+}
+
+bool ViceConnection::IsPending(ViceRequest request)
+{
+	IBMutexLock(&msgSendMutex);
+	bool found = pending.Find(request) != nullptr;
+	IBMutexRelease(&msgSendMutex);
+	return found;
+}
+
+// the connection is gone, let anyone waiting on a response know
+void ViceConnection::abortRequests()
+{
+	std::vector<PendingRequest> aborted;
+	IBMutexLock(&msgSendMutex);
+	pending.TakeCallbacks(aborted);
+	scheduledInFlight = 0;
+	refreshInFlight = 0;
+	IBMutexRelease(&msgSendMutex);
+	for (size_t i = 0, n = aborted.size(); i < n; ++i) {
+		ViceSnapshot::Completion done = { aborted[i].done, aborted[i].user, aborted[i].requestID, VICE_REQUEST_ABORTED };
+		snapshot()->completions.push_back(done);
+	}
+}
+
+// connection thread, requests unanswered for EXPIRE_TICKS complete as aborted so
+// a dropped response doesn't keep the pending window growing for the session
+void ViceConnection::expireRequests()
+{
+	std::vector<PendingRequest> expired;
+	IBMutexLock(&msgSendMutex);
+	pending.TakeExpired(tickCount - EXPIRE_TICKS, expired);
+	for (size_t i = 0, n = expired.size(); i < n; ++i) {
+		if (expired[i].scheduled) {
+			if (scheduledInFlight) { --scheduledInFlight; }
+			if (expired[i].priority < (uint8_t)ViceSchedule::Display && refreshInFlight) { --refreshInFlight; }
+		}
+	}
+	IBMutexRelease(&msgSendMutex);
+	for (size_t i = 0, n = expired.size(); i < n; ++i) {
+		const PendingRequest& request = expired[i];
+		if (request.kind == ViceRequestKind::MemGet) {
+			if (CPU6510* cpu = GetCPU((VICEMemSpaces)request.space)) { cpu->MemoryRequestFailed(request.start, request.end); }
+		}
+		if (request.requestID == checkpointListID) {
+			checkpointListID = 0;
+			relistCheckpoints = true;
+		}
+		ViceSnapshot::Completion done = { request.done, request.user, request.requestID, VICE_REQUEST_ABORTED };
+		snapshot()->completions.push_back(done);
+	}
+	if (building && !refreshOutstanding()) { publishSnapshot(); }
+}
+
+// send everything in the queue, only called from the connection thread
+void ViceConnection::FlushMessages()
+{
+	while (ViceMessage* stack = sendQueue.exchange(nullptr)) {
+		ViceMessage* ordered = nullptr;
+		while (stack) {
+			ViceMessage* next = stack->next;
+			stack->next = ordered;
+			ordered = stack;
+			stack = next;
+		}
+		sendBatch(ordered);
+	}
+}
+
+// write a list of messages with as few syscalls as possible and free them
+bool ViceConnection::sendBatch(ViceMessage* first)
+{
+	bool success = true;
+	while (first) {
+#ifdef _WIN32
+		WSABUF bufs[MAX_SEND_BATCH];
 #else
+		iovec bufs[MAX_SEND_BATCH];
+#endif
+		ViceMessage* batch[MAX_SEND_BATCH];
+		int count = 0;
+		while (first && count < MAX_SEND_BATCH) {
+#ifdef _WIN32
+			bufs[count].buf = (CHAR*)(first + 1);
+			bufs[count].len = (ULONG)first->size;
+#else
+			bufs[count].iov_base = (void*)(first + 1);
+			bufs[count].iov_len = (size_t)first->size;
+#endif
+			batch[count++] = first;
+			first = first->next;
+		}
 
-	ViceMessage* msg = (ViceMessage*)malloc(sizeof(ViceMessage) + size);
-	if (msg) {
-		if (wantResponse) {
-			MessageRequestTimeout to = { ((VICEBinHeader*)message)->GetReqID(), 0 };
-			sMessageTimeouts.push_back(to);
+		if (success) {
+			int b = 0;
+			while (b < count) {
+#ifdef _WIN32
+				DWORD sent = 0;
+				if (WSASend(s, bufs + b, DWORD(count - b), &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+					if (WSAGetLastError() == WSAEWOULDBLOCK) {
+						// the event select made the socket non-blocking, wait for send space
+						fd_set writeSet;
+						FD_ZERO(&writeSet);
+						FD_SET(s, &writeSet);
+						select(0, nullptr, &writeSet, nullptr, nullptr);
+						continue;
+					}
+					success = false;
+					break;
+				}
+#else
+				ssize_t sent = writev(s, bufs + b, count - b);
+				if (sent < 0) {
+					if (errno == EINTR) { continue; }
+					success = false;
+					break;
+				}
+#endif
+				// step past fully sent buffers and trim a partially sent one
+				size_t left = (size_t)sent;
+#ifdef _WIN32
+				while (b < count && left >= bufs[b].len) { left -= bufs[b++].len; }
+				if (b < count) { bufs[b].buf += left; bufs[b].len -= (ULONG)left; }
+#else
+				while (b < count && left >= bufs[b].iov_len) { left -= bufs[b++].iov_len; }
+				if (b < count) {
+					bufs[b].iov_base = (uint8_t*)bufs[b].iov_base + left;
+					bufs[b].iov_len -= left;
+				}
+#endif
+			}
 		}
-		msg->size = size;
-		memcpy(&msg->size + 1, message, size);
-		IBMutexLock(&msgSendMutex);
-		toSend.push(msg);
-		IBMutexRelease(&msgSendMutex);
+		for (int m = 0; m < count; ++m) { free(batch[m]); }
+	}
+	return success;
+}
+
+// drop anything that didn't get sent before the connection closed
+void ViceConnection::DiscardMessages()
+{
+	ViceMessage* msg = sendQueue.exchange(nullptr, std::memory_order_acquire);
+	while (msg) {
+		ViceMessage* next = msg->next;
+		free(msg);
+		msg = next;
+	}
+}
+
+// create the wakeup object the connection thread waits on alongside the socket
+bool ViceConnection::openWake()
+{
+	wakePending = false;
+	IBMutexLock(&msgSendMutex);
+#ifdef _WIN32
+	socketEvent = WSACreateEvent();
+	wakeEvent = WSACreateEvent();
+	bool opened = socketEvent != WSA_INVALID_EVENT && wakeEvent != WSA_INVALID_EVENT &&
+		WSAEventSelect(s, socketEvent, FD_READ | FD_CLOSE) == 0;
+#elif defined(__linux__)
+	wakeRead = wakeWrite = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	bool opened = wakeRead >= 0;
+#else
+	int fds[2];
+	bool opened = pipe(fds) == 0;
+	if (opened) {
+		fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+		wakeRead = fds[0];
+		wakeWrite = fds[1];
 	}
 #endif
+	IBMutexRelease(&msgSendMutex);
+	return opened;
+}
+
+void ViceConnection::closeWake()
+{
+	// a descriptor number can be reused as soon as it is closed
+	IBMutexLock(&msgSendMutex);
+#ifdef _WIN32
+	if (socketEvent != WSA_INVALID_EVENT) { WSACloseEvent(socketEvent); }
+	if (wakeEvent != WSA_INVALID_EVENT) { WSACloseEvent(wakeEvent); }
+	socketEvent = wakeEvent = WSA_INVALID_EVENT;
+#else
+	if (wakeRead >= 0) { ::close(wakeRead); }
+	if (wakeWrite >= 0 && wakeWrite != wakeRead) { ::close(wakeWrite); }
+	wakeRead = wakeWrite = -1;
+#endif
+	IBMutexRelease(&msgSendMutex);
+}
+
+// called from other threads when there is something to send or the connection should close
+void ViceConnection::Wake()
+{
+	// only signal once until the connection thread has caught up
+	if (wakePending.exchange(true)) { return; }
+	IBMutexLock(&msgSendMutex);
+#ifdef _WIN32
+	if (wakeEvent != WSA_INVALID_EVENT) { WSASetEvent(wakeEvent); }
+#else
+	if (wakeWrite >= 0) {
+		uint64_t one = 1;
+	#ifdef __linux__
+		ssize_t written = write(wakeWrite, &one, sizeof(one));
+	#else
+		ssize_t written = write(wakeWrite, &one, 1);
+	#endif
+		(void)written;
+	}
+#endif
+	IBMutexRelease(&msgSendMutex);
+}
+
+void ViceConnection::clearWake()
+{
+	wakePending = false;
+#ifdef _WIN32
+	WSAResetEvent(wakeEvent);
+#else
+	uint64_t count;
+	while (read(wakeRead, &count, sizeof(count)) > 0) {}
+#endif
+}
+
+// block until the socket is readable or Wake is called, no timeout
+int ViceConnection::waitForEvents()
+{
+	int events = 0;
+#ifdef _WIN32
+	WSAEVENT waitOn[2] = { socketEvent, wakeEvent };
+	DWORD result = WSAWaitForMultipleEvents(2, waitOn, FALSE, WSA_INFINITE, FALSE);
+	if (result == WSA_WAIT_FAILED) { return -1; }
+	WSANETWORKEVENTS netEvents;
+	if (WSAEnumNetworkEvents(s, socketEvent, &netEvents) == 0 && (netEvents.lNetworkEvents & (FD_READ | FD_CLOSE))) {
+		events |= WAIT_RECEIVE;
+	}
+	if (WaitForSingleObject(wakeEvent, 0) == WAIT_OBJECT_0) { events |= WAIT_WAKE; }
+#else
+	pollfd fds[2];
+	fds[0].fd = s;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	fds[1].fd = wakeRead;
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+	int result = poll(fds, 2, -1);
+	if (result < 0) { return errno == EINTR ? 0 : -1; }
+	if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) { events |= WAIT_RECEIVE; }
+	if (fds[1].revents & POLLIN) { events |= WAIT_WAKE; }
+#endif
+	return events;
 }
 
 IBThreadRet WINAPI ViceConnection::ViceConnectThread(void* data)
 {
-	IBMutexInit(&userRequestMutex, "User request VICE operations");
 	((ViceConnection*)data)->connectionThread();
-	IBMutexDestroy(&userRequestMutex);
 	if ((void*)viceCon == data) {
 		viceCon = nullptr;
 		delete (ViceConnection*)data;
@@ -24,28 +24,65 @@ bool ViceRunning();
 
 void ViceDisconnect();
 void ViceConnect(const char* ip, uint32_t port);
-void ViceQuit();
-
-void ViceBreak();
-void ViceGo();
-void ViceStep();
-void ViceStepOver();
-void ViceStepOut();
-void ViceRunTo(uint16_t addr);
-bool ViceGetMemory(uint16_t start, uint16_t end, VICEMemSpaces mem);
-bool ViceSetMemory(uint16_t start, uint16_t len, uint8_t* bytes, VICEMemSpaces mem);
-bool ViceSetRegisters(const CPU6510& cpu, uint32_t regMask);
-void ViceStartProgram(const char* loadPrg);
-void ViceReset(uint8_t resetType);
-void ViceRemoveBreakpoint(uint32_t number);
-void ViceToggleBreakpoint(uint32_t number, bool enable);
-void ViceAddCheckpoint(uint16_t start, uint16_t end, bool stop, bool load, bool store, bool exec);
-void ViceAddBreakpoint(uint16_t address);
-void ViceSetCondition(int checkPoint, strref condition);
-void ViceRemoveBreakpointNoList(uint32_t number);
+// handle for a command sent to VICE, 0 if nothing was sent
+typedef uint32_t ViceRequest;
+// called on the UI thread from ViceTickMessage once the response is visible,
+// errorCode is VICE_REQUEST_ABORTED if the connection closed first
+enum { VICE_REQUEST_ABORTED = 0xff };
+typedef void (*ViceRequestDone)(void* user, ViceRequest request, uint8_t errorCode);
+
+bool ViceRequestPending(ViceRequest request);
+// one continuation per request, called on the UI thread once the response is
+// applied, right away if that already happened
+void ViceThen(ViceRequest request, ViceRequestDone done, void* user);
+// done is called once with request 0 and the first error after every request completed
+void ViceWhenAll(const ViceRequest* requests, size_t count, ViceRequestDone done, void* user);
+
+ViceRequest ViceQuit();
+
+// commands sent after ViceBreak are queued behind it so memory can be read
+// and written before VICE reports that it stopped
+ViceRequest ViceBreak();
+ViceRequest ViceGo();
+ViceRequest ViceStep();
+ViceRequest ViceStepOver();
+ViceRequest ViceStepOut();
+ViceRequest ViceRunTo(uint16_t addr);
+ViceRequest ViceGetMemory(uint16_t start, uint16_t end, VICEMemSpaces mem);
+ViceRequest ViceSetMemory(uint16_t start, uint16_t len, uint8_t* bytes, VICEMemSpaces mem);
+// large writes are split into chunks that are all queued at once, the
+// returned request is the last chunk which VICE answers after the others
+ViceRequest ViceUpload(uint16_t start, const uint8_t* data, uint32_t bytes, VICEMemSpaces mem);
+// bytes VICE confirmed out of the bytes queued, false if nothing is uploading
+bool ViceUploadProgress(uint32_t& done, uint32_t& total);
+ViceRequest ViceSetRegisters(const CPU6510& cpu, uint32_t regMask);
+ViceRequest ViceStartProgram(const char* loadPrg);
+ViceRequest ViceReset(uint8_t resetType);
+ViceRequest ViceRemoveBreakpoint(uint32_t number);
+ViceRequest ViceToggleBreakpoint(uint32_t number, bool enable);
+ViceRequest ViceAddCheckpoint(uint16_t start, uint16_t end, bool stop, bool load, bool store, bool exec);
+ViceRequest ViceAddBreakpoint(uint16_t address);
+ViceRequest ViceSetCondition(int checkPoint, strref condition);
+ViceRequest ViceRemoveBreakpointNoList(uint32_t number);
+
+// hits of checkpoints that don't stop, streamed past the breakpoint list.
+// VICE doesn't send the PC of a hit so address is the start of the checkpoint
+struct ViceTraceHit {
+	int64_t time;		// microseconds when the event arrived
+	uint32_t number;
+	uint32_t count;		// VICE hit count of the checkpoint
+	uint16_t address;
+};
+// UI thread, copies out the oldest hits not taken yet and returns how many
+size_t ViceTraceHits(ViceTraceHit* hits, size_t maxHits);
+// hits lost because they were not taken before the stream filled up
+uint64_t ViceTraceHitsDropped();
 
 void ViceWaiting();
 void ViceTickMessage();
+// bumped every time a refresh from VICE is handed to the UI
+uint32_t ViceSnapshotGeneration();
+int64_t ViceStopLatencyMicros();
 
 void ViceLog(strref msg);
 typedef void (*ViceLogger)(void*, const char* text, size_t len);
@@ -26,7 +26,7 @@
 #define SOCKET_ERROR -1
 static void Sleep(int ms)
 {
-	timespec t = { 0, ms * 1000 };
+	timespec t = { ms / 1000, (ms % 1000) * 1000000 };
 	nanosleep(&t, &t);
 }
 #endif
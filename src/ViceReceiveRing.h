@@ -0,0 +1,108 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Receive ring buffer. Complete responses are handed out in place, only a
+// response that wraps around the end of the ring is copied to be contiguous.
+// The ring starts small and doubles when a response doesn't fit.
+struct ViceReceiveRing {
+	enum { MIN_SIZE = 64 * 1024 };
+
+	uint8_t* buffer;
+	size_t size;		// power of two
+	size_t readPos;		// positions keep counting up, masked on access
+	size_t writePos;
+	uint8_t* linear;	// scratch for responses straddling the wrap
+	size_t linearSize;
+
+	ViceReceiveRing() : buffer(nullptr), size(0), readPos(0), writePos(0), linear(nullptr), linearSize(0) {}
+	~ViceReceiveRing() { Free(); }
+
+	bool Init() {
+		Free();
+		buffer = (uint8_t*)malloc(MIN_SIZE);
+		size = buffer ? MIN_SIZE : 0;
+		return buffer != nullptr;
+	}
+
+	void Free() {
+		if (buffer) { free(buffer); }
+		if (linear) { free(linear); }
+		buffer = linear = nullptr;
+		size = linearSize = 0;
+		readPos = writePos = 0;
+	}
+
+	size_t Used() const { return writePos - readPos; }
+
+	// largest contiguous free span for the next recv
+	uint8_t* WriteSpace(size_t& space) {
+		size_t mask = size - 1;
+		size_t w = writePos & mask, r = readPos & mask;
+		if (Used() == size) { space = 0; }
+		else if (w >= r) { space = size - w; }
+		else { space = r - w; }
+		return buffer + w;
+	}
+
+	void Written(size_t bytes) { writePos += bytes; }
+
+	void Consume(size_t bytes) {
+		readPos += bytes;
+		if (readPos == writePos) { readPos = writePos = 0; }	// restart at the front to avoid wrapping
+	}
+
+	void Peek(void* dest, size_t bytes) const {
+		size_t r = readPos & (size - 1);
+		size_t first = size - r < bytes ? size - r : bytes;
+		memcpy(dest, buffer + r, first);
+		if (bytes > first) { memcpy((uint8_t*)dest + first, buffer, bytes - first); }
+	}
+
+	bool Grow(size_t minSize) {
+		size_t newSize = size;
+		while (newSize < minSize) { newSize <<= 1; }
+		if (newSize == size) { return true; }
+		uint8_t* grown = (uint8_t*)malloc(newSize);
+		if (!grown) { return false; }
+		size_t used = Used();
+		Peek(grown, used);
+		free(buffer);
+		buffer = grown;
+		size = newSize;
+		readPos = 0;
+		writePos = used;
+		return true;
+	}
+
+	// next complete response or nullptr if more data is needed
+	VICEBinResponse* NextFrame(uint32_t& bytes) {
+		while (Used()) {
+			if (buffer[readPos & (size - 1)] != 2) {	// not STX, skip to resync
+				Consume(1);
+				continue;
+			}
+			if (Used() < sizeof(VICEBinResponse)) { return nullptr; }
+			VICEBinResponse header;
+			Peek(&header, sizeof(header));
+			bytes = header.GetSize();
+			if (bytes > Used()) {
+				// make sure the whole response can fit in the ring
+				if (bytes > size && !Grow((size_t)bytes)) { return nullptr; }
+				return nullptr;
+			}
+			size_t r = readPos & (size - 1);
+			if (r + bytes <= size) { return (VICEBinResponse*)(buffer + r); }
+			if (linearSize < bytes) {
+				uint8_t* grown = (uint8_t*)realloc(linear, bytes);
+				if (!grown) { return nullptr; }
+				linear = grown;
+				linearSize = bytes;
+			}
+			Peek(linear, bytes);
+			return (VICEBinResponse*)linear;
+		}
+		return nullptr;
+	}
+};
@@ -0,0 +1,92 @@
+// Benchmark of the stop to stop memory diff over the full 64KB, not part of the build.
+// Compares DiffBytesScalar against DiffBytes as compiled, build twice to see both
+// vector paths:
+//
+// build from src/: g++ -O2 -I. bench/DiffBytesBench.cpp -o DiffBytesBench          (SSE2)
+//                  g++ -O2 -mavx2 -I. bench/DiffBytesBench.cpp -o DiffBytesBench   (AVX2)
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "DiffBytes.h"
+
+enum { MEM_SIZE = 0x10000 };
+
+static uint32_t sSeed = 0xd1ff;
+static uint32_t Rand() { sSeed = sSeed * 1664525 + 1013904223; return sSeed >> 8; }
+
+typedef uint32_t (*DiffFunc)(const uint8_t* prev, const uint8_t* next, uint32_t bytes, uint32_t addr, uint8_t* bits);
+
+// best of several runs in microseconds, diffed in 256 byte pages like DiffStops
+static double Time(DiffFunc diff, const uint8_t* prev, const uint8_t* next, uint8_t* bits, uint32_t& count)
+{
+	double best = 1e30;
+	for (int run = 0; run < 50; ++run) {
+		if (bits) { memset(bits, 0, MEM_SIZE / 8); }
+		auto t0 = std::chrono::steady_clock::now();
+		uint32_t total = 0;
+		for (uint32_t p = 0; p < MEM_SIZE; p += 0x100) {
+			total += diff(prev + p, next + p, 0x100, p, bits);
+		}
+		double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+		if (us < best) { best = us; }
+		count = total;
+	}
+	return best;
+}
+
+int main()
+{
+#if defined(__AVX2__)
+	const char* vector = "AVX2";
+#elif defined(DIFF_SSE2)
+	const char* vector = "SSE2";
+#else
+	const char* vector = "none";
+#endif
+	uint8_t* prev = (uint8_t*)malloc(MEM_SIZE);
+	uint8_t* next = (uint8_t*)malloc(MEM_SIZE);
+	uint8_t* bitsScalar = (uint8_t*)malloc(MEM_SIZE / 8);
+	uint8_t* bitsVector = (uint8_t*)malloc(MEM_SIZE / 8);
+	for (uint32_t i = 0; i < MEM_SIZE; ++i) { prev[i] = (uint8_t)Rand(); }
+
+	// fraction of bytes changed between the stops, per 1000
+	const uint32_t densities[] = { 0, 1, 10, 100, 500 };
+	printf("vector path: %s\n", vector);
+	printf("changed   scalar us  vector us  speedup  (bitmap)\n");
+	for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d) {
+		memcpy(next, prev, MEM_SIZE);
+		for (uint32_t i = 0; i < MEM_SIZE; ++i) {
+			if ((Rand() % 1000) < densities[d]) { next[i] ^= 1 + (Rand() % 255); }
+		}
+		for (int withBits = 0; withBits < 2; ++withBits) {
+			uint32_t countScalar, countVector;
+			double scalar = Time(DiffBytesScalar, prev, next, withBits ? bitsScalar : nullptr, countScalar);
+			double vec = Time(DiffBytes, prev, next, withBits ? bitsVector : nullptr, countVector);
+			if (countScalar != countVector || (withBits && memcmp(bitsScalar, bitsVector, MEM_SIZE / 8))) {
+				printf("mismatch at %u/1000 changed\n", densities[d]);
+				return 1;
+			}
+			printf("%5.1f%%  %10.2f %10.2f %7.1fx  %s\n", densities[d] / 10.0, scalar, vec,
+				scalar / vec, withBits ? "yes" : "no");
+		}
+	}
+
+	// unaligned starts and lengths against the scalar reference
+	for (int test = 0; test < 10000; ++test) {
+		uint32_t addr = Rand() % MEM_SIZE;
+		uint32_t bytes = Rand() % (MEM_SIZE - addr + 1);
+		if (bytes > 300) { bytes = Rand() % 300; }
+		memset(bitsScalar, 0, MEM_SIZE / 8);
+		memset(bitsVector, 0, MEM_SIZE / 8);
+		if (DiffBytesScalar(prev + addr, next + addr, bytes, addr, bitsScalar) !=
+			DiffBytes(prev + addr, next + addr, bytes, addr, bitsVector) ||
+			memcmp(bitsScalar, bitsVector, MEM_SIZE / 8)) {
+			printf("mismatch at $%04x, %u bytes\n", addr, bytes);
+			return 1;
+		}
+	}
+	free(prev); free(next); free(bitsScalar); free(bitsVector);
+	return 0;
+}
@@ -0,0 +1,125 @@
+// Benchmark of HashTable against std::unordered_map, not part of the build.
+// Inserts, finds (hits and misses) and erases at 10K to 1M keys, both for
+// random 64 bit keys like the symbol name hashes and for sequential keys
+// like addresses.
+//
+// build from src/: g++ -O2 -I. bench/HashTableBench.cpp -o HashTableBench
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include "HashTable.h"
+
+static uint64_t sSeed = 0x9e3779b97f4a7c15ull;
+static uint64_t Rand()
+{
+	sSeed ^= sSeed << 13; sSeed ^= sSeed >> 7; sSeed ^= sSeed << 17;
+	return sSeed;
+}
+
+typedef std::chrono::steady_clock Clock;
+static double NsPerOp(Clock::time_point start, size_t ops)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (double)ops;
+}
+
+struct Result {
+	double insert, hit, miss, erase;
+	uint64_t check;		// sum of found values so the lookups can't be dropped
+};
+
+static Result RunHashTable(const std::vector<uint64_t>& keys, const std::vector<uint64_t>& missing)
+{
+	Result r = {};
+	HashTable<uint64_t, uint32_t> table;
+	size_t n = keys.size();
+	Clock::time_point t = Clock::now();
+	for (size_t i = 0; i < n; ++i) { table.Insert(keys[i], (uint32_t)i); }
+	r.insert = NsPerOp(t, n);
+	t = Clock::now();
+	for (size_t i = 0; i < n; ++i) { if (uint32_t* v = table.Value(keys[i])) { r.check += *v; } }
+	r.hit = NsPerOp(t, n);
+	t = Clock::now();
+	for (size_t i = 0; i < n; ++i) { if (uint32_t* v = table.Value(missing[i])) { r.check += *v; } }
+	r.miss = NsPerOp(t, n);
+	t = Clock::now();
+	for (size_t i = 0; i < n; i += 2) { table.Erase(keys[i]); }
+	r.erase = NsPerOp(t, n / 2);
+	r.check += table.GetUsed();
+	return r;
+}
+
+static Result RunUnorderedMap(const std::vector<uint64_t>& keys, const std::vector<uint64_t>& missing)
+{
+	Result r = {};
+	std::unordered_map<uint64_t, uint32_t> table;
+	size_t n = keys.size();
+	Clock::time_point t = Clock::now();
+	for (size_t i = 0; i < n; ++i) { table[keys[i]] = (uint32_t)i; }
+	r.insert = NsPerOp(t, n);
+	t = Clock::now();
+	for (size_t i = 0; i < n; ++i) {
+		std::unordered_map<uint64_t, uint32_t>::iterator f = table.find(keys[i]);
+		if (f != table.end()) { r.check += f->second; }
+	}
+	r.hit = NsPerOp(t, n);
+	t = Clock::now();
+	for (size_t i = 0; i < n; ++i) {
+		std::unordered_map<uint64_t, uint32_t>::iterator f = table.find(missing[i]);
+		if (f != table.end()) { r.check += f->second; }
+	}
+	r.miss = NsPerOp(t, n);
+	t = Clock::now();
+	for (size_t i = 0; i < n; i += 2) { table.erase(keys[i]); }
+	r.erase = NsPerOp(t, n / 2);
+	r.check += table.size();
+	return r;
+}
+
+// best of a few runs per operation
+static Result Best(Result (*run)(const std::vector<uint64_t>&, const std::vector<uint64_t>&),
+	const std::vector<uint64_t>& keys, const std::vector<uint64_t>& missing)
+{
+	Result best = run(keys, missing);
+	for (int i = 1; i < 3; ++i) {
+		Result r = run(keys, missing);
+		if (r.insert < best.insert) { best.insert = r.insert; }
+		if (r.hit < best.hit) { best.hit = r.hit; }
+		if (r.miss < best.miss) { best.miss = r.miss; }
+		if (r.erase < best.erase) { best.erase = r.erase; }
+	}
+	return best;
+}
+
+int main()
+{
+	const size_t counts[] = { 10000, 100000, 1000000 };
+	printf("ns per op          keys  insert     hit    miss   erase\n");
+	for (int sequential = 0; sequential < 2; ++sequential) {
+		for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+			size_t n = counts[c];
+			std::vector<uint64_t> keys(n), missing(n);
+			for (size_t i = 0; i < n; ++i) {
+				if (sequential) {
+					keys[i] = i;
+					missing[i] = n + i;
+				} else {
+					keys[i] = Rand() | 1;	// odd keys are stored, even ones are missing
+					missing[i] = Rand() & ~1ull;
+				}
+			}
+			Result table = Best(RunHashTable, keys, missing);
+			Result map = Best(RunUnorderedMap, keys, missing);
+			if (table.check != map.check) {
+				printf("results differ at %zu keys\n", n);
+				return 1;
+			}
+			const char* kind = sequential ? "sequential" : "random";
+			printf("HashTable     %-10s %7zu %7.1f %7.1f %7.1f %7.1f\n", kind, n, table.insert, table.hit, table.miss, table.erase);
+			printf("unordered_map %-10s %7zu %7.1f %7.1f %7.1f %7.1f\n", kind, n, map.insert, map.hit, map.miss, map.erase);
+		}
+	}
+	return 0;
+}
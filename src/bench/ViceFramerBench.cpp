@@ -0,0 +1,136 @@
+// Replay benchmark for the VICE binary monitor receive framer, not part of the build.
+// Feeds a generated response stream through ViceReceiveRing in randomly sized
+// recv chunks and compares against the previous flat buffer + memmove framer.
+//
+// build from src/: g++ -O2 -I. bench/ViceFramerBench.cpp -o ViceFramerBench
+// usage: ViceFramerBench [responses] [percent of 64KB MemGet sized responses]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "struse/struse.h"
+#include "Files.h"
+#include "ViceInterface.h"
+#include "ViceBinInterface.h"
+#include "ViceReceiveRing.h"
+
+static uint32_t sSeed = 0x1ce8b0;
+static uint32_t Rand() { sSeed = sSeed * 1664525 + 1013904223; return sSeed >> 8; }
+
+// mostly small register / checkpoint responses with the occasional full MemGet
+static uint8_t* MakeStream(size_t count, uint32_t largePct, size_t& size)
+{
+	size_t cap = 1024 * 1024, used = 0;
+	uint8_t* stream = (uint8_t*)malloc(cap);
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t body = (Rand() % 100) < largePct ? (2 + 0x10000) : (Rand() % 96);
+		if (used + body + 12 > cap) {
+			while (used + body + 12 > cap) { cap *= 2; }
+			stream = (uint8_t*)realloc(stream, cap);
+		}
+		uint8_t* r = stream + used;
+		r[0] = 2; r[1] = 2;
+		r[2] = (uint8_t)body; r[3] = (uint8_t)(body >> 8); r[4] = (uint8_t)(body >> 16); r[5] = (uint8_t)(body >> 24);
+		r[6] = (uint8_t)Rand(); r[7] = 0;
+		r[8] = (uint8_t)i; r[9] = (uint8_t)(i >> 8); r[10] = (uint8_t)(i >> 16); r[11] = (uint8_t)(i >> 24);
+		for (uint32_t b = 0; b < body; ++b) { r[12 + b] = (uint8_t)(i + b); }
+		used += body + 12;
+	}
+	size = used;
+	return stream;
+}
+
+// checksum touches every byte so both framers do the same work per response
+static bool HandleResponse(VICEBinResponse* resp, uint32_t bytes, uint32_t& expect, uint64_t& sum)
+{
+	if (resp->GetReqID() != expect || resp->GetSize() != bytes) { return false; }
+	uint8_t* body = (uint8_t*)(resp + 1);
+	for (uint32_t b = 0, n = resp->GetLength(); b < n; ++b) { sum += body[b]; }
+	++expect;
+	return true;
+}
+
+static size_t NextChunk(size_t left)
+{
+	size_t chunk = 1 + Rand() % 8192;	// typical TCP segment coalescing
+	return chunk < left ? chunk : left;
+}
+
+static bool RunRing(const uint8_t* stream, size_t size, size_t count, uint64_t& sum)
+{
+	ViceReceiveRing ring;
+	if (!ring.Init()) { return false; }
+	uint32_t expect = 0;
+	size_t pos = 0;
+	sum = 0;
+	while (pos < size) {
+		size_t space;
+		uint8_t* dest = ring.WriteSpace(space);
+		size_t chunk = NextChunk(size - pos);
+		if (chunk > space) { chunk = space; }
+		memcpy(dest, stream + pos, chunk);
+		ring.Written(chunk);
+		pos += chunk;
+		uint32_t bytes;
+		while (VICEBinResponse* resp = ring.NextFrame(bytes)) {
+			if (!HandleResponse(resp, bytes, expect, sum)) { return false; }
+			ring.Consume(bytes);
+		}
+	}
+	return expect == count;
+}
+
+static bool RunFlat(const uint8_t* stream, size_t size, size_t count, uint64_t& sum)
+{
+	const size_t bufSize = 10 * 1024 * 1024;
+	uint8_t* recvBuf = (uint8_t*)malloc(bufSize);
+	size_t bufferRead = 0, pos = 0;
+	uint32_t expect = 0;
+	sum = 0;
+	while (pos < size) {
+		size_t chunk = NextChunk(size - pos);
+		if (chunk > bufSize - bufferRead) { chunk = bufSize - bufferRead; }
+		memcpy(recvBuf + bufferRead, stream + pos, chunk);
+		bufferRead += chunk;
+		pos += chunk;
+		while (bufferRead >= sizeof(VICEBinResponse)) {
+			VICEBinResponse* resp = (VICEBinResponse*)recvBuf;
+			uint32_t bytes = resp->GetSize();
+			if (bytes > bufferRead) { break; }
+			if (!HandleResponse(resp, bytes, expect, sum)) { free(recvBuf); return false; }
+			memmove(recvBuf, recvBuf + bytes, bufferRead - bytes);
+			bufferRead -= bytes;
+		}
+	}
+	free(recvBuf);
+	return expect == count;
+}
+
+int main(int argc, char** argv)
+{
+	size_t count = argc > 1 ? (size_t)atol(argv[1]) : 200000;
+	uint32_t largePct = argc > 2 ? (uint32_t)atoi(argv[2]) : 3;
+	size_t size;
+	uint8_t* stream = MakeStream(count, largePct, size);
+	printf("%zu responses, %u%% MemGet sized, %.1f MB\n", count, largePct, size / (1024.0 * 1024.0));
+
+	const int runs = 5;
+	double best[2] = { 1e30, 1e30 };
+	uint64_t sums[2] = {};
+	for (int run = 0; run < runs; ++run) {
+		for (int f = 0; f < 2; ++f) {
+			sSeed = 0x5eed + run;	// same chunking for both framers
+			auto t0 = std::chrono::steady_clock::now();
+			bool ok = f ? RunFlat(stream, size, count, sums[f]) : RunRing(stream, size, count, sums[f]);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+			if (!ok) { printf("%s framer failed\n", f ? "flat" : "ring"); return 1; }
+			if (ms < best[f]) { best[f] = ms; }
+		}
+	}
+	if (sums[0] != sums[1]) { printf("checksum mismatch\n"); return 1; }
+	printf("ring:         %6.2f ms  %7.1f MB/s\n", best[0], size / (1024.0 * 1024.0) / (best[0] / 1000.0));
+	printf("flat+memmove: %6.2f ms  %7.1f MB/s\n", best[1], size / (1024.0 * 1024.0) / (best[1] / 1000.0));
+	free(stream);
+	return 0;
+}
@@ -35,6 +35,7 @@ int IBMutexLock(IBMutex* mutex);
 bool IBMutexRelease(IBMutex* mutex);
 bool IBCreateThread(IBThread* thread, size_t stackSize, IBThreadFunc func, void* param);
 bool IBDestroyThread(IBThread* thread);
+bool IBReleaseThread(IBThread* thread);
 
 void CopyBitmapToClipboard(void* bitmap, int width, int height);
 
@@ -150,7 +150,7 @@ void BreakpointView::Draw()
 	ImVec2 winSize = ImGui::GetWindowSize();
 
 	float fontHgt = ImGui::GetFont()->FontSize;
-	if (ImGui::BeginTable("##breakpointstable", 5, flags)) {
+	if (ImGui::BeginTable("##breakpointstable", 6, flags)) {
 		size_t numBreakpoints = NumBreakpoints();
 
 		ImGui::TableSetupColumn("B", ImGuiTableColumnFlags_WidthFixed);
@@ -158,6 +158,11 @@ void BreakpointView::Draw()
 		ImGui::TableSetupColumn("Addr ", ImGuiTableColumnFlags_WidthStretch);
 		ImGui::TableSetupColumn("Label", ImGuiTableColumnFlags_WidthStretch);
 		ImGui::TableSetupColumn("Condition", ImGuiTableColumnFlags_WidthStretch);
+		// hits carry the count from VICE so a lost hit only delays the count until the next one
+		strown<48> hitsHeader("Hits");
+		if (uint64_t dropped = ViceTraceHitsDropped()) { hitsHeader.sprintf_append(" (%llu lost)", (unsigned long long)dropped); }
+		hitsHeader.append("###Hits");
+		ImGui::TableSetupColumn(hitsHeader.c_str(), ImGuiTableColumnFlags_WidthFixed);
 		ImGui::TableSetupScrollFreeze(0, 1); // Make row always visible
 		ImGui::TableHeadersRow();
 
@@ -253,6 +258,10 @@ void BreakpointView::Draw()
 				} else if (bp.condition) {
 					ImGui::Text("%s", bp.condition);
 				}
+				ImGui::TableSetColumnIndex(col++);
+				if (!(bp.flags & Breakpoint::Stop)) {
+					ImGui::Text("%u", TraceHitCount(bp.number));
+				}
 			}
 		}
 		if (!was_selected) {
@@ -19,7 +19,7 @@
 #include "../SourceDebug.h"
 #include "../CodeColoring.h"
 
-CodeView::CodeView() : open(false), evalAddress(false)
+CodeView::CodeView() : evalGeneration(0), open(false), evalAddress(false)
 {
 	srcColDif = 0;
 	showAddress = true;
@@ -225,8 +225,10 @@ void CodeView::Draw(int index)
 	if (ImGui::InputText("address", address, sizeof(address), ImGuiInputTextFlags_EnterReturnsTrue)) {
 		fixedAddress = address[0]=='=';
 		SetAddr(ValueFromExpression(address+(fixedAddress ? 1 : 0)));
-	} else if (evalAddress||(fixedAddress && cpu->MemoryChange())) {
+	} else if (evalAddress||(fixedAddress && (cpu->MemoryChange() || evalGeneration != ViceSnapshotGeneration()))) {
+		// registers only change with a new snapshot
 		SetAddr(ValueFromExpression(address+(fixedAddress ? 1 : 0)));
+		evalGeneration = ViceSnapshotGeneration();
 		evalAddress = false;
 	}
 
@@ -362,6 +364,16 @@ void CodeView::Draw(int index)
 		}
 	} else { srcColDrag = -1.0f; }
 
+	// at most 3 bytes per line
+	cpu->WantMemory(addrValue, (uint32_t)addrValue + lines * 3);
+
+	// exec breakpoints on screen in one query
+	enum { MAX_SHOWN_BREAKPOINTS = 64 };
+	Breakpoint shownBreakpoints[MAX_SHOWN_BREAKPOINTS];
+	uint32_t shownEnd = (uint32_t)addrValue + lines * 3;
+	size_t numShownBreakpoints = BreakpointsInRange(addrValue, (uint16_t)shownEnd, Breakpoint::Exec,
+		shownBreakpoints, MAX_SHOWN_BREAKPOINTS);
+
 	strown<128> line;
 	uint16_t read = addrValue;
 	int lineNum = 0;
@@ -511,7 +523,14 @@ void CodeView::Draw(int index)
 			}
 		// breakpoints
 			Breakpoint bp;
-			if (BreakpointAt(read, bp)) {
+			bool hasBreakpoint = false;
+			for (size_t b = 0; b < numShownBreakpoints && !hasBreakpoint; ++b) {
+				if (shownBreakpoints[b].start == read) {
+					bp = shownBreakpoints[b];
+					hasBreakpoint = true;
+				}
+			}
+			if (hasBreakpoint) {
 				ImVec2 savePos = ImGui::GetCursorPos();
 				ImGui::SetCursorPos(linePos);
 				DrawTexturedIcon((bp.flags & Breakpoint::Enabled) ? ViceMonIcons::VMI_BreakPoint : ViceMonIcons::VMI_DisabledBreakPoint, false, fontCharWidth);
@@ -14,6 +14,7 @@ struct CodeView
 	uint16_t addrCursor;
 	uint16_t lastShownPC;
 	uint16_t lastShownAddress;
+	uint32_t evalGeneration;	// ViceSnapshotGeneration the fixed address was evaluated for
 
 	CodeView();
 
@@ -497,11 +497,7 @@ void IceConsole::ExecCommand(const char* command_line)
 	} else if (cmd.same_str("gfxsave")) {
 		if (!ViceConnected()) { AddLog("VICE Not Connected Error"); }
 		else {
-			strref arg = param.valid() ? param : strref("gfxsave");
-			const char* mode = CommandGfxSave(arg);
-			AddLog("Exported " STRREF_FMT ".txt, " STRREF_FMT ".scr (screen),\n"
-				STRREF_FMT ".col (color mem) and " STRREF_FMT ".chr (characters)\nfor graphics mode %s\n",
-				STRREF_ARG(arg), STRREF_ARG(arg), STRREF_ARG(arg), STRREF_ARG(arg), mode);
+			CommandGfxSave(param.valid() ? param : strref("gfxsave"));
 		}
 	} else if (cmd.same_str("commands") || cmd.same_str("cmd")) {
 		if (param.same_str("remember")) {
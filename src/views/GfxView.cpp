@@ -720,7 +720,8 @@ void GfxView::Draw(int index)
 	if (HandleContextMenu()) { redraw = true; }
 
 	CPU6510* cpu = GetCurrCPU();
-	if (!bitmap || redraw || reeval || cpu->MemoryChange()) {
+	WantMemory(cpu);
+	if (!bitmap || redraw || reeval || (cpu->MemoryChange() && cpu->PagesChanged(shownPages))) {
 		Create8bppBitmap(cpu);
 		reeval = false;
 	}
@@ -850,6 +851,53 @@ void GfxView::PrintHoverInfo(CPU6510* cpu, int *hoverPos, int mode, uint16_t scr
 	info_text[1] = line;
 }
 
+// memory decoded by the current mode is fetched first when VICE stops,
+// anything else read while drawing is fetched when it turns out stale
+void GfxView::Want(CPU6510* cpu, uint32_t start, uint32_t end)
+{
+	cpu->WantMemory(start, end);
+	CPU6510::PagesInRange(shownPages, start, end);
+}
+
+void GfxView::WantMemory(CPU6510* cpu)
+{
+	for (int w = 0; w < CPU6510::PAGE_WORDS; ++w) { shownPages[w] = 0; }
+	switch (displaySystem) {
+		case System::C64: Want(cpu, 0xd000, 0xd02e); Want(cpu, 0xd800, 0xdbff); break;
+		case System::Vic20: Want(cpu, 0x9000, 0x900f); Want(cpu, 0x9400, 0x97ff); break;
+		case System::Plus4: Want(cpu, 0xff00, 0xff1f); break;
+	}
+
+	uint32_t cells = columns * rows;
+	switch (displayMode) {
+		case C64_Current: {
+			uint16_t vic = (3 ^ (cpu->GetByte(0xdd00) & 3)) * 0x4000;
+			Want(cpu, 0xdd00, 0xdd00);
+			Want(cpu, vic, vic + 0x3fff);
+			break;
+		}
+		case V20_Current:
+		case Plus4_Current:
+			// reads all over memory, redraw on any change
+			for (int w = 0; w < CPU6510::PAGE_WORDS; ++w) { shownPages[w] = ~0ull; }
+			break;
+		case V20_Text:
+			cells = (uint32_t)v20Columns * v20Rows;
+			Want(cpu, v20GfxAddr, v20GfxAddr + cells * (vic20DoubleHeightChars ? 16 : 8));
+			Want(cpu, v20ScreenAddr, v20ScreenAddr + cells);
+			Want(cpu, v20ColorAddr, v20ColorAddr + cells);
+			break;
+		case C64_Sprites:
+			Want(cpu, addrGfxValue, addrGfxValue + columns_sprite * rows_sprite * 64);
+			break;
+		default:
+			Want(cpu, addrGfxValue, addrGfxValue + cells * 8);
+			Want(cpu, addrScreenValue, addrScreenValue + cells);
+			Want(cpu, addrColValue, addrColValue + cells);
+			break;
+	}
+}
+
 void GfxView::Create8bppBitmap(CPU6510* cpu)
 {
 	int cellWid = 8, cellHgt = 8;
@@ -85,6 +85,7 @@ struct GfxView {
 
 	uint8_t* bitmap;
 	size_t bitmapSize;
+	uint64_t shownPages[4];		// memory the bitmap was built from
 	int bitmapWidth;
 	int bitmapHeight;
 
@@ -114,6 +115,8 @@ struct GfxView {
 
 	void Draw(int index);
 	void Create8bppBitmap(CPU6510* cpu);
+	void WantMemory(CPU6510* cpu);
+	void Want(CPU6510* cpu, uint32_t start, uint32_t end);
 	bool HandleContextMenu();
 
 	void CreatePlanarBitmap(CPU6510* cpu, uint32_t* dst, int lines, uint32_t width, const uint32_t* palette);
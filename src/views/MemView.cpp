@@ -10,9 +10,11 @@
 #include "../ImGui_Helper.h"
 #include "../imgui/imgui_internal.h"
 #include "../Sym.h"
+#include "../Breakpoints.h"
+#include "../ViceInterface.h"
 #include "GLFW/glfw3.h"
 
-MemView::MemView() : fixedAddress(false), open(false), evalAddress(false)
+MemView::MemView() : evalGeneration(0), fixedAddress(false), open(false), evalAddress(false)
 {
 	SetAddr(0x400);
 
@@ -106,9 +108,11 @@ void MemView::Draw(int index)
 		}
 	}
 
-	if (evalAddress||(fixedAddress && cpu->MemoryChange())) {
+	if (evalAddress||(fixedAddress && (cpu->MemoryChange() || evalGeneration != ViceSnapshotGeneration()))) {
+		// registers only change with a new snapshot
 		SetAddr(ValueFromExpression(address+(fixedAddress ? 1 : 0)));
 		spanValue = ValueFromExpression(span);
+		evalGeneration = ViceSnapshotGeneration();
 		evalAddress = false;
 	}
 
@@ -239,12 +243,41 @@ void MemView::Draw(int index)
 			}
 		}
 
+		cpu->WantMemory(addrValue, (uint32_t)addrValue + lines * spanWin);
+
+		// load and store checkpoints covering the shown bytes in one query
+		enum { MAX_SHOWN_WATCHES = 64 };
+		Breakpoint watches[MAX_SHOWN_WATCHES];
+		uint32_t shownEnd = (uint32_t)addrValue + lines * spanWin;
+		size_t numWatches = showHex ? BreakpointsInRange(addrValue, (uint16_t)shownEnd,
+			Breakpoint::Load | Breakpoint::Store, watches, MAX_SHOWN_WATCHES) : 0;
+
 		strown<1024> line;
 		uint16_t read = addrValue;
 		for(int lineNum = 0; lineNum < lines; ++lineNum) {
 			line.clear();
 			if (showAddress) { line.append_num(read, 4, 16).append(' ');  }
 			if (showHex) {
+				// mark bytes changed since the last stop behind the text
+				ImVec2 linePos = ImGui::GetCursorScreenPos();
+				linePos.x += fontWidth * (showAddress ? 5 : 0);
+				uint16_t changed = read;
+				for (uint32_t c = 0; c < spanWin; ++c) {
+					if (cpu->ByteChanged(changed++)) {
+						ImVec2 p(linePos.x + fontWidth * 3 * c, linePos.y);
+						ImGui::GetWindowDrawList()->AddRectFilled(p, ImVec2(p.x + fontWidth * 2, p.y + fontHgt),
+							ImColor(255, 64, 64, 96));
+					}
+				}
+				// underline bytes watched by a checkpoint
+				for (size_t w = 0; w < numWatches; ++w) {
+					uint32_t first = watches[w].start > read ? watches[w].start : read;
+					uint32_t last = watches[w].end < (uint32_t)read + spanWin - 1 ? watches[w].end : (uint32_t)read + spanWin - 1;
+					if (first > last) { continue; }
+					ImVec2 p(linePos.x + fontWidth * 3 * (first - read), linePos.y + fontHgt - 2.0f);
+					ImGui::GetWindowDrawList()->AddRectFilled(p, ImVec2(linePos.x + fontWidth * (3 * (last - read) + 2), p.y + 2.0f),
+						(watches[w].flags & Breakpoint::Enabled) ? ImColor(64, 160, 255, 192) : ImColor(128, 128, 128, 160));
+				}
 				uint16_t bytes = read;
 				for (uint32_t c = 0; c<spanWin; ++c) {
 					line.append_num(cpu->GetByte(bytes++), 2, 16).append(' ');
@@ -9,6 +9,7 @@ struct MemView {
 
 	uint32_t addrValue;
 	uint32_t spanValue;
+	uint32_t evalGeneration;	// ViceSnapshotGeneration the fixed address was evaluated for
 
 	int cursor[2];
 
@@ -6,6 +6,7 @@
 #include "../Config.h"
 #include "../FileDialog.h"
 #include "../Sym.h"
+#include "../DebugLoad.h"
 #include "../StartVice.h"
 #include "ToolBar.h"
 
@@ -115,6 +116,15 @@ void ToolBar::Draw()
 	viceToggle = CenterTextButtonInColumn(ViceConnected() ? "Quit Vice" : "Start Vice") || viceToggle;
 
 	ImGui::Columns(1);
+
+	uint32_t uploaded, uploadSize;
+	if (ViceUploadProgress(uploaded, uploadSize)) {
+		ImGui::ProgressBar((float)uploaded / (float)uploadSize, ImVec2(-1.0f, 0.0f), "Uploading");
+	}
+	float loaded;
+	if (DebugLoadProgress(loaded)) {
+		ImGui::ProgressBar(loaded, ImVec2(-1.0f, 0.0f), "Loading Debug Info");
+	}
 	ImGui::End();
 
 	if (connected && stopGo) {
@@ -150,34 +160,33 @@ void ToolBar::Draw()
 
 	if (const char* loadPrg = LoadProgramReady()) {
 		ViceStartProgram(loadPrg);
-		ReadSymbolsForBinary(loadPrg);
+		QueueDebugLoad(DebugLoadType::SymbolsForBinary, loadPrg);
 	}
 //
 	if (reload) {
 		if (const char* loadPrg = ReloadProgramFile()) {
 			ViceStartProgram(loadPrg);
-			ReadSymbolsForBinary(loadPrg);
+			QueueDebugLoad(DebugLoadType::SymbolsForBinary, loadPrg);
 		}
 	}
 
 	if (reload_info) {
+		// the first of these that loads
+		bool queued = false;
 		if (const char* dbgFile = GetKickDbgFile()) {
-			if (ReadSymbolsFile(dbgFile)) { reload_info = false; }
+			QueueDebugLoad(DebugLoadType::SymbolsFile, dbgFile, queued);
+			queued = true;
 		}
-		if (reload_info) {
-			if (const char* symFile = GetSymbolFilename()) {
-				if (ReadSymbolsFile(symFile)) { reload_info = false; }
-			}
+		if (const char* symFile = GetSymbolFilename()) {
+			QueueDebugLoad(DebugLoadType::SymbolsFile, symFile, queued);
+			queued = true;
 		}
-		if (reload_info) {
-			if (const char* vsFile = GetViceCMDFilename()) {
-				if (ReadSymbolsFile(vsFile)) { reload_info = false; }
-			}
+		if (const char* vsFile = GetViceCMDFilename()) {
+			QueueDebugLoad(DebugLoadType::SymbolsFile, vsFile, queued);
+			queued = true;
 		}
-		if (reload_info) {
-			if (const char* loadPrg = ReloadProgramFile()) {
-				ReadSymbolsForBinary(loadPrg);
-			}
+		if (const char* loadPrg = ReloadProgramFile()) {
+			QueueDebugLoad(DebugLoadType::SymbolsForBinary, loadPrg, queued);
 		}
 	}
 //
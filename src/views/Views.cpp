@@ -18,6 +18,10 @@
 #include "TraceView.h"
 #include "../6510.h"
 #include "../Config.h"
+#include "../HotReload.h"
+#include "../DebugLoad.h"
+#include "../Breakpoints.h"
+#include "../Sym.h"
 #include "../data/C64_Pro_Mono-STYLE.ttf.h"
 #include "../FileDialog.h"
 #include "../SourceDebug.h"
@@ -221,6 +225,9 @@ void ViewContext::SaveState(UserData& conf)
 	conf.AddValue("CodePCHighlight", sCodePCHighlight);
 	conf.AddValue("CodePCHighlightColor", sCodePCColor);
 	conf.AddValue("EmuType", (int)ViceGetEmuType());
+	conf.AddValue("MemoryHistoryKB", (int)(GetMemoryHistoryBudget() >> 10));
+	conf.AddValue("HotReload", HotReloadEnabled() ? 1 : 0);
+	conf.AddValue("HotReloadRestart", HotReloadRestarts() ? 1 : 0);
 }
 
 void ViewContext::LoadState(strref config)
@@ -257,6 +264,12 @@ void ViewContext::LoadState(strref config)
 				sCodePCColor = (uint8_t)value.atoi() & 0xf;
 			} else if(name.same_str("EmuType")) {
 				ViceSetEmuType((VICEEmuType)value.atoi());
+			} else if(name.same_str("MemoryHistoryKB")) {
+				SetMemoryHistoryBudget((size_t)value.atoi() << 10);
+			} else if(name.same_str("HotReload")) {
+				HotReloadEnable(value.atoi() != 0);
+			} else if(name.same_str("HotReloadRestart")) {
+				HotReloadSetRestart(value.atoi() != 0);
 			}
 		}
 		if (type == ConfigParseType::CPT_Struct) {
@@ -316,6 +329,8 @@ void ViewContext::Draw()
 				}
 				if (ImGui::MenuItem("Read .prg to RAM")) { ReadPRGDialog(); }
 				if (ImGui::MenuItem("Reread .prg to RAM")) { GetCurrCPU()->ReadPRGToRAM(ReadPRGFile()); }
+				if (ImGui::MenuItem("Hot Reload Program", NULL, HotReloadEnabled())) { HotReloadEnable(!HotReloadEnabled()); }
+				if (ImGui::MenuItem("Hot Reload Restarts", NULL, HotReloadRestarts())) { HotReloadSetRestart(!HotReloadRestarts()); }
 				if (ImGui::BeginMenu("Paths")) {
 					FileDialogPathMenu();
 					ImGui::EndMenu();
@@ -458,6 +473,10 @@ void ViewContext::Draw()
 	fileView.Draw("Select File");
 	GlobalKeyCheck();
 	ViceTickMessage();
+	HotReloadTick();
+	DebugLoadTick();
+	UpdateTraceHits();
+	FreeReplacedSymbols();
 
 	if (GetCurrCPU()->MemoryChange() && memoryWasChanged) {
 		GetCurrCPU()->WemoryChangeRefreshed();
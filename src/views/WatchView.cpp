@@ -296,6 +296,7 @@ void WatchView::Draw(int index)
 			}
 		}
 		if (rebuildAll) { Evaluate(i); } else if (recalcAll) { EvaluateItem(i); }
+		if (i < numExpressions && types[i] != WatchType::WT_NORMAL) { cpu->WantMemory((uint32_t)values[i], (uint32_t)values[i] + 63); }
 		if (i != editExpression) {
 			if ((i & 1) == 0) { DrawBlueTextLine(); }
 			ImGui::Text("%s", expressions[i].c_str());